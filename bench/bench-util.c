@@ -0,0 +1,223 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * Sampling loop, cache miss counter and command line options shared by the
+ * opsutils benchmarks.
+ *
+ * @file
+ * Source file for the benchmark helpers.
+ *
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "util.h"
+#include "bench-util.h"
+
+#define BENCH_MIN_SAMPLES   8
+
+/*
+ * Returns a monotonic timestamp in nanoseconds.
+ */
+uint64_t
+bench_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int
+bench_compare_u64 (const void *a_, const void *b_)
+{
+    uint64_t a = *(const uint64_t *) a_;
+    uint64_t b = *(const uint64_t *) b_;
+
+    return a < b ? -1 : a > b;
+}
+
+/*
+ * Opens a user-space cache miss counter for the calling thread.
+ */
+void
+bench_counter_open (struct bench_counter *counter)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    counter->fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void
+bench_counter_close (struct bench_counter *counter)
+{
+    if (counter->fd >= 0) {
+        close(counter->fd);
+        counter->fd = -1;
+    }
+}
+
+static void
+bench_counter_start (struct bench_counter *counter)
+{
+    if (counter && counter->fd >= 0) {
+        ioctl(counter->fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter->fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+/*
+ * Stops the counter and returns the number of misses since the start,
+ * or -1 if the counter is not available.
+ */
+static long long
+bench_counter_stop (struct bench_counter *counter)
+{
+    uint64_t value;
+
+    if (!counter || counter->fd < 0) {
+        return -1;
+    }
+    ioctl(counter->fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counter->fd, &value, sizeof value) != sizeof value) {
+        return -1;
+    }
+    return value;
+}
+
+/*
+ * Runs 'op' options->iterations times, timing options->ops_per_sample
+ * calls per sample on inputs 0 to n_inputs - 1 in turn, and fills 'result'
+ * with the per-op statistics. Sampling stops early once the case has run
+ * for options->max_seconds, so that slow cases do not dominate the run
+ * time. 'counter' may be NULL.
+ */
+void
+bench_run (const struct bench_options *options, bench_op_func *op,
+           void *aux, size_t n_inputs, struct bench_counter *counter,
+           struct bench_result *result)
+{
+    uint64_t *samples = xmalloc(options->iterations * sizeof *samples);
+    uint64_t total = 0, start;
+    uint64_t budget = options->max_seconds * 1e9;
+    long ops_per_sample = options->ops_per_sample;
+    long long misses;
+    size_t input = 0;
+    long i, k, n;
+
+    /* Warm up the caches and any lazy initialization. */
+    op(0, aux);
+
+    bench_counter_start(counter);
+    for (i = 0; i < options->iterations; i++) {
+        start = bench_now_ns();
+        for (k = 0; k < ops_per_sample; k++) {
+            op(input, aux);
+            input = (input + 1) % n_inputs;
+        }
+        samples[i] = bench_now_ns() - start;
+        total += samples[i];
+        if (total > budget && i + 1 >= BENCH_MIN_SAMPLES) {
+            i++;
+            break;
+        }
+    }
+    misses = bench_counter_stop(counter);
+    n = i;
+
+    qsort(samples, n, sizeof *samples, bench_compare_u64);
+    result->ops = n * ops_per_sample;
+    result->ns_per_op = (double) total / result->ops;
+    result->p50_ns = (double) samples[n / 2] / ops_per_sample;
+    result->p99_ns = (double) samples[(n * 99) / 100] / ops_per_sample;
+    result->has_cache_misses = misses >= 0;
+    result->cache_misses_per_op = result->has_cache_misses
+        ? (double) misses / result->ops : 0;
+    free(samples);
+}
+
+/*
+ * Handles option 'c' of BENCH_SHORT_OPTIONS, other than -h. Returns false
+ * if 'c' is not one of them.
+ */
+bool
+bench_parse_option (struct bench_options *options, int c, const char *arg)
+{
+    switch (c) {
+    case 'i':
+        options->iterations = strtol(arg, NULL, 10);
+        return true;
+    case 'o':
+        options->ops_per_sample = strtol(arg, NULL, 10);
+        return true;
+    case 't':
+        options->max_seconds = strtod(arg, NULL);
+        return true;
+    case 'r':
+        options->seed = strtoul(arg, NULL, 10);
+        return true;
+    default:
+        return false;
+    }
+}
+
+/*
+ * Returns true if the sampling settings are usable, else prints why not.
+ */
+bool
+bench_options_check (const struct bench_options *options)
+{
+    if (options->iterations <= 0 || options->ops_per_sample <= 0
+        || options->max_seconds <= 0) {
+        fprintf(stderr, "iterations, ops-per-sample and max-seconds must be "
+                "positive\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Prints the help of the options of every benchmark, with their defaults.
+ */
+void
+bench_usage_options (const struct bench_options *options)
+{
+    printf("  -i, --iterations=N     samples per case (default %ld)\n"
+           "  -o, --ops-per-sample=N operations timed per sample (default %ld)\n"
+           "  -t, --max-seconds=N    time budget per case (default %.1f)\n"
+           "  -r, --seed=N           random seed of the inputs\n"
+           "  -h, --help             display this help message\n",
+           options->iterations, options->ops_per_sample,
+           options->max_seconds);
+}
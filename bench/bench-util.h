@@ -0,0 +1,87 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * Sampling loop, cache miss counter and command line options shared by the
+ * opsutils benchmarks.
+ *
+ * @file
+ * Header for the benchmark helpers.
+ *
+ ****************************************************************************/
+
+#ifndef __BENCH_UTIL_H_
+#define __BENCH_UTIL_H_
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Options of every benchmark, for getopt_long(). */
+#define BENCH_SHORT_OPTIONS "i:o:t:r:h"
+#define BENCH_LONG_OPTIONS                                      \
+    {"iterations",     required_argument, NULL, 'i'},           \
+    {"ops-per-sample", required_argument, NULL, 'o'},           \
+    {"max-seconds",    required_argument, NULL, 't'},           \
+    {"seed",           required_argument, NULL, 'r'},           \
+    {"help",           no_argument,       NULL, 'h'}
+
+/* Sampling settings, from the command line. */
+struct bench_options
+{
+    long iterations;            /* Samples per case. */
+    long ops_per_sample;        /* Operations timed per sample. */
+    double max_seconds;         /* Time budget per case. */
+    unsigned int seed;          /* Random seed of the inputs. */
+};
+
+/* Hardware cache miss counter, fd is -1 when unavailable. */
+struct bench_counter
+{
+    int fd;
+};
+
+struct bench_result
+{
+    long ops;
+    double ns_per_op;
+    double p50_ns;
+    double p99_ns;
+    double cache_misses_per_op;
+    bool has_cache_misses;
+};
+
+/* One measured operation on input 'i'. */
+typedef void bench_op_func(size_t i, void *aux);
+
+uint64_t bench_now_ns(void);
+int bench_compare_u64(const void *a, const void *b);
+
+void bench_counter_open(struct bench_counter *counter);
+void bench_counter_close(struct bench_counter *counter);
+
+void bench_run(const struct bench_options *options, bench_op_func *op,
+               void *aux, size_t n_inputs, struct bench_counter *counter,
+               struct bench_result *result);
+
+bool bench_parse_option(struct bench_options *options, int c,
+                        const char *arg);
+bool bench_options_check(const struct bench_options *options);
+void bench_usage_options(const struct bench_options *options);
+
+#endif /* __BENCH_UTIL_H_ */
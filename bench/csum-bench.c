@@ -0,0 +1,312 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * @ingroup ping_send
+ * Microbenchmark for the ping-send Internet checksum.
+ *
+ * Compares ping_checksum() with the 16-bit word loop checksum() used before
+ * it, and the sequence number change of the echo send path, which writes
+ * the one's complement of the sequence number in the payload so that the
+ * checksum stays the same, with summing the whole packet again. The results
+ * of all the implementations, including ping_checksum_update(), are checked
+ * against each other first. Every case prints one JSON object per
+ * line on stdout:
+ *
+ *   {"bench":"...","bytes":N,"ops":N,"ns_per_op":X,"p50_ns":X,
+ *    "p99_ns":X,"gbytes_per_s":X}
+ *
+ * @file
+ * Source file for the opsutils-csum-bench program.
+ *
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "ping-send.h"
+#include "bench-util.h"
+
+#define BENCH_MIN_BYTES     12
+#define BENCH_MAX_BYTES     9216
+/* Offsets of the echo sequence number and of its payload complement. */
+#define BENCH_ECHO_SEQ      6
+#define BENCH_PAYLOAD_SEQ   10
+#define BENCH_BUFFERS       64
+
+/* Command line settings. */
+static struct bench_options bench_options = {
+    .iterations = 20000,
+    .ops_per_sample = 64,
+    .max_seconds = 0.5,
+    .seed = 1,
+};
+
+/* Packets to sum, one per op in turn, and the checksum sink. */
+struct bench_buffers
+{
+    uint8_t data[BENCH_BUFFERS][BENCH_MAX_BYTES];
+    size_t bytes;
+    uint16_t seq;
+    volatile uint16_t sink;
+};
+
+/*
+ * The checksum() loop as it was before ping_checksum(): 16-bit words
+ * summed one at a time into a 32-bit accumulator.
+ */
+static uint16_t
+bench_checksum_legacy (const void *b, int len)
+{
+    const unsigned short *buf = b;
+    unsigned int sum;
+
+    for (sum = 0; len > 1; len -= 2) {
+        sum += *buf++;
+    }
+    if (len == 1) {
+        sum += *(const unsigned char *) buf;
+    }
+    sum = (sum >> 16) + (sum & 0xFFFF);
+    sum += (sum >> 16);
+    return ~sum;
+}
+
+static void
+bench_report (const char *name, const struct bench_buffers *bufs,
+              const struct bench_result *result)
+{
+    printf("{\"bench\":\"%s\",\"bytes\":%zu,\"ops\":%ld,\"ns_per_op\":%.1f,"
+           "\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"gbytes_per_s\":%.2f}\n",
+           name, bufs->bytes, result->ops, result->ns_per_op,
+           result->p50_ns, result->p99_ns, bufs->bytes / result->ns_per_op);
+    fflush(stdout);
+}
+
+/* Measured operations. */
+
+static void
+bench_op_legacy (size_t i, void *bufs_)
+{
+    struct bench_buffers *bufs = bufs_;
+
+    bufs->sink = bench_checksum_legacy(bufs->data[i], bufs->bytes);
+}
+
+static void
+bench_op_checksum (size_t i, void *bufs_)
+{
+    struct bench_buffers *bufs = bufs_;
+
+    bufs->sink = ping_checksum(bufs->data[i], bufs->bytes);
+}
+
+/* Sequence number change, the packet is summed again. */
+static void
+bench_op_seq_resum (size_t i, void *bufs_)
+{
+    struct bench_buffers *bufs = bufs_;
+    uint16_t *seq = (uint16_t *) &bufs->data[i][BENCH_ECHO_SEQ];
+
+    *seq = htons(bufs->seq++);
+    bufs->sink = ping_checksum(bufs->data[i], bufs->bytes);
+}
+
+/*
+ * Sequence number change as done by ping_echo_set_seq(): the payload word
+ * compensates it, so the checksum is left as is.
+ */
+static void
+bench_op_seq_compensated (size_t i, void *bufs_)
+{
+    struct bench_buffers *bufs = bufs_;
+    uint16_t *seq = (uint16_t *) &bufs->data[i][BENCH_ECHO_SEQ];
+    uint16_t *payload_seq = (uint16_t *) &bufs->data[i][BENCH_PAYLOAD_SEQ];
+    uint16_t new_seq = bufs->seq++;
+
+    *seq = htons(new_seq);
+    *payload_seq = htons(~new_seq);
+}
+
+/*
+ * Checks ping_checksum() and the update helpers against the legacy loop,
+ * on every length up to 256 bytes, odd addresses and random patches, and
+ * that a compensated sequence number change keeps the checksum.
+ */
+static bool
+bench_verify (void)
+{
+    uint8_t buf[BENCH_MAX_BYTES + 1];
+    size_t len, off, i;
+
+    for (i = 0; i < sizeof buf; i++) {
+        buf[i] = rand_r(&bench_options.seed);
+    }
+    for (off = 0; off < 2; off++) {
+        for (len = 0; len <= 256; len++) {
+            if (ping_checksum(buf + off, len)
+                != bench_checksum_legacy(buf + off, len)) {
+                fprintf(stderr, "checksum mismatch: %zu bytes at +%zu\n",
+                        len, off);
+                return false;
+            }
+        }
+    }
+    if (ping_checksum(buf, BENCH_MAX_BYTES)
+        != bench_checksum_legacy(buf, BENCH_MAX_BYTES)) {
+        fprintf(stderr, "checksum mismatch: %d bytes\n", BENCH_MAX_BYTES);
+        return false;
+    }
+
+    for (i = 0; i < 100000; i++) {
+        uint16_t word, csum = ping_checksum(buf, 64);
+        uint32_t word32;
+
+        off = (rand_r(&bench_options.seed) % 31) * 2;
+        memcpy(&word, buf + off, sizeof word);
+        if (i % 2) {
+            uint16_t new_word = rand_r(&bench_options.seed);
+
+            memcpy(buf + off, &new_word, sizeof new_word);
+            csum = ping_checksum_update(csum, word, new_word);
+        } else {
+            uint32_t new_word = rand_r(&bench_options.seed);
+
+            memcpy(&word32, buf + off, sizeof word32);
+            memcpy(buf + off, &new_word, sizeof new_word);
+            csum = ping_checksum_update32(csum, word32, new_word);
+        }
+        if (csum != bench_checksum_legacy(buf, 64)) {
+            fprintf(stderr, "incremental checksum mismatch at %zu\n", off);
+            return false;
+        }
+    }
+
+    for (i = 0; i < 65536; i++) {
+        uint16_t csum = ping_checksum(buf, 64);
+        uint16_t seq = htons(i), payload_seq = htons((uint16_t) ~i);
+
+        memcpy(buf + BENCH_ECHO_SEQ, &seq, sizeof seq);
+        memcpy(buf + BENCH_PAYLOAD_SEQ, &payload_seq, sizeof payload_seq);
+        if (i && csum != ping_checksum(buf, 64)) {
+            fprintf(stderr, "compensated sequence %zu changed the checksum\n",
+                    i);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+bench_size (struct bench_buffers *bufs, size_t bytes)
+{
+    struct bench_result result;
+
+    bufs->bytes = bytes;
+
+    bench_run(&bench_options, bench_op_legacy, bufs, BENCH_BUFFERS, NULL,
+              &result);
+    bench_report("checksum_legacy", bufs, &result);
+
+    bench_run(&bench_options, bench_op_checksum, bufs, BENCH_BUFFERS, NULL,
+              &result);
+    bench_report("ping_checksum", bufs, &result);
+
+    bench_run(&bench_options, bench_op_seq_resum, bufs, BENCH_BUFFERS, NULL,
+              &result);
+    bench_report("seq_change_resum", bufs, &result);
+
+    bench_run(&bench_options, bench_op_seq_compensated, bufs, BENCH_BUFFERS,
+              NULL, &result);
+    bench_report("seq_change_compensated", bufs, &result);
+}
+
+static void
+usage (const char *program)
+{
+    printf("%s: benchmark for the ping-send checksum\n"
+           "usage: %s [OPTIONS]\n"
+           "  -b, --bytes=N          packet size, at most %d\n"
+           "                         (default 20,64,576,1500,9000)\n",
+           program, program, BENCH_MAX_BYTES);
+    bench_usage_options(&bench_options);
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"bytes",          required_argument, NULL, 'b'},
+        BENCH_LONG_OPTIONS,
+        {NULL, 0, NULL, 0},
+    };
+    size_t default_bytes[] = {20, 64, 576, 1500, 9000};
+    size_t *bytes = default_bytes;
+    size_t n_bytes = ARRAY_SIZE(default_bytes);
+    struct bench_buffers *bufs;
+    size_t one_bytes, i, j;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "b:" BENCH_SHORT_OPTIONS, long_options,
+                            NULL)) != -1) {
+        switch (c) {
+        case 'b':
+            one_bytes = strtoul(optarg, NULL, 10);
+            if (one_bytes < BENCH_MIN_BYTES || one_bytes > BENCH_MAX_BYTES) {
+                fprintf(stderr, "bytes must be between %d and %d\n",
+                        BENCH_MIN_BYTES, BENCH_MAX_BYTES);
+                return EXIT_FAILURE;
+            }
+            bytes = &one_bytes;
+            n_bytes = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            if (!bench_parse_option(&bench_options, c, optarg)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+    }
+    if (!bench_options_check(&bench_options)) {
+        return EXIT_FAILURE;
+    }
+
+    if (!bench_verify()) {
+        return EXIT_FAILURE;
+    }
+
+    bufs = xmalloc(sizeof *bufs);
+    for (i = 0; i < BENCH_BUFFERS; i++) {
+        for (j = 0; j < BENCH_MAX_BYTES; j++) {
+            bufs->data[i][j] = rand_r(&bench_options.seed);
+        }
+    }
+    bufs->seq = 0;
+    for (i = 0; i < n_bytes; i++) {
+        bench_size(bufs, bytes[i]);
+    }
+    free(bufs);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,422 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * @ingroup l3_utils
+ * Scale benchmark for the l3-utils address overlap checks.
+ *
+ * VRF and Port rows are built in memory, so no ovsdb-server is needed.
+ * Every case prints one JSON object per line on stdout:
+ *
+ *   {"bench":"...","ports":N,"secondaries":N,"addresses":N,"ops":N,
+ *    "ns_per_op":X,"p50_ns":X,"p99_ns":X,"cache_misses_per_op":X}
+ *
+ * cache_misses_per_op is null when perf_event_open is not available.
+ *
+ * @file
+ * Source file for the opsutils-l3-bench program.
+ *
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "vrf-utils.h"
+#include "l3-utils.h"
+#include "bench-util.h"
+
+#define BENCH_MAX_SECONDARIES   64
+#define BENCH_QUERIES           1024
+#define BENCH_MAX_CONFLICTS     16
+
+/* Command line settings. */
+static struct bench_options bench_options = {
+    .iterations = 2000,
+    .ops_per_sample = 8,
+    .max_seconds = 1.0,
+    .seed = 1,
+};
+
+/* In-memory VRF fixture. */
+struct bench_fixture
+{
+    struct ovsrec_vrf vrf;
+    struct ovsrec_port *ports;
+    size_t n_ports;
+    size_t n_secondaries;
+    size_t n_addresses;
+};
+
+/* Query prefixes, in both string and binary form. */
+struct bench_queries
+{
+    char *v4[BENCH_QUERIES];
+    char *v6[BENCH_QUERIES];
+    uint32_t v4_addrs[BENCH_QUERIES];
+    unsigned int v4_mask_bits[BENCH_QUERIES];
+};
+
+/* What a measured operation works on. */
+struct bench_case
+{
+    const struct bench_fixture *fx;
+    const struct bench_queries *q;
+    void *aux;
+};
+
+/*
+ * Builds a VRF with n_ports ports. Every port has an IPv4 primary address
+ * and n_secondaries IPv4 secondaries, every other port also has IPv6
+ * primary and secondary addresses. All the subnets are distinct.
+ */
+static void
+bench_fixture_build (struct bench_fixture *fx, size_t n_ports,
+                     size_t n_secondaries)
+{
+    size_t p, k;
+
+    memset(fx, 0, sizeof *fx);
+    fx->n_ports = n_ports;
+    fx->n_secondaries = n_secondaries;
+    fx->ports = xzalloc(n_ports * sizeof *fx->ports);
+    fx->vrf.name = xstrdup("vrf_bench");
+    fx->vrf.ports = xmalloc(n_ports * sizeof *fx->vrf.ports);
+    fx->vrf.n_ports = n_ports;
+
+    for (p = 0; p < n_ports; p++) {
+        struct ovsrec_port *port = &fx->ports[p];
+        bool ipv6 = (p % 2) == 1;
+
+        fx->vrf.ports[p] = port;
+        port->name = xasprintf("%zu", p + 1);
+
+        /* 10.0.0.0/8 carved in /24s for primaries. */
+        port->ip4_address = xasprintf("10.%zu.%zu.1/24", (p >> 8) & 0xff,
+                                      p & 0xff);
+        fx->n_addresses++;
+
+        /* 100.64.0.0/10 carved in /30s for secondaries. */
+        port->n_ip4_address_secondary = n_secondaries;
+        port->ip4_address_secondary =
+            xmalloc((n_secondaries + 1) * sizeof(char *));
+        for (k = 0; k < n_secondaries; k++) {
+            uint32_t index = p * BENCH_MAX_SECONDARIES + k;
+            uint32_t addr = 0x64400000 + index * 4 + 1;
+
+            port->ip4_address_secondary[k] =
+                xasprintf("%u.%u.%u.%u/30", addr >> 24, (addr >> 16) & 0xff,
+                          (addr >> 8) & 0xff, addr & 0xff);
+            fx->n_addresses++;
+        }
+
+        if (ipv6) {
+            port->ip6_address = xasprintf("2001:db8:%zx::1/64", p);
+            fx->n_addresses++;
+            port->n_ip6_address_secondary = n_secondaries;
+            port->ip6_address_secondary =
+                xmalloc((n_secondaries + 1) * sizeof(char *));
+            for (k = 0; k < n_secondaries; k++) {
+                port->ip6_address_secondary[k] =
+                    xasprintf("2001:db8:%zx:%zx::1/64", p, k + 1);
+                fx->n_addresses++;
+            }
+        }
+    }
+}
+
+static void
+bench_fixture_destroy (struct bench_fixture *fx)
+{
+    size_t p, k;
+
+    for (p = 0; p < fx->n_ports; p++) {
+        struct ovsrec_port *port = &fx->ports[p];
+
+        for (k = 0; k < port->n_ip4_address_secondary; k++) {
+            free(port->ip4_address_secondary[k]);
+        }
+        for (k = 0; k < port->n_ip6_address_secondary; k++) {
+            free(port->ip6_address_secondary[k]);
+        }
+        free(port->ip4_address_secondary);
+        free(port->ip6_address_secondary);
+        free(port->ip4_address);
+        free(port->ip6_address);
+        free(port->name);
+    }
+    free(fx->ports);
+    free(fx->vrf.ports);
+    free(fx->vrf.name);
+}
+
+/*
+ * Generates queries that miss every configured subnet, which forces the
+ * overlap checks to walk the whole VRF.
+ */
+static void
+bench_queries_build (struct bench_queries *q)
+{
+    size_t i;
+
+    for (i = 0; i < BENCH_QUERIES; i++) {
+        uint32_t addr = 0xc0a80000 | (rand_r(&bench_options.seed) & 0xffff);
+
+        q->v4[i] = xasprintf("%u.%u.%u.%u/32", addr >> 24,
+                             (addr >> 16) & 0xff, (addr >> 8) & 0xff,
+                             addr & 0xff);
+        q->v4_addrs[i] = addr;
+        q->v4_mask_bits[i] = 32;
+        q->v6[i] = xasprintf("2001:db9:%x::%x/128",
+                             rand_r(&bench_options.seed) & 0xffff,
+                             rand_r(&bench_options.seed) & 0xffff);
+    }
+}
+
+static void
+bench_queries_destroy (struct bench_queries *q)
+{
+    size_t i;
+
+    for (i = 0; i < BENCH_QUERIES; i++) {
+        free(q->v4[i]);
+        free(q->v6[i]);
+    }
+}
+
+static void
+bench_report (const char *name, const struct bench_fixture *fx,
+              const struct bench_result *result)
+{
+    printf("{\"bench\":\"%s\",\"ports\":%zu,\"secondaries\":%zu,"
+           "\"addresses\":%zu,\"ops\":%ld,\"ns_per_op\":%.1f,"
+           "\"p50_ns\":%.1f,\"p99_ns\":%.1f,\"cache_misses_per_op\":",
+           name, fx->n_ports, fx->n_secondaries, fx->n_addresses,
+           result->ops, result->ns_per_op,
+           result->p50_ns, result->p99_ns);
+    if (result->has_cache_misses) {
+        printf("%.2f}\n", result->cache_misses_per_op);
+    } else {
+        printf("null}\n");
+    }
+    fflush(stdout);
+}
+
+/* Measured operations, on query 'i'. */
+
+static void
+bench_op_overlap_v4 (size_t i, void *c_)
+{
+    const struct bench_case *c = c_;
+
+    l3_utils_is_ipaddr_overlapping(c->q->v4[i], "0", AF_INET, false,
+                                   &c->fx->vrf);
+}
+
+static void
+bench_op_overlap_v6 (size_t i, void *c_)
+{
+    const struct bench_case *c = c_;
+
+    l3_utils_is_ipaddr_overlapping(c->q->v6[i], "0", AF_INET6, false,
+                                   &c->fx->vrf);
+}
+
+static void
+bench_op_conflicts_v4 (size_t i, void *c_)
+{
+    const struct bench_case *c = c_;
+
+    l3_utils_ipaddr_conflicts(c->q->v4[i], AF_INET, &c->fx->vrf, c->aux,
+                              BENCH_MAX_CONFLICTS);
+}
+
+static void
+bench_op_conflicts_v6 (size_t i, void *c_)
+{
+    const struct bench_case *c = c_;
+
+    l3_utils_ipaddr_conflicts(c->q->v6[i], AF_INET6, &c->fx->vrf, c->aux,
+                              BENCH_MAX_CONFLICTS);
+}
+
+static void
+bench_op_ipv4_set_build (size_t i OVS_UNUSED, void *c_)
+{
+    const struct bench_case *c = c_;
+
+    l3_utils_ipv4_set_build(c->aux, &c->fx->vrf);
+}
+
+static void
+bench_op_ipv4_set (size_t i, void *c_)
+{
+    const struct bench_case *c = c_;
+
+    l3_utils_ipv4_set_is_overlapping(c->aux, c->q->v4[i], "0", false);
+}
+
+static void
+bench_op_ipv4_set_batch (size_t i, void *c_)
+{
+    const struct bench_case *c = c_;
+
+    /* One op is one prefix, the batch covers the whole query table. */
+    if (i == 0) {
+        l3_utils_ipv4_set_overlaps_batch(c->aux, c->q->v4_addrs,
+                                         c->q->v4_mask_bits, BENCH_QUERIES,
+                                         NULL);
+    }
+}
+
+/*
+ * Runs all the cases for one VRF size.
+ */
+static void
+bench_size (size_t n_ports, size_t n_secondaries,
+            const struct bench_queries *q, struct bench_counter *counter)
+{
+    struct l3_utils_ipaddr_conflict conflicts[BENCH_MAX_CONFLICTS];
+    struct bench_options batch_options;
+    struct l3_utils_ipv4_set set;
+    struct bench_fixture fx;
+    struct bench_result result;
+    struct bench_case c;
+
+    bench_fixture_build(&fx, n_ports, n_secondaries);
+    l3_utils_ipv4_set_init(&set);
+    c.fx = &fx;
+    c.q = q;
+
+    c.aux = NULL;
+    bench_run(&bench_options, bench_op_overlap_v4, &c, BENCH_QUERIES,
+              counter, &result);
+    bench_report("is_ipaddr_overlapping_v4", &fx, &result);
+
+    bench_run(&bench_options, bench_op_overlap_v6, &c, BENCH_QUERIES,
+              counter, &result);
+    bench_report("is_ipaddr_overlapping_v6", &fx, &result);
+
+    c.aux = conflicts;
+    bench_run(&bench_options, bench_op_conflicts_v4, &c, BENCH_QUERIES,
+              counter, &result);
+    bench_report("ipaddr_conflicts_v4", &fx, &result);
+
+    bench_run(&bench_options, bench_op_conflicts_v6, &c, BENCH_QUERIES,
+              counter, &result);
+    bench_report("ipaddr_conflicts_v6", &fx, &result);
+
+    c.aux = &set;
+    bench_run(&bench_options, bench_op_ipv4_set_build, &c, BENCH_QUERIES,
+              counter, &result);
+    bench_report("ipv4_set_build", &fx, &result);
+
+    bench_run(&bench_options, bench_op_ipv4_set, &c, BENCH_QUERIES,
+              counter, &result);
+    bench_report("ipv4_set_is_overlapping", &fx, &result);
+
+    batch_options = bench_options;
+    batch_options.ops_per_sample = BENCH_QUERIES;
+    bench_run(&batch_options, bench_op_ipv4_set_batch, &c, BENCH_QUERIES,
+              counter, &result);
+    bench_report("ipv4_set_overlaps_batch", &fx, &result);
+
+    l3_utils_ipv4_set_destroy(&set);
+    bench_fixture_destroy(&fx);
+}
+
+static void
+usage (const char *program)
+{
+    printf("%s: benchmark for the l3-utils overlap checks\n"
+           "usage: %s [OPTIONS]\n"
+           "  -p, --ports=N          number of ports (default 1,1024,4096)\n"
+           "  -s, --secondaries=N    secondaries per port, at most %d\n"
+           "                         (default 0,8,64)\n",
+           program, program, BENCH_MAX_SECONDARIES);
+    bench_usage_options(&bench_options);
+}
+
+int
+main (int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"ports",          required_argument, NULL, 'p'},
+        {"secondaries",    required_argument, NULL, 's'},
+        BENCH_LONG_OPTIONS,
+        {NULL, 0, NULL, 0},
+    };
+    size_t default_ports[] = {1, 1024, 4096};
+    size_t default_secondaries[] = {0, 8, 64};
+    size_t *ports = default_ports, *secondaries = default_secondaries;
+    size_t n_ports = ARRAY_SIZE(default_ports);
+    size_t n_secondaries = ARRAY_SIZE(default_secondaries);
+    size_t one_port, one_secondary, i, j;
+    struct bench_queries queries;
+    struct bench_counter counter;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "p:s:" BENCH_SHORT_OPTIONS, long_options,
+                            NULL)) != -1) {
+        switch (c) {
+        case 'p':
+            one_port = strtoul(optarg, NULL, 10);
+            if (!one_port || one_port > 16384) {
+                fprintf(stderr, "ports must be between 1 and 16384\n");
+                return EXIT_FAILURE;
+            }
+            ports = &one_port;
+            n_ports = 1;
+            break;
+        case 's':
+            one_secondary = strtoul(optarg, NULL, 10);
+            if (one_secondary > BENCH_MAX_SECONDARIES) {
+                fprintf(stderr, "secondaries must be at most %d\n",
+                        BENCH_MAX_SECONDARIES);
+                return EXIT_FAILURE;
+            }
+            secondaries = &one_secondary;
+            n_secondaries = 1;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            if (!bench_parse_option(&bench_options, c, optarg)) {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        }
+    }
+    if (!bench_options_check(&bench_options)) {
+        return EXIT_FAILURE;
+    }
+
+    bench_counter_open(&counter);
+    bench_queries_build(&queries);
+    for (i = 0; i < n_ports; i++) {
+        for (j = 0; j < n_secondaries; j++) {
+            bench_size(ports[i], secondaries[j], &queries, &counter);
+        }
+    }
+    bench_queries_destroy(&queries);
+    bench_counter_close(&counter);
+    return EXIT_SUCCESS;
+}
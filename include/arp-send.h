@@ -0,0 +1,89 @@
+/*
+ *(c) Copyright 2016 Hewlett Packard Enterprise Development LP.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *   not use this file except in compliance with the License. You may obtain
+ *   a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *   License for the specific language governing permissions and limitations
+ *   under the License.
+ */
+
+/************************************************************************//**
+ * @defgroup arp_send Core Utilities
+ * This library provides common utility functions used by various OpenSwitch
+ * processes.
+ * @{
+ *
+ * @defgroup arp_send_public Public Interface
+ * Public API for the arp_send library.
+ *
+ * Bulk address announcements after a failover (VRRP, MCLAG): gratuitous
+ * ARP for IPv4 addresses and unsolicited neighbor advertisements for IPv6
+ * addresses, sent from a packet socket.
+ * @{
+ *
+ * @file
+ * Header for arp_send library.
+ ***************************************************************************/
+
+#ifndef __ARP_SEND_H_
+#define __ARP_SEND_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <net/ethernet.h>
+
+/* An address to announce. */
+struct arp_announcement
+{
+    int ifindex;                /* Interface to announce on. */
+    int family;                 /* AF_INET for a gratuitous ARP, AF_INET6
+                                 * for an unsolicited neighbor
+                                 * advertisement. */
+    union {
+        struct in_addr ipv4;
+        struct in6_addr ipv6;
+    } addr;
+    struct ether_addr mac;      /* Link-layer address of addr. */
+    bool router;                /* IPv6: set the router flag. */
+};
+
+/************************************************************************//**
+ * Announces addresses. IPv4 addresses are announced with a broadcast ARP
+ * request for the address itself (RFC 5227 ARP announcement), IPv6
+ * addresses with a neighbor advertisement to all nodes with the override
+ * flag set (RFC 4861 section 7.2.6). Frames are sent in batches with
+ * sendmmsg() on a packet socket cached per namespace.
+ *
+ * @param[in]  vrf_ns_name     : VRF namespace of the interfaces, NULL for
+ *                               the namespace of the calling thread.
+ * @param[in]  announcements   : addresses to announce.
+ * @param[in]  n_announcements : number of announcements.
+ *
+ * @return number of frames sent, or -1 if the packet socket could not be
+ *         created.
+ ***************************************************************************/
+extern int arp_send_announcements(const char *vrf_ns_name,
+                                  const struct arp_announcement *announcements,
+                                  size_t n_announcements);
+
+/************************************************************************//**
+ * Closes the cached packet sockets of a VRF namespace.
+ * arp_send_announcements() keeps one packet socket open per namespace,
+ * which keeps the namespace alive: call this when the VRF is deleted.
+ *
+ * @param[in]  vrf_ns_name : namespace name of the deleted VRF, or NULL to
+ *                           close the sockets of all namespaces.
+ ***************************************************************************/
+extern void arp_send_sockets_flush(const char *vrf_ns_name);
+
+#endif /* __ARP_SEND_H_ */
+/** @} end of group arp_send_public */
+/** @} end of group arp_send */
@@ -34,6 +34,13 @@
 #ifndef __L3_UTILS_H_
 #define __L3_UTILS_H_
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "hmap.h"
+#include "vswitch-idl.h"
+#include "nl-utils.h"
+
 /* IP_ADDRESS is of format xxx.xxx.xxx.xxx/MM and max length 18*/
 #define IP_ADDRESS_LENGTH              18
 /* IPV6_ADDRESS is of format xxxx:xxxx:xxxx:xxxx:xxxx:xxxx:AAA.BBB.CCC.DDD/MMM
@@ -45,6 +52,62 @@
 #define IPV4_BITLENGTH_MAX             32
 #define IPV6_BITLENGTH_MAX             128
 
+/* IPv4 or IPv6 prefix in binary form. */
+struct l3_utils_prefix
+{
+    u_char family;                      /* AF_INET or AF_INET6. */
+    unsigned int mask_bits;             /* Subnet mask length. */
+    union {
+        struct in_addr ipv4;            /* Network byte order. */
+        struct in6_addr ipv6;
+    } addr;
+};
+
+/* How the subnet of a checked address relates to a conflicting subnet. */
+enum l3_utils_overlap_relation
+{
+    L3_UTILS_OVERLAP_EQUAL,             /* Same subnet. */
+    L3_UTILS_OVERLAP_CONTAINS,          /* Checked subnet is the larger one. */
+    L3_UTILS_OVERLAP_CONTAINED          /* Checked subnet is the smaller one. */
+};
+
+/* One address of a VRF overlapping a checked address. */
+struct l3_utils_ipaddr_conflict
+{
+    const struct ovsrec_port *port;     /* Port the address is set on. */
+    const char *ip_address;             /* Address as stored in the port. */
+    bool secondary;                     /* true if a secondary address. */
+    enum l3_utils_overlap_relation relation;
+};
+
+/* Per-port address sets, in binary form, as seen at the last IDL run.
+ * Used to work out which addresses were added to or removed from each port
+ * since then. */
+struct l3_utils_addr_snapshot
+{
+    struct hmap ports;          /* Contains "struct l3_utils_port_addrs". */
+    unsigned int idl_seqno;     /* IDL seqno of the last update. */
+    bool has_seqno;             /* false until the first update. */
+};
+
+/* Called for each address to add to or remove from a port. */
+typedef void l3_utils_addr_delta_cb(const char *port_name,
+                                    const struct l3_utils_prefix *prefix,
+                                    bool secondary, bool add, void *aux);
+
+/* Packed per-VRF IPv4 address layout used by the vectorized overlap kernel.
+ * Addresses and masks are stored as parallel arrays in host byte order so
+ * that several entries can be compared against a prefix per instruction. */
+struct l3_utils_ipv4_set
+{
+    uint32_t *addrs;                    /* Addresses, host byte order. */
+    uint32_t *masks;                    /* Subnet masks, host byte order. */
+    const struct ovsrec_port **ports;   /* Port owning each entry. */
+    bool *secondary;                    /* true if entry is a secondary IP. */
+    size_t n;                           /* Number of entries. */
+    size_t allocated;                   /* Allocated number of entries. */
+};
+
 /************************************************************************//**
  * Checks if IPv4 or IPv6 address already configured or not.
  *
@@ -64,6 +127,214 @@ l3_utils_is_ipaddr_overlapping (const char *ip_address,
                                 bool secondary,
                                 const struct ovsrec_vrf *vrf_row);
 
+/************************************************************************//**
+ * Parses an IPv4 or IPv6 address with an optional "/mask" suffix. An address
+ * without a mask is taken as a host address.
+ *
+ * @param[in]  ip_address  : address string, e.g. "10.0.0.1/24".
+ * @param[in]  addr_family : AF_INET or AF_INET6.
+ * @param[out] prefix      : parsed prefix.
+ *
+ * @return true if the address is valid, else false.
+ ***************************************************************************/
+extern bool
+l3_utils_prefix_parse (const char *ip_address, u_char addr_family,
+                       struct l3_utils_prefix *prefix);
+
+/************************************************************************//**
+ * Lists every primary and secondary address of a VRF whose subnet overlaps
+ * the subnet of ip_address, in a single walk of the VRF ports. Results are
+ * written to caller storage, nothing is allocated. The returned pointers
+ * refer to the VRF rows and stay valid until the next IDL run.
+ *
+ * @param[in]  ip_address    : address to check, e.g. "10.0.0.1/24".
+ * @param[in]  addr_family   : AF_INET or AF_INET6.
+ * @param[in]  vrf_row       : VRF whose ports are checked.
+ * @param[out] conflicts     : storage for up to max_conflicts results.
+ * @param[in]  max_conflicts : number of entries in conflicts.
+ *
+ * @return total number of conflicting addresses, which may be larger than
+ *         max_conflicts; only the first max_conflicts are stored.
+ ***************************************************************************/
+extern size_t
+l3_utils_ipaddr_conflicts (const char *ip_address, u_char addr_family,
+                           const struct ovsrec_vrf *vrf_row,
+                           struct l3_utils_ipaddr_conflict *conflicts,
+                           size_t max_conflicts);
+
+/************************************************************************//**
+ * Adds and removes a batch of kernel interface addresses in a VRF.
+ * When validate is set, each address to add is first checked against the
+ * addresses configured on the other ports of the VRF and against the
+ * earlier items of the batch, deletes included; overlapping items fail with
+ * EADDRINUSE and are not sent. The remaining items are programmed with
+ * nl_addr_batch_check(), entering the VRF namespace once, also to find the
+ * names of the interfaces given by ifindex.
+ *
+ * @param[in]  idl      : idl reference to OVSDB
+ * @param[in]  vrf_name : VRF of the interfaces.
+ * @param[in,out] reqs  : addresses to program, 'error' is filled per item.
+ * @param[in]  n_reqs   : number of items in reqs.
+ * @param[in]  validate : true to run the overlap checks first.
+ *
+ * @return number of items that failed, or -1 if the batch could not be sent.
+ ***************************************************************************/
+extern int
+l3_utils_vrf_addr_batch (const struct ovsdb_idl *idl, const char *vrf_name,
+                         struct nl_addr_req *reqs, size_t n_reqs,
+                         bool validate);
+
+/************************************************************************//**
+ * Initializes an empty address snapshot.
+ *
+ * @param[in]  snap : snapshot to initialize.
+ ***************************************************************************/
+extern void
+l3_utils_addr_snapshot_init (struct l3_utils_addr_snapshot *snap);
+
+/************************************************************************//**
+ * Frees the memory held by an address snapshot.
+ *
+ * @param[in]  snap : snapshot to destroy.
+ ***************************************************************************/
+extern void
+l3_utils_addr_snapshot_destroy (struct l3_utils_addr_snapshot *snap);
+
+/************************************************************************//**
+ * Enables IDL change tracking for the Port columns read by address
+ * snapshots (name and the IPv4/IPv6 address columns). Must be called once,
+ * after those columns were added to the idl and before the first
+ * l3_utils_addr_snapshot_update().
+ *
+ * @param[in]  idl  : idl reference to OVSDB.
+ ***************************************************************************/
+extern void
+l3_utils_addr_snapshot_track (struct ovsdb_idl *idl);
+
+/************************************************************************//**
+ * Brings an address snapshot up to date with the Port table and reports the
+ * changes. The first call reads every port; later calls only visit the
+ * ports on the IDL change tracking list, so the idl must be set up with
+ * l3_utils_addr_snapshot_track() and the caller must call this function
+ * on each IDL run before ovsdb_idl_track_clear(). For each port, removals
+ * are reported before additions so that a changed primary address can be
+ * reprogrammed in order, and a renamed port reports under its new name.
+ * A port that was deleted gets all its addresses removed. Nothing is
+ * reported when the IDL seqno did not change since the last call.
+ *
+ * @param[in]  snap : snapshot to update.
+ * @param[in]  idl  : idl reference to OVSDB.
+ * @param[in]  cb   : called for each added or removed address.
+ * @param[in]  aux  : passed to cb.
+ *
+ * @return number of reported changes.
+ ***************************************************************************/
+extern size_t
+l3_utils_addr_snapshot_update (struct l3_utils_addr_snapshot *snap,
+                               const struct ovsdb_idl *idl,
+                               l3_utils_addr_delta_cb *cb, void *aux);
+
+/************************************************************************//**
+ * Initializes an empty packed IPv4 address set.
+ *
+ * @param[in]  set : set to initialize.
+ ***************************************************************************/
+extern void
+l3_utils_ipv4_set_init (struct l3_utils_ipv4_set *set);
+
+/************************************************************************//**
+ * Frees the memory held by a packed IPv4 address set.
+ *
+ * @param[in]  set : set to destroy.
+ ***************************************************************************/
+extern void
+l3_utils_ipv4_set_destroy (struct l3_utils_ipv4_set *set);
+
+/************************************************************************//**
+ * Removes all the entries of a packed IPv4 address set, keeping its memory.
+ *
+ * @param[in]  set : set to clear.
+ ***************************************************************************/
+extern void
+l3_utils_ipv4_set_clear (struct l3_utils_ipv4_set *set);
+
+/************************************************************************//**
+ * Appends an IPv4 address to a packed IPv4 address set.
+ *
+ * @param[in]  set       : set to add the address to.
+ * @param[in]  addr      : IPv4 address in host byte order.
+ * @param[in]  mask_bits : subnet mask length of the address.
+ * @param[in]  port_row  : port on which the address is configured.
+ * @param[in]  secondary : true if the address is a secondary address.
+ ***************************************************************************/
+extern void
+l3_utils_ipv4_set_add (struct l3_utils_ipv4_set *set, uint32_t addr,
+                       unsigned int mask_bits,
+                       const struct ovsrec_port *port_row, bool secondary);
+
+/************************************************************************//**
+ * Rebuilds a packed IPv4 address set from the primary and secondary IPv4
+ * addresses of all the ports of a VRF.
+ *
+ * @param[in]  set     : set to fill, previous contents are discarded.
+ * @param[in]  vrf_row : VRF whose ports are to be loaded.
+ ***************************************************************************/
+extern void
+l3_utils_ipv4_set_build (struct l3_utils_ipv4_set *set,
+                         const struct ovsrec_vrf *vrf_row);
+
+/************************************************************************//**
+ * Finds the first entry of the set, at or after 'start', whose subnet
+ * overlaps the given IPv4 prefix. The comparison uses the AVX2 or SSE4.1
+ * kernel when the CPU supports it and a scalar loop otherwise.
+ *
+ * @param[in]  set       : set to search.
+ * @param[in]  addr      : IPv4 address in host byte order.
+ * @param[in]  mask_bits : subnet mask length of the address.
+ * @param[in]  start     : index of the first entry to look at.
+ *
+ * @return index of the overlapping entry, set->n if there is none.
+ ***************************************************************************/
+extern size_t
+l3_utils_ipv4_set_find (const struct l3_utils_ipv4_set *set, uint32_t addr,
+                        unsigned int mask_bits, size_t start);
+
+/************************************************************************//**
+ * Same check as l3_utils_is_ipaddr_overlapping() for an IPv4 address, done
+ * against a packed set built with l3_utils_ipv4_set_build().
+ *
+ * @param[in]  set        : set built from the VRF of the interface.
+ * @param[in]  ip_address : User configured ip address
+ * @param[in]  if_name    : Interface for which user is configuring IP
+ * @param[in]  secondary  : 1 indicates IP is configured as secondary,
+ *                          0 as primary IP address.
+ *
+ * @return 1 if input ip address is duplicate else 0.
+ ***************************************************************************/
+extern bool
+l3_utils_ipv4_set_is_overlapping (const struct l3_utils_ipv4_set *set,
+                                  const char *ip_address,
+                                  const char *if_name,
+                                  bool secondary);
+
+/************************************************************************//**
+ * Checks a batch of IPv4 prefixes against a packed set.
+ *
+ * @param[in]  set       : set to search.
+ * @param[in]  addrs     : 'n' IPv4 addresses in host byte order.
+ * @param[in]  mask_bits : 'n' subnet mask lengths.
+ * @param[in]  n         : number of prefixes to check.
+ * @param[out] overlaps  : if nonnull, overlaps[i] is set to true when
+ *                         prefix 'i' overlaps an entry of the set.
+ *
+ * @return number of prefixes overlapping an entry of the set.
+ ***************************************************************************/
+extern size_t
+l3_utils_ipv4_set_overlaps_batch (const struct l3_utils_ipv4_set *set,
+                                  const uint32_t *addrs,
+                                  const unsigned int *mask_bits,
+                                  size_t n, bool *overlaps);
+
 #endif /* __L3_UTILS_H_ */
 /** @} end of group l3_utils_public */
 /** @} end of group l3_utils */
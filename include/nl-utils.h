@@ -41,10 +41,13 @@
 #include <sched.h>
 #include <stdbool.h>
 #include <net/if.h>
+#include <netinet/in.h>
+#include <stddef.h>
 
 #define MAX_BUFFER_SIZE        128
 #define MAX_BUFFER_LENGTH      128
 #define SWITCH_NAMESPACE       "swns"
+#define NL_NEIGH_LLADDR_LEN    32
 
 /**************************************************************************
 ***************************************************************************/
@@ -93,6 +96,117 @@ struct nlutils_op_data
     int result;
 };
 
+/**************************************************************************
+* One address to add to or remove from an interface with nl_addr_batch.
+***************************************************************************/
+struct nl_addr_req
+{
+    char ifname[IFNAMSIZ];      /* Interface name, used if ifindex is 0. */
+    int ifindex;                /* Interface index. */
+    int family;                 /* AF_INET or AF_INET6. */
+    unsigned char prefixlen;    /* Subnet mask length. */
+    union {
+        struct in_addr ipv4;
+        struct in6_addr ipv6;
+    } addr;
+    bool add;                   /* true to add, false to delete. */
+    int error;                  /* Set to 0 or to the errno of the item. */
+};
+
+/**************************************************************************
+* One neighbor to resolve with nl_neigh_probe_batch.
+***************************************************************************/
+struct nl_neigh_req
+{
+    const char *ns_name;        /* VRF namespace, NULL for the default. */
+    int ifindex;                /* Interface of the neighbor. */
+    int family;                 /* AF_INET or AF_INET6. */
+    union {
+        struct in_addr ipv4;
+        struct in6_addr ipv6;
+    } addr;
+    int error;                  /* Set to 0 or to the errno of the item. */
+};
+
+/**************************************************************************
+* One nexthop of a route programmed with nl_route_batch.
+***************************************************************************/
+struct nl_route_nexthop
+{
+    int ifindex;                /* Output interface, 0 to let the kernel
+                                 * find it from the gateway. */
+    bool has_gateway;           /* false for a directly connected route. */
+    union {
+        struct in_addr ipv4;
+        struct in6_addr ipv6;
+    } gateway;                  /* Same family as the route. */
+    unsigned char weight;       /* Multipath weight, 0 is the same as 1. */
+};
+
+/**************************************************************************
+* One route to add to or remove from a routing table with nl_route_batch.
+***************************************************************************/
+struct nl_route_req
+{
+    int family;                 /* AF_INET or AF_INET6. */
+    unsigned char prefixlen;    /* Prefix length. */
+    union {
+        struct in_addr ipv4;
+        struct in6_addr ipv6;
+    } prefix;
+    const struct nl_route_nexthop *nexthops; /* Nexthops of the route. */
+    size_t n_nexthops;          /* At least one to add, optional to
+                                 * delete. */
+    uint32_t metric;            /* Route priority. */
+    bool add;                   /* true to add or replace, false to
+                                 * delete. */
+    int error;                  /* Set to 0 or to the errno of the item. */
+};
+
+/**************************************************************************
+* A neighbor of a nl_neigh_cache.
+***************************************************************************/
+struct nl_neigh_entry
+{
+    int ifindex;                /* Interface of the neighbor. */
+    int family;                 /* AF_INET or AF_INET6. */
+    union {
+        struct in_addr ipv4;
+        struct in6_addr ipv6;
+    } addr;
+    unsigned char lladdr[NL_NEIGH_LLADDR_LEN]; /* Link-layer address. */
+    size_t lladdr_len;          /* 0 while unresolved or failed. */
+    uint16_t state;             /* NUD_* state. */
+    uint8_t flags;              /* NTF_* flags. */
+};
+
+struct nl_neigh_cache;
+
+/* nl_neigh_cache_for_each() callback. */
+typedef void nl_neigh_cache_cb(const struct nl_neigh_entry *entry,
+                               void *aux);
+
+/**************************************************************************
+* Counters of one interface, from nl_if_stats_get.
+***************************************************************************/
+struct nl_if_stats
+{
+    int ifindex;
+    struct rtnl_link_stats64 stats;
+};
+
+/**************************************************************************
+* Where an interface is, from nl_intf_locate.
+***************************************************************************/
+struct nl_intf_location
+{
+    char intf_name[IFNAMSIZ];
+    int ifindex;                /* Index in ns_name. */
+    char ns_name[MAX_BUFFER_SIZE]; /* SWITCH_NAMESPACE for the default. */
+    char vrf_name[MAX_BUFFER_SIZE]; /* As given to
+                                     * nl_intf_locator_add_ns(). */
+};
+
 struct rtareq {
     struct nlmsghdr  n;
     struct ifinfomsg i;
@@ -165,6 +279,255 @@ void nl_perform_socket_operation(struct nlutils_op_data *tdata);
  ***************************************************************************/
 int nl_setns_with_name(const char *ns_name);
 
+/***************************************************************************
+ * Adds and removes a batch of interface addresses in a namespace.
+ * The namespace is entered once to open a netlink socket and resolve the
+ * interface names, then all the RTM_NEWADDR/RTM_DELADDR requests are sent
+ * back to back and the kernel acknowledgement of each one is collected in
+ * its 'error' member.
+ *
+ * @param[in]  ns_name : namespace of the interfaces.
+ * @param[in,out] reqs : addresses to program, 'error' is filled per item.
+ * @param[in]  n_reqs  : number of items in reqs.
+ *
+ * @return number of items that failed, or -1 if the batch could not be sent.
+ ***************************************************************************/
+int nl_addr_batch(const char *ns_name, struct nl_addr_req *reqs,
+                  size_t n_reqs);
+
+/* Called by nl_addr_batch_check() for each item of the batch, in order,
+ * with the name of its interface, looked up from its ifindex if it has
+ * none (empty if the interface does not exist). Returns 0 to send the item,
+ * else the errno value to fail it with. */
+typedef int nl_addr_check_fn(const struct nl_addr_req *req,
+                             const char *ifname, void *aux);
+
+/***************************************************************************
+ * Same as nl_addr_batch(), but first passes each item to 'check' while the
+ * namespace is entered to resolve the interfaces, so that a validation
+ * needing interface names costs no additional namespace entry. Items
+ * 'check' rejects are not sent to the kernel.
+ *
+ * @param[in]  ns_name : namespace of the interfaces.
+ * @param[in,out] reqs : addresses to program, 'error' is filled per item.
+ * @param[in]  n_reqs  : number of items in reqs.
+ * @param[in]  check   : validation of each item, may be NULL.
+ * @param[in]  aux     : passed to 'check'.
+ *
+ * @return number of items that failed, or -1 if the batch could not be sent.
+ ***************************************************************************/
+int nl_addr_batch_check(const char *ns_name, struct nl_addr_req *reqs,
+                        size_t n_reqs, nl_addr_check_fn *check, void *aux);
+
+/***************************************************************************
+ * Adds, replaces and removes a batch of routes in a routing table of a
+ * namespace. The namespace is entered once to open a netlink socket, then
+ * all the RTM_NEWROUTE/RTM_DELROUTE requests are sent back to back and the
+ * kernel acknowledgement of each one is collected in its 'error' member.
+ * Routes with several nexthops are sent as one multipath route.
+ *
+ * @param[in]  ns_name : namespace of the VRF.
+ * @param[in]  table   : routing table id, 0 for the main table.
+ * @param[in,out] reqs : routes to program, 'error' is filled per item.
+ * @param[in]  n_reqs  : number of items in reqs.
+ *
+ * @return number of items that failed, or -1 if the batch could not be sent.
+ ***************************************************************************/
+int nl_route_batch(const char *ns_name, uint32_t table,
+                   struct nl_route_req *reqs, size_t n_reqs);
+
+/***************************************************************************
+ * Asks the kernel to resolve a batch of neighbors (ARP for IPv4, neighbor
+ * discovery for IPv6), without sending any packet from user space. Each
+ * item is an RTM_NEWNEIGH request with NTF_USE, which creates the neighbor
+ * entry if needed and starts its resolution, or its NUD_PROBE confirmation
+ * if it is stale. The requests of each namespace are sent back to back and
+ * the kernel acknowledgement of each one is collected in its 'error'
+ * member. The resolution itself completes asynchronously.
+ *
+ * @param[in,out] reqs : neighbors to resolve, 'error' is filled per item.
+ * @param[in]  n_reqs  : number of items in reqs.
+ *
+ * @return number of items that failed, or -1 if a batch could not be sent.
+ ***************************************************************************/
+int nl_neigh_probe_batch(struct nl_neigh_req *reqs, size_t n_reqs);
+
+/***************************************************************************
+ * Creates a cache of the IPv4 and IPv6 neighbor table of a namespace,
+ * keyed by ifindex and address. It is seeded by one RTM_GETNEIGH dump and
+ * kept up to date from RTMGRP_NEIGH events by nl_neigh_cache_run(), so
+ * that lookups and walks do not enter the namespace.
+ *
+ * @param[in]  ns_name : namespace to track, NULL for the default one.
+ *
+ * @return the new cache, or NULL on failure
+ ***************************************************************************/
+struct nl_neigh_cache *nl_neigh_cache_create(const char *ns_name);
+
+/***************************************************************************
+ * Destroys a neighbor cache.
+ *
+ * @param[in]  cache : cache to destroy, may be NULL.
+ ***************************************************************************/
+void nl_neigh_cache_destroy(struct nl_neigh_cache *cache);
+
+/***************************************************************************
+ * Returns a descriptor that becomes readable when nl_neigh_cache_run() has
+ * events to apply. It stays the same for the life of the cache.
+ *
+ * @param[in]  cache : neighbor cache.
+ ***************************************************************************/
+int nl_neigh_cache_fd(const struct nl_neigh_cache *cache);
+
+/***************************************************************************
+ * Applies the pending neighbor events to the cache, without blocking. If
+ * events were lost because the event socket overflowed, the cache is
+ * seeded again from a dump.
+ *
+ * @param[in]  cache : neighbor cache.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+int nl_neigh_cache_run(struct nl_neigh_cache *cache);
+
+/***************************************************************************
+ * Looks up a neighbor in the cache.
+ *
+ * @param[in]  cache   : neighbor cache.
+ * @param[in]  ifindex : interface of the neighbor.
+ * @param[in]  family  : AF_INET or AF_INET6.
+ * @param[in]  addr    : struct in_addr or struct in6_addr of the neighbor.
+ * @param[out] entry   : if not NULL, set to the neighbor when found.
+ *
+ * @return true if the neighbor is in the cache, else false
+ ***************************************************************************/
+bool nl_neigh_cache_lookup(const struct nl_neigh_cache *cache, int ifindex,
+                           int family, const void *addr,
+                           struct nl_neigh_entry *entry);
+
+/***************************************************************************
+ * Calls a function for every neighbor of the cache, in no particular
+ * order. The callback must not modify the cache.
+ *
+ * @param[in]  cache : neighbor cache.
+ * @param[in]  cb    : function to call.
+ * @param[in]  aux   : passed to cb.
+ ***************************************************************************/
+void nl_neigh_cache_for_each(const struct nl_neigh_cache *cache,
+                             nl_neigh_cache_cb *cb, void *aux);
+
+/***************************************************************************
+ * Returns the number of neighbors in the cache.
+ *
+ * @param[in]  cache : neighbor cache.
+ ***************************************************************************/
+size_t nl_neigh_cache_count(const struct nl_neigh_cache *cache);
+
+/***************************************************************************
+ * Returns the 64 bits counters of all the interfaces of a namespace. They
+ * come from one dump of the whole namespace, which is kept and shared by
+ * all the callers for up to 'ttl_ms', so that periodic pollers (SNMP,
+ * telemetry, show commands) do not each enter the namespace. Callers that
+ * need a new dump of the same namespace wait for a single one, without
+ * delaying the callers of other namespaces.
+ *
+ * @param[in]  ns_name : namespace of the interfaces, NULL for the default.
+ * @param[in]  ttl_ms  : maximum age of cached counters, 0 to always dump.
+ * @param[out] stats   : set to an array of counters, to free with free().
+ * @param[out] n_stats : set to the number of interfaces in 'stats'.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+int nl_if_stats_get(const char *ns_name, unsigned int ttl_ms,
+                    struct nl_if_stats **stats, size_t *n_stats);
+
+/***************************************************************************
+ * Drops the cached interface counters of a namespace, e.g. when its VRF is
+ * deleted.
+ *
+ * @param[in]  ns_name : namespace to forget, NULL for all namespaces.
+ ***************************************************************************/
+void nl_if_stats_flush(const char *ns_name);
+
+/***************************************************************************
+ * Sets the VLANs of a port of a VLAN filtering bridge, as stored in OVSDB
+ * by ops_port_set_tag() and ops_port_set_trunks(). VLANs the port has but
+ * that are not given are removed. Consecutive VLANs are sent as ranges
+ * (BRIDGE_VLAN_INFO_RANGE_BEGIN/END) in at most two messages, so trunking
+ * all VLANs costs the same as trunking one.
+ *
+ * @param[in]  ns_name          : namespace of the bridge, NULL for default.
+ * @param[in]  ifindex          : ifindex of the bridge port.
+ * @param[in]  tag              : untagged PVID of the port, 0 for none.
+ * @param[in]  trunk_vlan_ids   : tagged VLANs of the port.
+ * @param[in]  trunk_vlan_count : count of trunk VLANs.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+int nl_bridge_vlan_set(const char *ns_name, int ifindex, int tag,
+                       const int64_t *trunk_vlan_ids, int trunk_vlan_count);
+
+/***************************************************************************
+ * Starts tracking the interfaces of a namespace in the process-wide
+ * interface locator. The namespace is entered once to subscribe to its
+ * RTMGRP_LINK events and dump its links; nl_intf_locator_run() then keeps
+ * the locator current, interfaces moved between tracked namespaces
+ * included. Adding a namespace again only updates its VRF name.
+ *
+ * @param[in]  ns_name  : namespace to track, NULL for the default one.
+ * @param[in]  vrf_name : VRF of the namespace, reported by lookups.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+int nl_intf_locator_add_ns(const char *ns_name, const char *vrf_name);
+
+/***************************************************************************
+ * Stops tracking a namespace, e.g. when its VRF is deleted, and forgets
+ * its interfaces.
+ *
+ * @param[in]  ns_name : namespace to forget, NULL for the default one.
+ ***************************************************************************/
+void nl_intf_locator_remove_ns(const char *ns_name);
+
+/***************************************************************************
+ * Returns a descriptor that becomes readable when nl_intf_locator_run() has
+ * link events to apply, whatever the namespace, or -1 if no namespace was
+ * ever added.
+ ***************************************************************************/
+int nl_intf_locator_fd(void);
+
+/***************************************************************************
+ * Applies the pending link events of the tracked namespaces. A namespace
+ * whose events overflowed its socket is dumped again.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+int nl_intf_locator_run(void);
+
+/***************************************************************************
+ * Finds the namespace holding an interface, without entering any
+ * namespace. Names are only looked up in the tracked namespaces.
+ *
+ * @param[in]  intf_name : interface to look for.
+ * @param[out] loc       : location of the interface, may be NULL.
+ *
+ * @return 0 if found, ENOENT if not, EEXIST if several namespaces have an
+ *         interface with that name (such as "lo"), 'loc' being one of them
+ ***************************************************************************/
+int nl_intf_locate(const char *intf_name, struct nl_intf_location *loc);
+
+/***************************************************************************
+ * Same as nl_intf_locate(), by ifindex. Indexes are allocated per
+ * namespace, so the same one may exist in several namespaces.
+ *
+ * @param[in]  ifindex : interface to look for.
+ * @param[out] loc     : location of the interface, may be NULL.
+ *
+ * @return 0 if found, ENOENT if not, EEXIST if several namespaces have an
+ *         interface with that ifindex, 'loc' being one of them
+ ***************************************************************************/
+int nl_intf_locate_ifindex(int ifindex, struct nl_intf_location *loc);
+
 /***************************************************************************
  * enters mgmt OOBM namespace
  *
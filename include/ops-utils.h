@@ -336,14 +336,16 @@ const struct ovsrec_vlan * ops_get_vlan_by_id(int vlan_id,
                                               struct ovsdb_idl *idl);
 
 /*****************************************************************************
-sends a ICMP_ECHO packet to the target.
+sends a ICMP_ECHO packet to the target, on the cached socket of the
+namespace of the calling thread (see ping_vrf_sockets_flush()).
  @param[in] target: ipv4 address string of the target to ping
  @return void
 ******************************************************************************/
 extern int ping4(const char *target);
 
 /*****************************************************************************
-sends a ICMP6_ECHO_REQUEST packet to the target.
+sends a ICMP6_ECHO_REQUEST packet to the target, on the cached socket of the
+namespace of the calling thread (see ping_vrf_sockets_flush()).
  @param[in] target: ipv6 address string of the target to ping
  @return void
 ******************************************************************************/
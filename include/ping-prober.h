@@ -0,0 +1,184 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/***************************************************************************
+ * @defgroup ping_prober Core Utilities
+ * This library provides common utility functions used by various OpenSwitch
+ * processes.
+ * @{
+ *
+ * @defgroup ping_prober_public Public Interface
+ * Public API for ping_prober library.
+ *
+ * Periodic reachability probing of many targets, for static route tracking
+ * and gateway monitoring. Probes are scheduled on a hierarchical timer
+ * wheel and the probes due in one tick are sent in one batch on a ping
+ * session (see ping-send.h). Reachability changes are reported through a
+ * callback, run from ping_prober_run() when ping_prober_fd() is readable.
+ * @{
+ *
+ * @file
+ * Header for ping_prober library.
+ ***************************************************************************/
+
+#ifndef __PING_PROBER_H_
+#define __PING_PROBER_H_
+
+#include <stdbool.h>
+#include "ping-send.h"
+
+/* Reachability of a prober target. */
+enum ping_prober_state
+{
+    PING_PROBER_UNKNOWN,        /* Not enough probes completed yet. */
+    PING_PROBER_UP,
+    PING_PROBER_DOWN
+};
+
+/* Settings of a prober. Zero selects the default of each field. */
+struct ping_prober_options
+{
+    struct ping_session_options session; /* Sockets, VRF and probe timeout.
+                                          * Up to 65536 probes in flight by
+                                          * default. */
+    unsigned int tick_ms;       /* Timer wheel resolution, 10 ms by
+                                 * default. */
+};
+
+/* Settings of a prober target. Zero selects the default of each field. */
+struct ping_prober_target_options
+{
+    unsigned int interval_ms;   /* Time between probes, 1000 ms by
+                                 * default. */
+    unsigned int jitter_percent; /* Random spread of each interval, in
+                                  * percent of the interval, none by
+                                  * default. */
+    unsigned int min_interval_ms; /* Rate limit: minimum time between two
+                                   * probes, including the ones requested
+                                   * by ping_prober_probe_now(). One tick
+                                   * by default. */
+    unsigned int up_count;      /* Consecutive replies to be up, 1 by
+                                 * default. */
+    unsigned int down_count;    /* Consecutive failures to be down, 3 by
+                                 * default. */
+};
+
+/************************************************************************//**
+ * Reachability change callback.
+ *
+ * @param[in]  target : target whose state changed.
+ * @param[in]  state  : new state.
+ * @param[in]  result : result of the probe that caused the change.
+ * @param[in]  aux    : aux of the target, from ping_prober_add().
+ ***************************************************************************/
+typedef void ping_prober_cb(const struct ping_target *target,
+                            enum ping_prober_state state,
+                            const struct ping_result *result, void *aux);
+
+struct ping_prober;
+
+/************************************************************************//**
+ * Creates a prober.
+ *
+ * @param[in]  options : prober settings, NULL for the defaults.
+ * @param[in]  cb      : reachability change callback.
+ *
+ * @return the new prober, or NULL if its descriptors could not be created.
+ ***************************************************************************/
+extern struct ping_prober *
+ping_prober_create(const struct ping_prober_options *options,
+                   ping_prober_cb *cb);
+
+/************************************************************************//**
+ * Destroys a prober and all its targets, without callbacks.
+ *
+ * @param[in]  prober : prober to destroy, may be NULL.
+ ***************************************************************************/
+extern void ping_prober_destroy(struct ping_prober *prober);
+
+/************************************************************************//**
+ * Starts probing a target. The first probe is sent at a random time within
+ * the first interval, so that targets added together are spread out.
+ *
+ * @param[in]  prober  : prober.
+ * @param[in]  target  : target to probe.
+ * @param[in]  options : target settings, NULL for the defaults.
+ * @param[in]  aux     : passed to the callback.
+ *
+ * @return true if added, false if the target is already probed.
+ ***************************************************************************/
+extern bool ping_prober_add(struct ping_prober *prober,
+                            const struct ping_target *target,
+                            const struct ping_prober_target_options *options,
+                            void *aux);
+
+/************************************************************************//**
+ * Stops probing a target.
+ *
+ * @param[in]  prober : prober.
+ * @param[in]  target : target to stop probing.
+ *
+ * @return true if removed, false if the target was not probed.
+ ***************************************************************************/
+extern bool ping_prober_remove(struct ping_prober *prober,
+                               const struct ping_target *target);
+
+/************************************************************************//**
+ * Probes a target as soon as its rate limit allows, e.g. after a route
+ * change.
+ *
+ * @param[in]  prober : prober.
+ * @param[in]  target : target to probe.
+ ***************************************************************************/
+extern void ping_prober_probe_now(struct ping_prober *prober,
+                                  const struct ping_target *target);
+
+/************************************************************************//**
+ * Returns the reachability of a target.
+ *
+ * @param[in]  prober : prober.
+ * @param[in]  target : target.
+ * @param[out] last   : if not NULL, result of the last completed probe.
+ *
+ * @return the state, PING_PROBER_UNKNOWN if the target is not probed.
+ ***************************************************************************/
+extern enum ping_prober_state
+ping_prober_get_state(const struct ping_prober *prober,
+                      const struct ping_target *target,
+                      struct ping_result *last);
+
+/************************************************************************//**
+ * Sends the probes that are due, reads the replies and runs the callback
+ * for the targets whose state changed. Call when ping_prober_fd() is
+ * readable.
+ *
+ * @param[in]  prober : prober.
+ ***************************************************************************/
+extern void ping_prober_run(struct ping_prober *prober);
+
+/************************************************************************//**
+ * Returns a descriptor that becomes readable when ping_prober_run() has
+ * work to do: replies to read or probes due. It stays the same for the
+ * life of the prober.
+ *
+ * @param[in]  prober : prober.
+ ***************************************************************************/
+extern int ping_prober_fd(const struct ping_prober *prober);
+
+#endif /* __PING_PROBER_H_ */
+/** @} end of group ping_prober_public */
+/** @} end of group ping_prober */
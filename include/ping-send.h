@@ -0,0 +1,423 @@
+/*
+ *(c) Copyright 2016 Hewlett Packard Enterprise Development LP.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *   not use this file except in compliance with the License. You may obtain
+ *   a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *   License for the specific language governing permissions and limitations
+ *   under the License.
+ */
+
+/************************************************************************//**
+ * @defgroup ping_send Core Utilities
+ * This library provides common utility functions used by various OpenSwitch
+ * processes.
+ * @{
+ *
+ * @defgroup ping_send_public Public Interface
+ * Public API for the ping_send library.
+ *
+ * Bulk ICMP and ICMPv6 echo functions. The single target ping4() and
+ * ping6() functions are declared in ops-utils.h.
+ * @{
+ *
+ * @file
+ * Header for ping_send library.
+ ***************************************************************************/
+
+#ifndef __PING_SEND_H_
+#define __PING_SEND_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+struct ovsdb_idl;
+
+/* Address of a host to ping. */
+struct ping_target
+{
+    int family;                 /* AF_INET or AF_INET6. */
+    union {
+        struct in_addr ipv4;
+        struct in6_addr ipv6;
+    } addr;
+};
+
+/* Outcome of an echo probe. */
+enum ping_status
+{
+    PING_PENDING,               /* No answer yet. */
+    PING_REACHABLE,             /* Echo reply received. */
+    PING_UNREACHABLE,           /* ICMP destination unreachable received. */
+    PING_TIME_EXCEEDED,         /* ICMP time exceeded received. */
+    PING_ICMP_ERROR,            /* Other ICMP error received. */
+    PING_TIMEOUT,               /* Nothing received within the timeout. */
+    PING_SEND_FAILED,           /* The echo request could not be sent. */
+    PING_TOO_BIG                /* Larger than the path MTU: ICMP
+                                 * fragmentation needed or packet too big
+                                 * received, or larger than the MTU of the
+                                 * outgoing interface. */
+};
+
+/* Result of one echo probe. */
+struct ping_result
+{
+    enum ping_status status;
+    uint8_t icmp_type;          /* Type and code of the ICMP error, */
+    uint8_t icmp_code;          /* for the ICMP error statuses. */
+    int error;                  /* errno, for PING_SEND_FAILED. */
+    uint32_t mtu;               /* MTU reported for PING_TOO_BIG, 0 if
+                                 * unknown. */
+    uint64_t rtt_ns;            /* Round trip time of the reply or error. */
+    struct ping_target from;    /* Sender of the reply or error. */
+};
+
+/* One echo request queued on a ping session. */
+struct ping_probe
+{
+    struct ping_target target;
+    void *aux;                  /* Returned as is with the result. */
+    uint8_t ttl;                /* TTL or hop limit, 0 for the default. */
+    uint16_t flow;              /* Probes with the same flow have the same
+                                 * ICMP checksum, so ECMP routers keep them
+                                 * on one path. */
+    uint16_t size;              /* IP packet size, 0 for the default
+                                 * 64-byte echo request. Probes are sent
+                                 * with the DF bit set. */
+};
+
+/* Completion of a probe, returned by ping_session_poll(). */
+struct ping_event
+{
+    void *aux;                  /* From the probe. */
+    struct ping_result result;
+};
+
+/* Kind of ICMP sockets used by a ping session. */
+enum ping_mode
+{
+    PING_MODE_RAW,              /* Raw sockets, which need CAP_NET_RAW. */
+    PING_MODE_DGRAM,            /* ICMP datagram sockets, allowed to the
+                                 * groups in net.ipv4.ping_group_range. */
+    PING_MODE_AUTO              /* Datagram sockets if allowed, else raw. */
+};
+
+/* Settings of a ping session. Zero selects the default of each field. */
+struct ping_session_options
+{
+    unsigned int timeout_ms;    /* Probe timeout, 1000 ms by default. */
+    size_t max_outstanding;     /* Probes in flight, 4096 by default and
+                                 * 65536 at most. */
+    const char *vrf_ns_name;    /* VRF namespace to probe from, by default
+                                 * the namespace of the calling thread. */
+    enum ping_mode mode;        /* Raw sockets by default. */
+};
+
+struct ping_session;
+
+/* Settings of a path MTU search. Zero selects the default of each
+ * field. */
+struct ping_pmtu_options
+{
+    struct ping_session_options session; /* Sockets, VRF and probe timeout. */
+    unsigned int min_mtu;       /* Smallest MTU searched, 68 for IPv4 and
+                                 * 1280 for IPv6 by default. */
+    unsigned int max_mtu;       /* Largest MTU searched, 9216 by default. */
+    unsigned int retries;       /* Resends of a probe that timed out before
+                                 * its size is deemed too big, 1 by
+                                 * default. */
+};
+
+/* Settings of a path trace. Zero selects the default of each field. */
+struct ping_trace_options
+{
+    struct ping_session_options session; /* Sockets, VRF and probe timeout.
+                                          * max_outstanding is ignored. */
+    unsigned int max_ttl;       /* Hops probed, 30 by default, 255 at most. */
+    unsigned int n_flows;       /* Paths probed, 1 by default, 256 at most. */
+};
+
+/************************************************************************//**
+ * Fills a ping target from an IPv4 or IPv6 address string.
+ *
+ * @param[in]  address : address string, without mask.
+ * @param[out] target  : target to fill.
+ *
+ * @return true if the address is valid, else false.
+ ***************************************************************************/
+extern bool ping_target_parse(const char *address, struct ping_target *target);
+
+/************************************************************************//**
+ * Computes the Internet checksum (RFC 1071) of a buffer. The result is in
+ * the byte order of the data and can be stored as is in a packet header.
+ *
+ * @param[in]  data : buffer to sum, with its checksum field set to zero.
+ * @param[in]  len  : length of the buffer, odd lengths are allowed.
+ *
+ * @return the checksum.
+ ***************************************************************************/
+extern uint16_t ping_checksum(const void *data, size_t len);
+
+/************************************************************************//**
+ * Updates an Internet checksum after a 16-bit word of the packet changed
+ * (RFC 1624), in constant time. All values are in packet byte order.
+ * The echo send path does not need it, since its payload keeps the
+ * checksum constant across sequence numbers; it is kept for callers that
+ * patch other fields of a built packet.
+ *
+ * @param[in]  csum     : checksum of the packet before the change.
+ * @param[in]  old_word : previous value of the word.
+ * @param[in]  new_word : new value of the word.
+ *
+ * @return the checksum of the changed packet.
+ ***************************************************************************/
+extern uint16_t ping_checksum_update(uint16_t csum, uint16_t old_word,
+                                     uint16_t new_word);
+
+/************************************************************************//**
+ * Same as ping_checksum_update() for a 32-bit field at an even offset,
+ * such as a timestamp.
+ *
+ * @param[in]  csum     : checksum of the packet before the change.
+ * @param[in]  old_word : previous value of the field, as read from memory.
+ * @param[in]  new_word : new value of the field, as written to memory.
+ *
+ * @return the checksum of the changed packet.
+ ***************************************************************************/
+extern uint16_t ping_checksum_update32(uint16_t csum, uint32_t old_word,
+                                       uint32_t new_word);
+
+/************************************************************************//**
+ * Sends one echo request to each target. The packets are built up front and
+ * sent with sendmmsg() on the cached ICMP and ICMPv6 sockets of the
+ * namespace of the calling thread, so the cost per target is a few hundred
+ * bytes of copying rather than a socket setup. Replies are not read.
+ *
+ * @param[in]  targets   : hosts to ping.
+ * @param[in]  n_targets : number of targets.
+ *
+ * @return number of echo requests sent, or -1 if no socket could be opened.
+ ***************************************************************************/
+extern int ping_send_batch(const struct ping_target *targets,
+                           size_t n_targets);
+
+/************************************************************************//**
+ * Same as ping_send_batch(), from a VRF namespace. The sockets of the VRF
+ * are created from a helper thread on first use and then cached, the
+ * calling thread never enters the namespace.
+ *
+ * @param[in]  vrf_ns_name : namespace of the VRF, see get_vrf_ns_from_name().
+ * @param[in]  targets     : hosts to ping.
+ * @param[in]  n_targets   : number of targets.
+ *
+ * @return number of echo requests sent, or -1 if no socket could be opened.
+ ***************************************************************************/
+extern int ping_send_batch_vrf(const char *vrf_ns_name,
+                               const struct ping_target *targets,
+                               size_t n_targets);
+
+/************************************************************************//**
+ * Sends a ICMP_ECHO packet to the target from a VRF, on the cached socket of
+ * the VRF namespace. The calling thread never enters the namespace.
+ *
+ * @param[in]  idl      : idl reference to OVSDB.
+ * @param[in]  vrf_name : name of the VRF.
+ * @param[in]  target   : ipv4 address string of the target to ping.
+ *
+ * @return 0 if successful, else negative value on failure.
+ ***************************************************************************/
+extern int ping4_vrf(const struct ovsdb_idl *idl, const char *vrf_name,
+                     const char *target);
+
+/************************************************************************//**
+ * Sends a ICMP6_ECHO_REQUEST packet to the target from a VRF, on the cached
+ * socket of the VRF namespace. The calling thread never enters the
+ * namespace.
+ *
+ * @param[in]  idl      : idl reference to OVSDB.
+ * @param[in]  vrf_name : name of the VRF.
+ * @param[in]  target   : ipv6 address string of the target to ping.
+ *
+ * @return 0 if successful, else negative value on failure.
+ ***************************************************************************/
+extern int ping6_vrf(const struct ovsdb_idl *idl, const char *vrf_name,
+                     const char *target);
+
+/************************************************************************//**
+ * Same as ping4_vrf(), with the VRF given by table_id.
+ *
+ * @param[in]  idl      : idl reference to OVSDB.
+ * @param[in]  table_id : table_id of the VRF, 0 for the default VRF.
+ * @param[in]  target   : ipv4 address string of the target to ping.
+ *
+ * @return 0 if successful, else negative value on failure.
+ ***************************************************************************/
+extern int ping4_vrf_table_id(const struct ovsdb_idl *idl, int64_t table_id,
+                              const char *target);
+
+/************************************************************************//**
+ * Same as ping6_vrf(), with the VRF given by table_id.
+ *
+ * @param[in]  idl      : idl reference to OVSDB.
+ * @param[in]  table_id : table_id of the VRF, 0 for the default VRF.
+ * @param[in]  target   : ipv6 address string of the target to ping.
+ *
+ * @return 0 if successful, else negative value on failure.
+ ***************************************************************************/
+extern int ping6_vrf_table_id(const struct ovsdb_idl *idl, int64_t table_id,
+                              const char *target);
+
+/************************************************************************//**
+ * Closes the cached send sockets of a VRF namespace. ping4(), ping6() and
+ * ping_send_batch() keep one ICMP and one ICMPv6 socket open per namespace,
+ * and these sockets keep the namespace alive: call this when the VRF is
+ * deleted.
+ *
+ * @param[in]  vrf_ns_name : namespace name of the deleted VRF, or NULL to
+ *                           close the sockets of all namespaces.
+ ***************************************************************************/
+extern void ping_vrf_sockets_flush(const char *vrf_ns_name);
+
+/************************************************************************//**
+ * Creates a ping session. A session owns its ICMP and ICMPv6 sockets, a
+ * unique echo id, and a table of outstanding probes indexed by sequence
+ * number. With datagram sockets the kernel sets the echo id, computes the
+ * checksums and only queues the replies to the session, and ICMP errors
+ * are read from the socket error queue. Replies and ICMP errors are read
+ * in batches with recvmmsg() and matched back to the probe that caused
+ * them. RTTs are measured from the kernel receive timestamp
+ * (SO_TIMESTAMPNS). A session is not thread safe.
+ *
+ * @param[in]  options : session settings, NULL for the defaults.
+ *
+ * @return the new session.
+ ***************************************************************************/
+extern struct ping_session *
+ping_session_create(const struct ping_session_options *options);
+
+/************************************************************************//**
+ * Destroys a ping session. Outstanding probes are dropped without events.
+ *
+ * @param[in]  session : session to destroy, may be NULL.
+ ***************************************************************************/
+extern void ping_session_destroy(struct ping_session *session);
+
+/************************************************************************//**
+ * Sends echo requests on a session. Probes are accepted in order while the
+ * outstanding table has room. Every accepted probe completes with exactly
+ * one event from ping_session_poll(), including probes whose send failed.
+ *
+ * @param[in]  session  : session to send on.
+ * @param[in]  probes   : probes to send.
+ * @param[in]  n_probes : number of probes.
+ *
+ * @return number of probes accepted.
+ ***************************************************************************/
+extern size_t ping_session_send(struct ping_session *session,
+                                const struct ping_probe *probes,
+                                size_t n_probes);
+
+/************************************************************************//**
+ * Collects completed probes: replies and ICMP errors read from the sockets,
+ * failed sends and timeouts. If nothing is ready, waits up to wait_ms for
+ * the sockets or the next timeout.
+ *
+ * @param[in]  session    : session to poll.
+ * @param[in]  wait_ms    : time to wait, 0 to not block, -1 to wait until
+ *                          the next timeout.
+ * @param[out] events     : completed probes.
+ * @param[in]  max_events : size of events.
+ *
+ * @return number of events stored.
+ ***************************************************************************/
+extern size_t ping_session_poll(struct ping_session *session, int wait_ms,
+                                struct ping_event *events,
+                                size_t max_events);
+
+/************************************************************************//**
+ * Returns the number of probes of a session that have not completed yet.
+ *
+ * @param[in]  session : session.
+ ***************************************************************************/
+extern size_t ping_session_pending(const struct ping_session *session);
+
+/************************************************************************//**
+ * Returns the socket descriptors of a session, for use in an event loop.
+ * A family whose socket is not open yet is reported as -1.
+ *
+ * @param[in]  session : session.
+ * @param[out] fds     : ICMP socket, then ICMPv6 socket.
+ ***************************************************************************/
+extern void ping_session_fds(const struct ping_session *session, int fds[2]);
+
+/************************************************************************//**
+ * Pings every target and waits for the results. Up to max_outstanding
+ * probes are kept in flight at once.
+ *
+ * @param[in]  targets    : hosts to ping.
+ * @param[in]  n_targets  : number of targets.
+ * @param[in]  options    : session settings, NULL for the defaults.
+ * @param[out] results    : result of each target, in target order.
+ *
+ * @return number of reachable targets.
+ ***************************************************************************/
+extern size_t ping_probe_batch(const struct ping_target *targets,
+                               size_t n_targets,
+                               const struct ping_session_options *options,
+                               struct ping_result *results);
+
+/************************************************************************//**
+ * Finds the path MTU of targets, by a binary search on the size of echo
+ * requests sent with the DF bit set. The searches of all the targets run
+ * at once on one session. The first probe of every target has the
+ * largest size; an MTU reported by an ICMP error is tried next, and
+ * probes lost without an error (black holes) are retried, then counted as
+ * too big. A search takes a round trip per step, plus the probe timeout
+ * per black hole step.
+ *
+ * @param[in]  targets   : hosts to probe.
+ * @param[in]  n_targets : number of targets.
+ * @param[in]  options   : search settings, NULL for the defaults.
+ * @param[out] mtus      : path MTU of each target, in target order, 0 if
+ *                         the target did not answer at any size.
+ *
+ * @return number of targets whose path MTU was found.
+ ***************************************************************************/
+extern size_t ping_pmtu_discover(const struct ping_target *targets,
+                                 size_t n_targets,
+                                 const struct ping_pmtu_options *options,
+                                 unsigned int *mtus);
+
+/************************************************************************//**
+ * Traces the path to a target. Unlike traceroute, the probes of every TTL
+ * are sent at once, on n_flows flows: each flow keeps one ICMP checksum,
+ * so routers that balance on it send all its probes on one path
+ * (Paris traceroute). The trace takes about one round trip, or the probe
+ * timeout if a hop does not answer.
+ *
+ * hops is indexed by flow * max_ttl + ttl - 1. A hop that answered has the
+ * status PING_TIME_EXCEEDED and its address in from; the target answers
+ * with PING_REACHABLE. Hops past the target are not meaningful.
+ *
+ * @param[in]  target  : host to trace.
+ * @param[in]  options : trace settings, NULL for the defaults.
+ * @param[out] hops    : max_ttl * n_flows results.
+ *
+ * @return number of hops to the target on the shortest flow, 0 if the
+ *         target did not answer.
+ ***************************************************************************/
+extern unsigned int ping_trace(const struct ping_target *target,
+                               const struct ping_trace_options *options,
+                               struct ping_result *hops);
+
+#endif /* __PING_SEND_H_ */
+/** @} end of group ping_send_public */
+/** @} end of group ping_send */
@@ -36,6 +36,8 @@
 #ifndef __VRF_UTILS_H_
 #define __VRF_UTILS_H_
 
+#include <sys/types.h>
+#include "hmap.h"
 #include "vswitch-idl.h"
 #include "nl-utils.h"
 
@@ -46,6 +48,48 @@ struct vrf_sock_params
     struct nl_sock_params nl_params;
 };
 
+/* Function run by vrf_exec() or vrf_exec_async() in a VRF namespace.
+ * Returns 0 or an errno value. */
+typedef int vrf_exec_fn(void *ctx);
+
+/* Completion callback of vrf_exec_async(), called from the worker thread
+ * with the value returned by the function, or with the error that kept it
+ * from running. */
+typedef void vrf_exec_done_fn(int error, void *ctx);
+
+/* One sysctl to write with vrf_sysctl_batch(). */
+struct vrf_sysctl
+{
+    const char *key;            /* "net.ipv4.ip_forward", or with '/' as
+                                 * separator if a component has a dot, as
+                                 * in "net/ipv4/conf/1.10/rp_filter". */
+    const char *value;          /* Value to write, e.g. "1". */
+};
+
+/* One VRF namespace to create or remove with vrf_ns_create_batch() or
+ * vrf_ns_delete_batch(). */
+struct vrf_ns_req
+{
+    char ns_name[MAX_BUFFER_SIZE];  /* Namespace name, the VRF UUID. */
+    const struct ovsrec_vrf *vrf;   /* If not NULL, marked ready once its
+                                     * namespace is created. */
+    int error;                      /* Set to 0 or to the errno of the
+                                     * item. */
+};
+
+/* Sockets kept open in one namespace, in a cache managed with
+ * vrf_sock_cache_get() and vrf_sock_cache_flush(). */
+#define VRF_SOCK_CACHE_SOCKS 2
+struct vrf_sock_cache_entry
+{
+    struct hmap_node node;          /* In the cache. */
+    dev_t dev;                      /* Identity of the namespace. */
+    ino_t ino;
+    char ns_name[MAX_BUFFER_SIZE];  /* Empty if the namespace has no name
+                                     * under /var/run/netns. */
+    int socks[VRF_SOCK_CACHE_SOCKS]; /* Up to the user, -1 until opened. */
+};
+
 /************************************************************************//**
  * Reads the vrf row from a ovsdb based on vrf name.
  *
@@ -220,6 +264,176 @@ get_vrf_ns_from_table_id(const struct ovsdb_idl *idl, const int64_t table_id,
 const int64_t
 get_vrf_uuid_from_table_id(const struct ovsdb_idl *idl, const int64_t table_id,
                            struct uuid *uuid);
+
+/************************************************************************//**
+ * Marks the namespace of a VRF as ready (VRF_STATUS_KEY set to
+ * VRF_STATUS_VALUE in its status column), which vrf_is_ready() checks.
+ *
+ * @param[in]  vrf : VRF row, in an open transaction.
+ ***************************************************************************/
+extern void vrf_set_ready(const struct ovsrec_vrf *vrf);
+
+/************************************************************************//**
+ * Creates the namespaces of a list of VRFs, without forking "ip netns add".
+ * Each namespace is created by a worker thread, which unshares its network
+ * namespace, bind mounts it on /var/run/netns/<ns_name> and brings up its
+ * loopback interface. The VRF rows given in the requests whose namespace
+ * was created are then marked ready, so this must be called in an open
+ * transaction if any is given.
+ *
+ * @param[in,out] reqs   : namespaces to create, 'error' is filled per item
+ *                         (EEXIST if the namespace already exists).
+ * @param[in]  n_reqs    : number of items in reqs.
+ * @param[in]  n_threads : number of worker threads, 0 for the default.
+ *
+ * @return number of items that failed
+ ***************************************************************************/
+extern int vrf_ns_create_batch(struct vrf_ns_req *reqs, size_t n_reqs,
+                               unsigned int n_threads);
+
+/************************************************************************//**
+ * Removes the namespaces of a list of VRFs, on worker threads. A namespace
+ * goes away once no process, socket or interface refers to it anymore: the
+ * vrf_exec() worker, ping and ARP sockets this library keeps there are
+ * closed first, and its interface counters and locator entries dropped.
+ *
+ * @param[in,out] reqs   : namespaces to remove, 'error' is filled per item.
+ * @param[in]  n_reqs    : number of items in reqs.
+ * @param[in]  n_threads : number of worker threads, 0 for the default.
+ *
+ * @return number of items that failed
+ ***************************************************************************/
+extern int vrf_ns_delete_batch(struct vrf_ns_req *reqs, size_t n_reqs,
+                               unsigned int n_threads);
+
+/************************************************************************//**
+ * Writes a list of sysctls (forwarding, rp_filter, neighbor discovery
+ * settings...) in a list of VRF namespaces. Each namespace is entered once
+ * by a worker thread, which writes all the sysctls there, and namespaces
+ * are handled in parallel.
+ *
+ * @param[in]  ns_names  : namespaces, NULL or SWITCH_NAMESPACE for the
+ *                         default one.
+ * @param[in]  n_ns      : number of namespaces.
+ * @param[in]  sysctls   : sysctls to write in every namespace, in order.
+ * @param[in]  n_sysctls : number of sysctls.
+ * @param[out] errors    : n_ns * n_sysctls results: errors[i * n_sysctls +
+ *                         k] is 0 or the errno of sysctl k in namespace i.
+ * @param[in]  n_threads : number of worker threads, 0 for the default.
+ *
+ * @return number of writes that failed
+ ***************************************************************************/
+extern int vrf_sysctl_batch(const char *const *ns_names, size_t n_ns,
+                            const struct vrf_sysctl *sysctls,
+                            size_t n_sysctls, int *errors,
+                            unsigned int n_threads);
+
+/************************************************************************//**
+ * Runs a function in a VRF namespace and waits for its result. Each
+ * namespace has a worker thread that enters it once and runs the functions
+ * queued for it in order, so a call costs two thread wakeups instead of a
+ * thread creation and a setns(). Idle workers exit after a while.
+ *
+ * A function that started always runs to completion, as a thread can not
+ * be interrupted safely: the timeout bounds the wait before it starts,
+ * e.g. behind a function stuck in the same namespace. fn must not wait for
+ * another function of its own namespace, which would never start. A
+ * forked child starts without workers and creates its own.
+ *
+ * @param[in]  vrf_ns_name : namespace to run in, NULL or SWITCH_NAMESPACE
+ *                           for the default one.
+ * @param[in]  fn          : function to run.
+ * @param[in]  ctx         : argument of fn.
+ * @param[in]  timeout_ms  : how long fn may wait to start, 0 for ever.
+ *
+ * @return the value returned by fn, ENOENT if the namespace could not be
+ *         entered, ETIMEDOUT if fn did not start in time, or the error of
+ *         the worker thread creation.
+ ***************************************************************************/
+extern int vrf_exec(const char *vrf_ns_name, vrf_exec_fn *fn, void *ctx,
+                    unsigned int timeout_ms);
+
+/************************************************************************//**
+ * Same as vrf_exec(), without waiting: 'done' is called from the worker
+ * thread once fn returned, or instead of fn with ENOENT, ECANCELED
+ * (vrf_exec_flush()) or ETIMEDOUT. A timeout is noticed when the worker
+ * reaches the function in its queue.
+ *
+ * @param[in]  vrf_ns_name : namespace to run in, NULL or SWITCH_NAMESPACE
+ *                           for the default one.
+ * @param[in]  fn          : function to run.
+ * @param[in]  ctx         : argument of fn and done.
+ * @param[in]  done        : completion callback, may be NULL.
+ * @param[in]  timeout_ms  : how long fn may wait to start, 0 for ever.
+ *
+ * @return 0 if queued, else an errno value
+ ***************************************************************************/
+extern int vrf_exec_async(const char *vrf_ns_name, vrf_exec_fn *fn,
+                          void *ctx, vrf_exec_done_fn *done,
+                          unsigned int timeout_ms);
+
+/************************************************************************//**
+ * Stops the worker thread of a VRF namespace, which keeps the namespace
+ * alive. vrf_ns_delete_batch() does it for the namespaces it removes.
+ * Functions still queued complete with ECANCELED.
+ *
+ * @param[in]  vrf_ns_name : namespace of the worker, NULL for all of them.
+ ***************************************************************************/
+extern void vrf_exec_flush(const char *vrf_ns_name);
+
+/************************************************************************//**
+ * Creates a group of sockets bound to the same address with SO_REUSEPORT
+ * in a VRF namespace, for servers with one receiving thread per socket:
+ * the kernel spreads the packets (or connections, once each socket
+ * listens) of the address over the group, without a dispatcher thread.
+ * The namespace is entered once for the whole group.
+ *
+ * With cpu_steering, a classic BPF program attached to the group makes
+ * packets received on CPU c go to socket c % n_socks, so a thread pinned
+ * to that CPU handles them where they arrived.
+ *
+ * @param[in]  vrf_ns_name  : namespace of the sockets, NULL or
+ *                            SWITCH_NAMESPACE for the default one.
+ * @param[in]  params       : family, type and protocol of the sockets.
+ * @param[in]  addr         : address to bind the sockets to.
+ * @param[in]  addrlen      : length of addr.
+ * @param[out] fds          : the n_socks sockets, all -1 on failure.
+ * @param[in]  n_socks      : number of sockets of the group.
+ * @param[in]  cpu_steering : true to pick the socket from the receive CPU.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+extern int vrf_create_reuseport_group(const char *vrf_ns_name,
+                                      const struct vrf_sock_params *params,
+                                      const struct sockaddr *addr,
+                                      socklen_t addrlen, int *fds,
+                                      size_t n_socks, bool cpu_steering);
+
+/************************************************************************//**
+ * Returns the entry of a VRF namespace in a socket cache, adding it with
+ * all its sockets set to -1 on first use. Entries are keyed by the device
+ * and inode of the namespace, so the default namespace of two threads in
+ * different namespaces gets two entries. The caller serializes access to
+ * the cache.
+ *
+ * @param[in]  cache       : hmap of struct vrf_sock_cache_entry.
+ * @param[in]  vrf_ns_name : namespace name, NULL or SWITCH_NAMESPACE for
+ *                           the namespace of the calling thread.
+ *
+ * @return the entry, or NULL if the namespace does not exist
+ ***************************************************************************/
+extern struct vrf_sock_cache_entry *
+vrf_sock_cache_get(struct hmap *cache, const char *vrf_ns_name);
+
+/************************************************************************//**
+ * Closes the sockets of a VRF namespace in a socket cache and removes its
+ * entry. The caller serializes access to the cache.
+ *
+ * @param[in]  cache       : hmap of struct vrf_sock_cache_entry.
+ * @param[in]  vrf_ns_name : namespace name, NULL for all of them.
+ ***************************************************************************/
+extern void vrf_sock_cache_flush(struct hmap *cache, const char *vrf_ns_name);
+
 #endif /* __VRF_UTILS_H_ */
 /** @} end of group vrf_utils_public */
 /** @} end of group vrf_utils */
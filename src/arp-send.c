@@ -0,0 +1,317 @@
+/*
+ *(c) Copyright 2016 Hewlett Packard Enterprise Development LP.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *   not use this file except in compliance with the License. You may obtain
+ *   a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *   License for the specific language governing permissions and limitations
+ *   under the License.
+ *
+ * File:arp_send.c
+*/
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+#include <netinet/ip6.h>
+#include <netinet/icmp6.h>
+#include <linux/if_packet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "openvswitch/vlog.h"
+#include "hmap.h"
+#include "util.h"
+#include "vrf-utils.h"
+#include "ping-send.h"
+#include "arp-send.h"
+
+VLOG_DEFINE_THIS_MODULE(arp_send);
+
+/* Frames handed to the kernel per sendmmsg() call. */
+#define ARP_SEND_BATCH      256
+/* Time to wait for the device queue when a burst fills it, doubled at each
+ * retry without progress, up to ARP_SEND_RETRIES retries. */
+#define ARP_SEND_WAIT_MS    1
+#define ARP_SEND_RETRIES    6
+
+/* Gratuitous ARP, padded to the minimum Ethernet frame size. */
+struct arp_frame
+{
+    struct ether_header eth;
+    struct ether_arp arp;
+    uint8_t pad[ETH_ZLEN - sizeof(struct ether_header)
+                - sizeof(struct ether_arp)];
+} __attribute__((packed));
+
+/* Unsolicited neighbor advertisement with a target link-layer address
+ * option. */
+struct arp_na_frame
+{
+    struct ether_header eth;
+    struct ip6_hdr ip6;
+    struct nd_neighbor_advert na;
+    struct nd_opt_hdr opt;
+    struct ether_addr lladdr;
+} __attribute__((packed));
+
+/* IPv6 pseudo-header followed by the ICMPv6 message, for the checksum. */
+struct arp_na_csum
+{
+    struct in6_addr src;
+    struct in6_addr dst;
+    uint32_t len;
+    uint8_t zero[3];
+    uint8_t nxt;
+    struct nd_neighbor_advert na;
+    struct nd_opt_hdr opt;
+    struct ether_addr lladdr;
+} __attribute__((packed));
+
+#define ARP_FRAME_MAX   MAX(sizeof(struct arp_frame), \
+                            sizeof(struct arp_na_frame))
+
+/* Packet sockets of the namespaces, in socks[0] of the entries. Closing a
+ * packet socket waits for an RCU grace period, which costs more than a
+ * whole burst, so the socket is kept. arp_mutex protects the cache. */
+static pthread_mutex_t arp_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct hmap arp_vrf_cache = HMAP_INITIALIZER(&arp_vrf_cache);
+
+/*This function builds the announcement frame of an address in buf, of at
+* least ARP_FRAME_MAX bytes, and its destination in sll. Returns the frame
+* length, 0 for an invalid family.
+*/
+static size_t arp_build_frame(void *buf, struct sockaddr_ll *sll,
+                              const struct arp_announcement *announcement)
+{
+    static const uint8_t all_nodes_mac[ETH_ALEN] = {
+        0x33, 0x33, 0x00, 0x00, 0x00, 0x01
+    };
+    struct arp_frame *arp = buf;
+    struct arp_na_frame *na = buf;
+    struct arp_na_csum csum;
+
+    memset(sll, 0, sizeof *sll);
+    sll->sll_family = AF_PACKET;
+    sll->sll_ifindex = announcement->ifindex;
+    sll->sll_halen = ETH_ALEN;
+
+    if (announcement->family == AF_INET) {
+        memset(arp, 0, sizeof *arp);
+        memset(arp->eth.ether_dhost, 0xff, ETH_ALEN);
+        memcpy(arp->eth.ether_shost, &announcement->mac, ETH_ALEN);
+        arp->eth.ether_type = htons(ETHERTYPE_ARP);
+        arp->arp.arp_hrd = htons(ARPHRD_ETHER);
+        arp->arp.arp_pro = htons(ETHERTYPE_IP);
+        arp->arp.arp_hln = ETH_ALEN;
+        arp->arp.arp_pln = sizeof announcement->addr.ipv4;
+        arp->arp.arp_op = htons(ARPOP_REQUEST);
+        memcpy(arp->arp.arp_sha, &announcement->mac, ETH_ALEN);
+        memcpy(arp->arp.arp_spa, &announcement->addr.ipv4,
+               sizeof announcement->addr.ipv4);
+        memcpy(arp->arp.arp_tpa, &announcement->addr.ipv4,
+               sizeof announcement->addr.ipv4);
+        sll->sll_protocol = htons(ETH_P_ARP);
+        memset(sll->sll_addr, 0xff, ETH_ALEN);
+        return sizeof *arp;
+    }
+    if (announcement->family != AF_INET6) {
+        return 0;
+    }
+
+    memset(na, 0, sizeof *na);
+    memcpy(na->eth.ether_dhost, all_nodes_mac, ETH_ALEN);
+    memcpy(na->eth.ether_shost, &announcement->mac, ETH_ALEN);
+    na->eth.ether_type = htons(ETHERTYPE_IPV6);
+    na->ip6.ip6_flow = htonl(6 << 28);
+    na->ip6.ip6_plen = htons(sizeof *na - sizeof na->eth - sizeof na->ip6);
+    na->ip6.ip6_nxt = IPPROTO_ICMPV6;
+    na->ip6.ip6_hlim = 255;
+    na->ip6.ip6_src = announcement->addr.ipv6;
+    inet_pton(AF_INET6, "ff02::1", &na->ip6.ip6_dst);
+    na->na.nd_na_type = ND_NEIGHBOR_ADVERT;
+    na->na.nd_na_flags_reserved = ND_NA_FLAG_OVERRIDE
+                                  | (announcement->router
+                                     ? ND_NA_FLAG_ROUTER : 0);
+    na->na.nd_na_target = announcement->addr.ipv6;
+    na->opt.nd_opt_type = ND_OPT_TARGET_LINKADDR;
+    na->opt.nd_opt_len = (sizeof na->opt + sizeof na->lladdr) / 8;
+    na->lladdr = announcement->mac;
+
+    memset(&csum, 0, sizeof csum);
+    csum.src = na->ip6.ip6_src;
+    csum.dst = na->ip6.ip6_dst;
+    csum.len = htonl(ntohs(na->ip6.ip6_plen));
+    csum.nxt = IPPROTO_ICMPV6;
+    csum.na = na->na;
+    csum.opt = na->opt;
+    csum.lladdr = na->lladdr;
+    na->na.nd_na_cksum = ping_checksum(&csum, sizeof csum);
+
+    sll->sll_protocol = htons(ETH_P_IPV6);
+    memcpy(sll->sll_addr, all_nodes_mac, ETH_ALEN);
+    return sizeof *na;
+}
+
+/*This function opens the packet socket the frames are sent from. Its
+* protocol is 0, so that it receives nothing.
+*/
+static int arp_socket_open(const char *vrf_ns_name)
+{
+    struct vrf_sock_params params;
+    char ns_name[MAX_BUFFER_SIZE];
+    int sock;
+
+    if (!is_nondefault_vrf(vrf_ns_name)) {
+        sock = socket(AF_PACKET, SOCK_RAW, 0);
+    } else {
+        snprintf(ns_name, sizeof ns_name, "%s", vrf_ns_name);
+        params.nl_params.family = AF_PACKET;
+        params.nl_params.type = SOCK_RAW;
+        params.nl_params.protocol = 0;
+        sock = vrf_create_socket(ns_name, &params);
+    }
+    if (sock < 0) {
+        VLOG_ERR("can not create packet socket in %s. errstr = %s",
+                 vrf_ns_name ? vrf_ns_name : SWITCH_NAMESPACE,
+                 strerror(errno));
+    }
+    return sock;
+}
+
+/*This function returns the cached packet socket of a VRF namespace,
+* opening it on first use, or -1. A NULL or default namespace name selects
+* the namespace of the calling thread. arp_mutex must be held.
+*/
+static int arp_vrf_sock(const char *vrf_ns_name)
+{
+    struct vrf_sock_cache_entry *entry;
+
+    entry = vrf_sock_cache_get(&arp_vrf_cache, vrf_ns_name);
+    if (!entry) {
+        return -1;
+    }
+    if (entry->socks[0] < 0) {
+        entry->socks[0] = arp_socket_open(is_nondefault_vrf(vrf_ns_name)
+                                          ? vrf_ns_name : NULL);
+    }
+    return entry->socks[0];
+}
+
+/*This function sends the announcements with sendmmsg(), ARP_SEND_BATCH
+* frames at a time. A frame refused by the kernel (e.g. interface down) is
+* skipped. When the device queue stays full, the remaining frames are given
+* up. Returns the number of frames sent.
+*/
+static size_t arp_send_mmsg(int sock,
+                            const struct arp_announcement *announcements,
+                            size_t n_announcements)
+{
+    size_t chunk = MIN(n_announcements, ARP_SEND_BATCH);
+    char (*frames)[ARP_FRAME_MAX];
+    struct sockaddr_ll *addrs;
+    struct iovec *iovs;
+    struct mmsghdr *msgs;
+    struct timespec wait;
+    size_t i = 0, n, done, sent = 0;
+    unsigned int retries = 0;
+    int rc;
+
+    frames = xmalloc(chunk * sizeof *frames);
+    addrs = xmalloc(chunk * sizeof *addrs);
+    iovs = xmalloc(chunk * sizeof *iovs);
+    msgs = xmalloc(chunk * sizeof *msgs);
+
+    while (i < n_announcements) {
+        for (n = 0; n < chunk && i < n_announcements; i++) {
+            iovs[n].iov_len = arp_build_frame(frames[n], &addrs[n],
+                                              &announcements[i]);
+            if (!iovs[n].iov_len) {
+                VLOG_ERR("The given announcement family %d is not valid",
+                         announcements[i].family);
+                continue;
+            }
+            iovs[n].iov_base = frames[n];
+            memset(&msgs[n], 0, sizeof msgs[n]);
+            msgs[n].msg_hdr.msg_name = &addrs[n];
+            msgs[n].msg_hdr.msg_namelen = sizeof addrs[n];
+            msgs[n].msg_hdr.msg_iov = &iovs[n];
+            msgs[n].msg_hdr.msg_iovlen = 1;
+            n++;
+        }
+
+        for (done = 0; done < n; ) {
+            rc = sendmmsg(sock, msgs + done, n - done, 0);
+            if (rc > 0) {
+                done += rc;
+                sent += rc;
+                retries = 0;
+            } else if (errno == ENOBUFS || errno == EAGAIN) {
+                /* The device queue is full: let it drain. Polling the
+                 * socket would not wait for it, its send space is free. */
+                if (retries == ARP_SEND_RETRIES) {
+                    VLOG_ERR("error:sendmmsg: device queue stays full, "
+                             "%zu frames not sent",
+                             n - done + n_announcements - i);
+                    goto out;
+                }
+                wait.tv_sec = 0;
+                wait.tv_nsec = (ARP_SEND_WAIT_MS << retries++) * 1000000L;
+                nanosleep(&wait, NULL);
+            } else if (errno != EINTR) {
+                VLOG_DBG("error:sendmmsg: ifindex %d errstr = %s",
+                         addrs[done].sll_ifindex, strerror(errno));
+                done++;
+            }
+        }
+    }
+
+out:
+    free(frames);
+    free(addrs);
+    free(iovs);
+    free(msgs);
+    return sent;
+}
+
+int arp_send_announcements(const char *vrf_ns_name,
+                           const struct arp_announcement *announcements,
+                           size_t n_announcements)
+{
+    int sent = -1;
+    int sock;
+
+    if (!n_announcements) {
+        return 0;
+    }
+    pthread_mutex_lock(&arp_mutex);
+    sock = arp_vrf_sock(vrf_ns_name);
+    if (sock >= 0) {
+        sent = arp_send_mmsg(sock, announcements, n_announcements);
+    }
+    pthread_mutex_unlock(&arp_mutex);
+    return sent;
+}
+
+/*This function closes the cached packet sockets of a VRF namespace, or of
+* all namespaces if vrf_ns_name is NULL.
+*/
+void arp_send_sockets_flush(const char *vrf_ns_name)
+{
+    pthread_mutex_lock(&arp_mutex);
+    vrf_sock_cache_flush(&arp_vrf_cache, vrf_ns_name);
+    pthread_mutex_unlock(&arp_mutex);
+}
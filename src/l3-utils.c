@@ -31,8 +31,13 @@
 #include <string.h>
 #include <errno.h>
 #include <byteswap.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include <assert.h>
+#include "util.h"
 #include "vrf-utils.h"
 #include "l3-utils.h"
 
@@ -276,3 +281,996 @@ l3_utils_is_ipaddr_overlapping (const char *ip_address,
     }
     return false;
 }
+
+/* One address of a port in an address snapshot. */
+struct l3_utils_addr_entry
+{
+    struct l3_utils_prefix prefix;
+    bool secondary;
+};
+
+/* Addresses of one port in an address snapshot. */
+struct l3_utils_port_addrs
+{
+    struct hmap_node node;      /* In l3_utils_addr_snapshot 'ports'. */
+    struct uuid uuid;           /* Port row UUID. */
+    char *name;                 /* Port name. */
+    struct l3_utils_addr_entry *addrs;  /* Sorted with l3_utils_addr_cmp. */
+    size_t n;
+};
+
+/*
+ * Total order on snapshot entries, used to sort and merge address lists.
+ */
+static int
+l3_utils_addr_cmp (const void *a_, const void *b_)
+{
+    const struct l3_utils_addr_entry *a = a_;
+    const struct l3_utils_addr_entry *b = b_;
+    int cmp;
+
+    if (a->prefix.family != b->prefix.family) {
+        return a->prefix.family < b->prefix.family ? -1 : 1;
+    }
+    cmp = memcmp(&a->prefix.addr, &b->prefix.addr, sizeof a->prefix.addr);
+    if (cmp) {
+        return cmp;
+    }
+    if (a->prefix.mask_bits != b->prefix.mask_bits) {
+        return a->prefix.mask_bits < b->prefix.mask_bits ? -1 : 1;
+    }
+    return (int) a->secondary - (int) b->secondary;
+}
+
+/*
+ * Appends a parsed address to a growing entry list. Invalid addresses are
+ * skipped.
+ */
+static void
+l3_utils_addr_list_add (struct l3_utils_addr_entry **list, size_t *n,
+                        size_t *allocated, const char *ip_address,
+                        u_char addr_family, bool secondary)
+{
+    struct l3_utils_addr_entry *entry;
+
+    if (*n >= *allocated) {
+        *allocated = *allocated ? *allocated * 2 : 16;
+        *list = xrealloc(*list, *allocated * sizeof **list);
+    }
+    entry = &(*list)[*n];
+    memset(entry, 0, sizeof *entry);
+    if (l3_utils_prefix_parse(ip_address, addr_family, &entry->prefix)) {
+        entry->secondary = secondary;
+        (*n)++;
+    }
+}
+
+/*
+ * Collects the sorted IPv4 and IPv6 addresses of port_row into list.
+ */
+static size_t
+l3_utils_port_addr_list (const struct ovsrec_port *port_row,
+                         struct l3_utils_addr_entry **list,
+                         size_t *allocated)
+{
+    size_t i, n = 0;
+
+    if (port_row->ip4_address) {
+        l3_utils_addr_list_add(list, &n, allocated, port_row->ip4_address,
+                               AF_INET, false);
+    }
+    for (i = 0; i < port_row->n_ip4_address_secondary; i++) {
+        l3_utils_addr_list_add(list, &n, allocated,
+                               port_row->ip4_address_secondary[i],
+                               AF_INET, true);
+    }
+    if (port_row->ip6_address) {
+        l3_utils_addr_list_add(list, &n, allocated, port_row->ip6_address,
+                               AF_INET6, false);
+    }
+    for (i = 0; i < port_row->n_ip6_address_secondary; i++) {
+        l3_utils_addr_list_add(list, &n, allocated,
+                               port_row->ip6_address_secondary[i],
+                               AF_INET6, true);
+    }
+    qsort(*list, n, sizeof **list, l3_utils_addr_cmp);
+    return n;
+}
+
+/*
+ * Reports the differences between the stored addresses of a port and the
+ * sorted list 'new', removals first, then stores 'new' in the port.
+ * Returns the number of reported changes.
+ */
+static size_t
+l3_utils_port_addrs_diff (struct l3_utils_port_addrs *port,
+                          const struct l3_utils_addr_entry *new, size_t n_new,
+                          l3_utils_addr_delta_cb *cb, void *aux)
+{
+    size_t i = 0, j = 0, changes = 0;
+    int cmp;
+
+    if (n_new == port->n
+        && (!n_new || !memcmp(port->addrs, new, n_new * sizeof *new))) {
+        return 0;
+    }
+
+    /* Addresses only in the old list are removed. */
+    while (i < port->n) {
+        cmp = j < n_new ? l3_utils_addr_cmp(&port->addrs[i], &new[j]) : -1;
+        if (cmp < 0) {
+            cb(port->name, &port->addrs[i].prefix, port->addrs[i].secondary,
+               false, aux);
+            changes++;
+            i++;
+        } else {
+            j++;
+            i += cmp == 0;
+        }
+    }
+
+    /* Addresses only in the new list are added. */
+    for (i = 0, j = 0; j < n_new; ) {
+        cmp = i < port->n ? l3_utils_addr_cmp(&port->addrs[i], &new[j]) : 1;
+        if (cmp > 0) {
+            cb(port->name, &new[j].prefix, new[j].secondary, true, aux);
+            changes++;
+            j++;
+        } else {
+            i++;
+            j += cmp == 0;
+        }
+    }
+
+    free(port->addrs);
+    port->addrs = n_new ? xmemdup(new, n_new * sizeof *new) : NULL;
+    port->n = n_new;
+    return changes;
+}
+
+static struct l3_utils_port_addrs *
+l3_utils_port_addrs_find (const struct l3_utils_addr_snapshot *snap,
+                          const struct uuid *uuid)
+{
+    struct l3_utils_port_addrs *port;
+
+    HMAP_FOR_EACH_WITH_HASH (port, node, uuid_hash(uuid), &snap->ports) {
+        if (uuid_equals(&port->uuid, uuid)) {
+            return port;
+        }
+    }
+    return NULL;
+}
+
+static void
+l3_utils_port_addrs_free (struct l3_utils_port_addrs *port)
+{
+    free(port->addrs);
+    free(port->name);
+    free(port);
+}
+
+/*
+ * Initializes an empty address snapshot.
+ */
+void
+l3_utils_addr_snapshot_init (struct l3_utils_addr_snapshot *snap)
+{
+    hmap_init(&snap->ports);
+    snap->idl_seqno = 0;
+    snap->has_seqno = false;
+}
+
+/*
+ * Frees all the ports of an address snapshot.
+ */
+void
+l3_utils_addr_snapshot_destroy (struct l3_utils_addr_snapshot *snap)
+{
+    struct l3_utils_port_addrs *port, *next;
+
+    if (snap) {
+        HMAP_FOR_EACH_SAFE (port, next, node, &snap->ports) {
+            hmap_remove(&snap->ports, &port->node);
+            l3_utils_port_addrs_free(port);
+        }
+        hmap_destroy(&snap->ports);
+    }
+}
+
+/*
+ * Registers change tracking for the Port columns that an address snapshot
+ * reads, so that updates only visit the ports that changed.
+ */
+void
+l3_utils_addr_snapshot_track (struct ovsdb_idl *idl)
+{
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_name);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_ip4_address);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_ip4_address_secondary);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_ip6_address);
+    ovsdb_idl_track_add_column(idl, &ovsrec_port_col_ip6_address_secondary);
+}
+
+/*
+ * Re-reads the addresses of one port row into its snapshot entry, creating
+ * the entry if needed, and reports the differences.
+ */
+static size_t
+l3_utils_port_addrs_refresh (struct l3_utils_addr_snapshot *snap,
+                             const struct ovsrec_port *port_row,
+                             struct l3_utils_addr_entry **list,
+                             size_t *allocated,
+                             l3_utils_addr_delta_cb *cb, void *aux)
+{
+    struct l3_utils_port_addrs *port;
+    size_t n;
+
+    port = l3_utils_port_addrs_find(snap, &port_row->header_.uuid);
+    if (!port) {
+        port = xzalloc(sizeof *port);
+        port->uuid = port_row->header_.uuid;
+        port->name = xstrdup(port_row->name);
+        hmap_insert(&snap->ports, &port->node, uuid_hash(&port->uuid));
+    } else if (strcmp(port->name, port_row->name)) {
+        free(port->name);
+        port->name = xstrdup(port_row->name);
+    }
+
+    n = l3_utils_port_addr_list(port_row, list, allocated);
+    return l3_utils_port_addrs_diff(port, *list, n, cb, aux);
+}
+
+/*
+ * Removes a deleted port from the snapshot, reporting all its addresses
+ * as removed.
+ */
+static size_t
+l3_utils_port_addrs_delete (struct l3_utils_addr_snapshot *snap,
+                            const struct uuid *uuid,
+                            l3_utils_addr_delta_cb *cb, void *aux)
+{
+    struct l3_utils_port_addrs *port = l3_utils_port_addrs_find(snap, uuid);
+    size_t i, changes;
+
+    if (!port) {
+        return 0;
+    }
+    for (i = 0; i < port->n; i++) {
+        cb(port->name, &port->addrs[i].prefix, port->addrs[i].secondary,
+           false, aux);
+    }
+    changes = port->n;
+    hmap_remove(&snap->ports, &port->node);
+    l3_utils_port_addrs_free(port);
+    return changes;
+}
+
+/*
+ * Reports the addresses that were added or removed since the last update.
+ * The first update reads every port; later ones only visit the ports on
+ * the IDL change tracking list.
+ */
+size_t
+l3_utils_addr_snapshot_update (struct l3_utils_addr_snapshot *snap,
+                               const struct ovsdb_idl *idl,
+                               l3_utils_addr_delta_cb *cb, void *aux)
+{
+    const struct ovsrec_port *port_row = NULL;
+    struct l3_utils_addr_entry *list = NULL;
+    size_t allocated = 0, changes = 0;
+    unsigned int seqno = ovsdb_idl_get_seqno(idl);
+    bool first = !snap->has_seqno;
+
+    if (!first && snap->idl_seqno == seqno) {
+        return 0;
+    }
+    snap->idl_seqno = seqno;
+    snap->has_seqno = true;
+
+    if (first) {
+        OVSREC_PORT_FOR_EACH (port_row, idl) {
+            changes += l3_utils_port_addrs_refresh(snap, port_row, &list,
+                                                   &allocated, cb, aux);
+        }
+    } else {
+        OVSREC_PORT_FOR_EACH_TRACKED (port_row, idl) {
+            if (ovsrec_port_is_deleted(port_row)) {
+                changes += l3_utils_port_addrs_delete(snap,
+                                                      &port_row->header_.uuid,
+                                                      cb, aux);
+            } else {
+                changes += l3_utils_port_addrs_refresh(snap, port_row, &list,
+                                                       &allocated, cb, aux);
+            }
+        }
+    }
+    free(list);
+    return changes;
+}
+
+/*
+ * Returns the IPv4 subnet mask, in host byte order, for mask_bits.
+ * Handles /0, which cannot be computed with a 32 bit shift.
+ */
+static inline uint32_t
+l3_utils_ipv4_mask (unsigned int mask_bits)
+{
+    if (mask_bits == 0) {
+        return 0;
+    }
+    if (mask_bits > IPV4_BITLENGTH_MAX) {
+        mask_bits = IPV4_BITLENGTH_MAX;
+    }
+    return IPV4_SUBNET_MASK_FULL << (IPV4_ADDR_BIT_LENGTH - mask_bits);
+}
+
+/*
+ * Parses "address[/mask]" into a binary prefix.
+ * Returns false if the address is not a valid address of addr_family.
+ */
+bool
+l3_utils_prefix_parse (const char *ip_address, u_char addr_family,
+                       struct l3_utils_prefix *prefix)
+{
+    char ipAddressString[IPV6_ADDRESS_LENGTH + 1];
+    unsigned int max_bits;
+    char *p;
+
+    memset(prefix, 0, sizeof *prefix);
+    if (addr_family == AF_INET) {
+        max_bits = IPV4_BITLENGTH_MAX;
+    } else if (addr_family == AF_INET6) {
+        max_bits = IPV6_BITLENGTH_MAX;
+    } else {
+        return false;
+    }
+
+    snprintf(ipAddressString, sizeof ipAddressString, "%s", ip_address);
+    if (NULL != (p = (strchr(ipAddressString, '/')))) {
+        *p = '\0';
+    }
+    if (inet_pton(addr_family, ipAddressString, &prefix->addr) != 1) {
+        return false;
+    }
+
+    prefix->family = addr_family;
+    prefix->mask_bits = l3_utils_mask_bits(ip_address, addr_family);
+    if (prefix->mask_bits > max_bits) {
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Returns true if the first mask_bits bits of 2 prefixes of the same
+ * family are equal.
+ */
+static bool
+l3_utils_prefix_bits_equal (const struct l3_utils_prefix *a,
+                            const struct l3_utils_prefix *b,
+                            unsigned int mask_bits)
+{
+    const uint8_t *pa, *pb;
+    unsigned int bytes;
+    uint8_t mask;
+
+    if (a->family == AF_INET) {
+        uint32_t ipv4_mask = htonl(l3_utils_ipv4_mask(mask_bits));
+
+        return ((a->addr.ipv4.s_addr ^ b->addr.ipv4.s_addr) & ipv4_mask) == 0;
+    }
+
+    pa = a->addr.ipv6.s6_addr;
+    pb = b->addr.ipv6.s6_addr;
+    bytes = mask_bits / 8;
+    if (memcmp(pa, pb, bytes)) {
+        return false;
+    }
+    if (mask_bits % 8) {
+        mask = 0xff << (8 - mask_bits % 8);
+        return ((pa[bytes] ^ pb[bytes]) & mask) == 0;
+    }
+    return true;
+}
+
+/*
+ * Checks one configured address against the input prefix and records it
+ * in conflicts when the subnets overlap. Returns the updated conflict count.
+ */
+static size_t
+l3_utils_ipaddr_conflict_check (const struct l3_utils_prefix *input,
+                                const char *ip_address,
+                                const struct ovsrec_port *port_row,
+                                bool secondary,
+                                struct l3_utils_ipaddr_conflict *conflicts,
+                                size_t max_conflicts, size_t n_conflicts)
+{
+    struct l3_utils_prefix prefix;
+    struct l3_utils_ipaddr_conflict *conflict;
+    unsigned int mask_bits;
+
+    if (!l3_utils_prefix_parse(ip_address, input->family, &prefix)) {
+        return n_conflicts;
+    }
+    mask_bits = MIN(input->mask_bits, prefix.mask_bits);
+    if (!l3_utils_prefix_bits_equal(input, &prefix, mask_bits)) {
+        return n_conflicts;
+    }
+
+    if (n_conflicts < max_conflicts) {
+        conflict = &conflicts[n_conflicts];
+        conflict->port = port_row;
+        conflict->ip_address = ip_address;
+        conflict->secondary = secondary;
+        if (input->mask_bits == prefix.mask_bits) {
+            conflict->relation = L3_UTILS_OVERLAP_EQUAL;
+        } else if (input->mask_bits < prefix.mask_bits) {
+            conflict->relation = L3_UTILS_OVERLAP_CONTAINS;
+        } else {
+            conflict->relation = L3_UTILS_OVERLAP_CONTAINED;
+        }
+    }
+    return n_conflicts + 1;
+}
+
+/*
+ * Lists all the addresses of vrf_row overlapping ip_address. Addresses are
+ * compared in binary form, each configured address is parsed once.
+ * Returns the total number of conflicts, of which at most max_conflicts
+ * are stored.
+ */
+size_t
+l3_utils_ipaddr_conflicts (const char *ip_address, u_char addr_family,
+                           const struct ovsrec_vrf *vrf_row,
+                           struct l3_utils_ipaddr_conflict *conflicts,
+                           size_t max_conflicts)
+{
+    const struct ovsrec_port *port_row = NULL;
+    struct l3_utils_prefix input;
+    size_t i, n, n_conflicts = 0;
+    const char *primary;
+    char **secondaries;
+    size_t n_secondaries;
+
+    if (!l3_utils_prefix_parse(ip_address, addr_family, &input)) {
+        return 0;
+    }
+
+    for (i = 0; i < vrf_row->n_ports; i++) {
+        port_row = vrf_row->ports[i];
+        if (addr_family == AF_INET) {
+            primary = port_row->ip4_address;
+            secondaries = port_row->ip4_address_secondary;
+            n_secondaries = port_row->n_ip4_address_secondary;
+        } else {
+            primary = port_row->ip6_address;
+            secondaries = port_row->ip6_address_secondary;
+            n_secondaries = port_row->n_ip6_address_secondary;
+        }
+
+        if (primary != NULL) {
+            n_conflicts = l3_utils_ipaddr_conflict_check(&input, primary,
+                                                         port_row, false,
+                                                         conflicts,
+                                                         max_conflicts,
+                                                         n_conflicts);
+        }
+        for (n = 0; n < n_secondaries; n++) {
+            n_conflicts = l3_utils_ipaddr_conflict_check(&input,
+                                                         secondaries[n],
+                                                         port_row, true,
+                                                         conflicts,
+                                                         max_conflicts,
+                                                         n_conflicts);
+        }
+    }
+    return n_conflicts;
+}
+
+/*
+ * Overlap kernels for the packed IPv4 layout.
+ * Entry 'i' overlaps the input prefix when both addresses agree on the bits
+ * covered by the shorter of the two masks, that is when
+ * ((addrs[i] ^ addr) & masks[i] & mask) == 0.
+ * Each kernel returns the index of the first overlapping entry at or after
+ * 'start', or 'n' if there is none.
+ */
+typedef size_t l3_utils_ipv4_find_func(const uint32_t *addrs,
+                                       const uint32_t *masks, size_t n,
+                                       uint32_t addr, uint32_t mask,
+                                       size_t start);
+
+static size_t
+l3_utils_ipv4_find_scalar (const uint32_t *addrs, const uint32_t *masks,
+                           size_t n, uint32_t addr, uint32_t mask,
+                           size_t start)
+{
+    size_t i;
+
+    for (i = start; i < n; i++) {
+        if (((addrs[i] ^ addr) & masks[i] & mask) == 0) {
+            return i;
+        }
+    }
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Compares 8 entries per iteration using 256 bit integer vectors. */
+__attribute__((target("avx2")))
+static size_t
+l3_utils_ipv4_find_avx2 (const uint32_t *addrs, const uint32_t *masks,
+                         size_t n, uint32_t addr, uint32_t mask, size_t start)
+{
+    const __m256i vaddr = _mm256_set1_epi32(addr);
+    const __m256i vmask = _mm256_set1_epi32(mask);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = start;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) &addrs[i]);
+        __m256i m = _mm256_loadu_si256((const __m256i *) &masks[i]);
+        __m256i diff = _mm256_and_si256(_mm256_xor_si256(a, vaddr),
+                                        _mm256_and_si256(m, vmask));
+        int hits = _mm256_movemask_ps(
+                       _mm256_castsi256_ps(_mm256_cmpeq_epi32(diff, zero)));
+
+        if (hits) {
+            return i + __builtin_ctz(hits);
+        }
+    }
+    return l3_utils_ipv4_find_scalar(addrs, masks, n, addr, mask, i);
+}
+
+/* Compares 4 entries per iteration using 128 bit integer vectors. */
+__attribute__((target("sse4.1")))
+static size_t
+l3_utils_ipv4_find_sse41 (const uint32_t *addrs, const uint32_t *masks,
+                          size_t n, uint32_t addr, uint32_t mask, size_t start)
+{
+    const __m128i vaddr = _mm_set1_epi32(addr);
+    const __m128i vmask = _mm_set1_epi32(mask);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = start;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *) &addrs[i]);
+        __m128i m = _mm_loadu_si128((const __m128i *) &masks[i]);
+        __m128i diff = _mm_and_si128(_mm_xor_si128(a, vaddr),
+                                     _mm_and_si128(m, vmask));
+        __m128i eq = _mm_cmpeq_epi32(diff, zero);
+
+        if (!_mm_testz_si128(eq, eq)) {
+            return i + __builtin_ctz(_mm_movemask_ps(_mm_castsi128_ps(eq)));
+        }
+    }
+    return l3_utils_ipv4_find_scalar(addrs, masks, n, addr, mask, i);
+}
+#endif
+
+static l3_utils_ipv4_find_func *l3_utils_ipv4_find_impl =
+                                                    l3_utils_ipv4_find_scalar;
+static pthread_once_t l3_utils_ipv4_find_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Selects the overlap kernel based on the features of the running CPU.
+ */
+static void
+l3_utils_ipv4_find_select (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        l3_utils_ipv4_find_impl = l3_utils_ipv4_find_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        l3_utils_ipv4_find_impl = l3_utils_ipv4_find_sse41;
+    }
+#endif
+}
+
+/*
+ * Initializes an empty packed IPv4 address set.
+ */
+void
+l3_utils_ipv4_set_init (struct l3_utils_ipv4_set *set)
+{
+    memset(set, 0, sizeof *set);
+}
+
+/*
+ * Frees the memory held by a packed IPv4 address set.
+ */
+void
+l3_utils_ipv4_set_destroy (struct l3_utils_ipv4_set *set)
+{
+    if (set) {
+        free(set->addrs);
+        free(set->masks);
+        free(set->ports);
+        free(set->secondary);
+        memset(set, 0, sizeof *set);
+    }
+}
+
+/*
+ * Removes all the entries of the set, keeping the allocated arrays.
+ */
+void
+l3_utils_ipv4_set_clear (struct l3_utils_ipv4_set *set)
+{
+    set->n = 0;
+}
+
+/*
+ * Appends an IPv4 address to the set, growing the arrays as needed.
+ */
+void
+l3_utils_ipv4_set_add (struct l3_utils_ipv4_set *set, uint32_t addr,
+                       unsigned int mask_bits,
+                       const struct ovsrec_port *port_row, bool secondary)
+{
+    if (set->n >= set->allocated) {
+        set->allocated = set->allocated ? set->allocated * 2 : 64;
+        set->addrs = xrealloc(set->addrs,
+                              set->allocated * sizeof *set->addrs);
+        set->masks = xrealloc(set->masks,
+                              set->allocated * sizeof *set->masks);
+        set->ports = xrealloc(set->ports,
+                              set->allocated * sizeof *set->ports);
+        set->secondary = xrealloc(set->secondary,
+                                  set->allocated * sizeof *set->secondary);
+    }
+    set->addrs[set->n] = addr;
+    set->masks[set->n] = l3_utils_ipv4_mask(mask_bits);
+    set->ports[set->n] = port_row;
+    set->secondary[set->n] = secondary;
+    set->n++;
+}
+
+/*
+ * Loads the IPv4 addresses of all the ports of vrf_row into the set.
+ * Entries are added port by port, primary address first, so that the set
+ * is walked in the same order as l3_utils_is_ipaddr_overlapping().
+ */
+void
+l3_utils_ipv4_set_build (struct l3_utils_ipv4_set *set,
+                         const struct ovsrec_vrf *vrf_row)
+{
+    const struct ovsrec_port *port_row = NULL;
+    size_t i, n;
+
+    l3_utils_ipv4_set_clear(set);
+    for (i = 0; i < vrf_row->n_ports; i++) {
+        port_row = vrf_row->ports[i];
+        if (port_row->ip4_address != NULL) {
+            l3_utils_ipv4_set_add(set,
+                                  l3_utils_ipv4_address(port_row->ip4_address),
+                                  l3_utils_mask_bits(port_row->ip4_address,
+                                                     AF_INET),
+                                  port_row, false);
+        }
+        for (n = 0; n < port_row->n_ip4_address_secondary; n++) {
+            const char *addr = port_row->ip4_address_secondary[n];
+
+            l3_utils_ipv4_set_add(set, l3_utils_ipv4_address(addr),
+                                  l3_utils_mask_bits(addr, AF_INET),
+                                  port_row, true);
+        }
+    }
+}
+
+/*
+ * Returns the index of the first entry at or after start overlapping
+ * addr/mask_bits, or set->n if none overlaps.
+ */
+size_t
+l3_utils_ipv4_set_find (const struct l3_utils_ipv4_set *set, uint32_t addr,
+                        unsigned int mask_bits, size_t start)
+{
+    pthread_once(&l3_utils_ipv4_find_once, l3_utils_ipv4_find_select);
+    if (start >= set->n) {
+        return set->n;
+    }
+    return l3_utils_ipv4_find_impl(set->addrs, set->masks, set->n, addr,
+                                   l3_utils_ipv4_mask(mask_bits), start);
+}
+
+/*
+ * Checks if an IPv4 address overlaps an address of the set.
+ * Only the first overlapping entry matters: as in
+ * l3_utils_is_ipaddr_overlapping(), overlapping the primary IP of the same
+ * interface is allowed when configuring a primary IP.
+ */
+bool
+l3_utils_ipv4_set_is_overlapping (const struct l3_utils_ipv4_set *set,
+                                  const char *ip_address,
+                                  const char *if_name,
+                                  bool secondary)
+{
+    size_t i;
+
+    i = l3_utils_ipv4_set_find(set, l3_utils_ipv4_address(ip_address),
+                               l3_utils_mask_bits(ip_address, AF_INET), 0);
+    if (i == set->n) {
+        return false;
+    }
+    if (!set->secondary[i]
+        && strncmp(set->ports[i]->name, if_name, strlen(if_name)) == 0) {
+        return secondary;
+    }
+    return true;
+}
+
+/*
+ * Checks n prefixes against the set, optionally recording the result of
+ * each one in overlaps. Returns the number of overlapping prefixes.
+ */
+size_t
+l3_utils_ipv4_set_overlaps_batch (const struct l3_utils_ipv4_set *set,
+                                  const uint32_t *addrs,
+                                  const unsigned int *mask_bits,
+                                  size_t n, bool *overlaps)
+{
+    size_t i, count = 0;
+    bool hit;
+
+    for (i = 0; i < n; i++) {
+        hit = l3_utils_ipv4_set_find(set, addrs[i], mask_bits[i], 0) < set->n;
+        if (overlaps) {
+            overlaps[i] = hit;
+        }
+        count += hit;
+    }
+    return count;
+}
+
+/* A parsed IPv6 address of a VRF, used to validate address batches. */
+struct l3_utils_ipv6_entry
+{
+    struct l3_utils_prefix prefix;
+    const struct ovsrec_port *port;
+    bool deleted;               /* Removed by an earlier item of the batch. */
+};
+
+/* An address added by an earlier item of the batch being validated. */
+struct l3_utils_batch_addr
+{
+    struct l3_utils_prefix prefix;
+    char ifname[IFNAMSIZ];
+    bool deleted;               /* Removed again by a later item. */
+};
+
+/* State of the validation of an address batch: the addresses of the VRF,
+ * updated with the items accepted so far, in batch order. */
+struct l3_utils_addr_check
+{
+    struct l3_utils_ipv4_set set;
+    bool *ipv4_deleted;         /* One per entry of 'set'. */
+    struct l3_utils_ipv6_entry *entries;
+    size_t n_entries;
+    struct l3_utils_batch_addr *added;
+    size_t n_added;
+    size_t allocated;
+};
+
+/*
+ * Parses the IPv6 addresses of all the ports of vrf_row. Returns the
+ * number of entries stored in *entries, which the caller must free.
+ */
+static size_t
+l3_utils_ipv6_entries (const struct ovsrec_vrf *vrf_row,
+                       struct l3_utils_ipv6_entry **entries)
+{
+    const struct ovsrec_port *port_row = NULL;
+    size_t i, k, n = 0, allocated = 0;
+    const char *addr;
+
+    *entries = NULL;
+    for (i = 0; i < vrf_row->n_ports; i++) {
+        port_row = vrf_row->ports[i];
+        for (k = 0; k <= port_row->n_ip6_address_secondary; k++) {
+            addr = k ? port_row->ip6_address_secondary[k - 1]
+                     : port_row->ip6_address;
+            if (!addr) {
+                continue;
+            }
+            if (n >= allocated) {
+                allocated = allocated ? allocated * 2 : 64;
+                *entries = xrealloc(*entries, allocated * sizeof **entries);
+            }
+            if (l3_utils_prefix_parse(addr, AF_INET6, &(*entries)[n].prefix)) {
+                (*entries)[n].port = port_row;
+                (*entries)[n++].deleted = false;
+            }
+        }
+    }
+    return n;
+}
+
+/*
+ * Returns true if 2 prefixes are the same address with the same mask.
+ */
+static bool
+l3_utils_prefix_same (const struct l3_utils_prefix *a,
+                      const struct l3_utils_prefix *b)
+{
+    return a->family == b->family && a->mask_bits == b->mask_bits
+           && l3_utils_prefix_bits_equal(a, b, a->family == AF_INET
+                                               ? IPV4_BITLENGTH_MAX
+                                               : IPV6_BITLENGTH_MAX);
+}
+
+/*
+ * Marks the addresses of ifname equal to prefix as deleted, in the VRF
+ * configuration and in the items added earlier in the batch.
+ */
+static void
+l3_utils_addr_check_delete (struct l3_utils_addr_check *check,
+                            const struct l3_utils_prefix *prefix,
+                            const char *ifname)
+{
+    size_t i;
+
+    if (prefix->family == AF_INET) {
+        uint32_t addr = ntohl(prefix->addr.ipv4.s_addr);
+
+        for (i = 0; i < check->set.n; i++) {
+            if (check->set.addrs[i] == addr
+                && check->set.masks[i] == l3_utils_ipv4_mask(prefix->mask_bits)
+                && !strncmp(check->set.ports[i]->name, ifname, IFNAMSIZ)) {
+                check->ipv4_deleted[i] = true;
+            }
+        }
+    } else {
+        for (i = 0; i < check->n_entries; i++) {
+            if (l3_utils_prefix_same(prefix, &check->entries[i].prefix)
+                && !strncmp(check->entries[i].port->name, ifname, IFNAMSIZ)) {
+                check->entries[i].deleted = true;
+            }
+        }
+    }
+    for (i = 0; i < check->n_added; i++) {
+        if (l3_utils_prefix_same(prefix, &check->added[i].prefix)
+            && !strncmp(check->added[i].ifname, ifname, IFNAMSIZ)) {
+            check->added[i].deleted = true;
+        }
+    }
+}
+
+/*
+ * Returns true if prefix overlaps an address of an interface other than
+ * ifname, in the VRF configuration or in the items added earlier in the
+ * batch, deleted addresses excluded.
+ */
+static bool
+l3_utils_addr_check_conflicts (const struct l3_utils_addr_check *check,
+                               const struct l3_utils_prefix *prefix,
+                               const char *ifname)
+{
+    const struct l3_utils_batch_addr *added;
+    uint32_t addr;
+    size_t i;
+
+    if (prefix->family == AF_INET) {
+        addr = ntohl(prefix->addr.ipv4.s_addr);
+        for (i = l3_utils_ipv4_set_find(&check->set, addr, prefix->mask_bits,
+                                        0);
+             i < check->set.n;
+             i = l3_utils_ipv4_set_find(&check->set, addr, prefix->mask_bits,
+                                        i + 1)) {
+            if (!check->ipv4_deleted[i]
+                && strncmp(check->set.ports[i]->name, ifname, IFNAMSIZ)) {
+                return true;
+            }
+        }
+    } else {
+        for (i = 0; i < check->n_entries; i++) {
+            const struct l3_utils_ipv6_entry *entry = &check->entries[i];
+
+            if (!entry->deleted
+                && l3_utils_prefix_bits_equal(prefix, &entry->prefix,
+                                              MIN(prefix->mask_bits,
+                                                  entry->prefix.mask_bits))
+                && strncmp(entry->port->name, ifname, IFNAMSIZ)) {
+                return true;
+            }
+        }
+    }
+    for (i = 0; i < check->n_added; i++) {
+        added = &check->added[i];
+        if (!added->deleted && added->prefix.family == prefix->family
+            && l3_utils_prefix_bits_equal(prefix, &added->prefix,
+                                          MIN(prefix->mask_bits,
+                                              added->prefix.mask_bits))
+            && strncmp(added->ifname, ifname, IFNAMSIZ)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * nl_addr_batch_check() callback: rejects with EADDRINUSE an address to add
+ * that overlaps an address of another interface of the VRF, taking the
+ * earlier items of the batch into account.
+ */
+static int
+l3_utils_addr_check_item (const struct nl_addr_req *req, const char *ifname,
+                          void *check_)
+{
+    struct l3_utils_addr_check *check = check_;
+    struct l3_utils_batch_addr *added;
+    struct l3_utils_prefix prefix;
+
+    if (req->family != AF_INET && req->family != AF_INET6) {
+        return 0;
+    }
+    memset(&prefix, 0, sizeof prefix);
+    prefix.family = req->family;
+    prefix.mask_bits = req->prefixlen;
+    memcpy(&prefix.addr, &req->addr, sizeof req->addr);
+
+    if (!req->add) {
+        l3_utils_addr_check_delete(check, &prefix, ifname);
+        return 0;
+    }
+    if (l3_utils_addr_check_conflicts(check, &prefix, ifname)) {
+        return EADDRINUSE;
+    }
+    if (check->n_added >= check->allocated) {
+        check->allocated = check->allocated ? check->allocated * 2 : 16;
+        check->added = xrealloc(check->added,
+                                check->allocated * sizeof *check->added);
+    }
+    added = &check->added[check->n_added++];
+    added->prefix = prefix;
+    snprintf(added->ifname, sizeof added->ifname, "%s", ifname);
+    added->deleted = false;
+    return 0;
+}
+
+/*
+ * Validates and programs a batch of interface addresses in a VRF.
+ * Items rejected by the validation are not sent to the kernel.
+ */
+int
+l3_utils_vrf_addr_batch (const struct ovsdb_idl *idl, const char *vrf_name,
+                         struct nl_addr_req *reqs, size_t n_reqs,
+                         bool validate)
+{
+    char vrf_ns_name[UUID_LEN + 1] = {0};
+    const struct ovsrec_vrf *vrf_row = NULL;
+    struct l3_utils_addr_check check;
+    size_t i;
+    int rc;
+
+    if (get_vrf_ns_from_name(idl, vrf_name, vrf_ns_name) != 0
+        || (validate && !(vrf_row = vrf_lookup(idl, vrf_name)))) {
+        for (i = 0; i < n_reqs; i++) {
+            reqs[i].error = ENOENT;
+        }
+        return -1;
+    }
+    if (!validate) {
+        return nl_addr_batch(vrf_ns_name, reqs, n_reqs);
+    }
+
+    /* The names of the interfaces given by ifindex are looked up while
+     * nl_addr_batch_check() is in the namespace. */
+    memset(&check, 0, sizeof check);
+    l3_utils_ipv4_set_init(&check.set);
+    l3_utils_ipv4_set_build(&check.set, vrf_row);
+    check.ipv4_deleted = xcalloc(MAX(check.set.n, 1),
+                                 sizeof *check.ipv4_deleted);
+    check.n_entries = l3_utils_ipv6_entries(vrf_row, &check.entries);
+
+    rc = nl_addr_batch_check(vrf_ns_name, reqs, n_reqs,
+                             l3_utils_addr_check_item, &check);
+
+    free(check.added);
+    free(check.entries);
+    free(check.ipv4_deleted);
+    l3_utils_ipv4_set_destroy(&check.set);
+    return rc;
+}
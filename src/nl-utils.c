@@ -34,81 +34,2231 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <sched.h>
+#include <pthread.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <dynamic-string.h>
+#include <linux/if_addr.h>
+#include <linux/neighbour.h>
+#include <linux/if_link.h>
+#include <linux/if_bridge.h>
 
 #include <assert.h>
 #include "openswitch-idl.h"
+#include "hash.h"
+#include "hmap.h"
+#include "util.h"
 #include "nl-utils.h"
 #include "openvswitch/vlog.h"
 
 VLOG_DEFINE_THIS_MODULE(nl_utils);
 
+#ifndef SOL_NETLINK
+#define SOL_NETLINK            270
+#endif
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK        10
+#endif
+
+/* Requests bytes handed to the kernel per send() in a batch. The ACKs of one
+ * chunk must fit in the socket receive buffer. */
+#define NL_BATCH_CHUNK_SIZE    (64 * 1024)
+#define NL_BATCH_SOCK_BUFSIZE  (1024 * 1024)
+#define NL_BATCH_RECV_SIZE     (32 * 1024)
+#define NL_BATCH_TIMEOUT_SEC   5
+
+/* Highest VLAN id that can be configured. */
+#define NL_VLAN_MAX            4094
+
+#ifndef NDA_RTA
+#define NDA_RTA(r) \
+    ((struct rtattr *) (((char *) (r)) + NLMSG_ALIGN(sizeof(struct ndmsg))))
+#endif
+
+/**************************************************************************
+* Netlink requests laid out back to back and sent as one pipelined batch.
+* Message 'i' of the batch carries sequence number 'i'.
+***************************************************************************/
+struct nl_batch
+{
+    char *data;             /* Messages, each one NLMSG_ALIGNed. */
+    size_t size;            /* Bytes in use in 'data'. */
+    size_t allocated;       /* Bytes allocated for 'data'. */
+    size_t last;            /* Offset of the last message. */
+    size_t n_msgs;          /* Number of messages. */
+};
+
+/**************************************************************************
+* Request type of a batch API, for nl_batch_run().
+***************************************************************************/
+struct nl_batch_ops
+{
+    /* Called in the namespace once the netlink socket is open, e.g. to
+     * look interfaces up. May be NULL. It may set the error of requests,
+     * which are then not sent. */
+    void (*in_ns)(void *reqs, const size_t *items, size_t n_items,
+                  void *aux);
+    /* Appends the message of request 'i' to the batch. Returns 0, or the
+     * errno value of a request that cannot be sent. */
+    int (*put)(struct nl_batch *batch, void *reqs, size_t i, void *aux);
+    /* Returns the 'error' member of request 'i'. */
+    int *(*error)(void *reqs, size_t i);
+};
+
+/**************************************************************************
+* Neighbor table of a namespace, kept in sync from RTMGRP_NEIGH events.
+***************************************************************************/
+struct nl_neigh_cache
+{
+    char ns_name[MAX_BUFFER_SIZE]; /* Empty for the default namespace. */
+    int event_sock;         /* Bound to RTMGRP_NEIGH, non-blocking. */
+    struct hmap entries;    /* Contains "struct nl_neigh_cache_node"s. */
+};
+
+struct nl_neigh_cache_node
+{
+    struct hmap_node node;  /* In nl_neigh_cache 'entries'. */
+    struct nl_neigh_entry entry;
+};
+
+/* Callback of nl_dump, called for each message of a dump. */
+typedef void nl_dump_cb(const struct nlmsghdr *nlh, void *aux);
+
+/* Callback of nl_event_sock_run, dumps again the state kept up to date by
+ * an event socket, in the namespace of the calling thread. */
+typedef int nl_event_redump_fn(void *aux);
+
+/**************************************************************************
+* Last interface counters dump of a namespace, shared by the callers of
+* nl_if_stats_get() for their TTL.
+***************************************************************************/
+struct nl_if_stats_cache
+{
+    struct hmap_node node;  /* In nl_if_stats_caches. */
+    char ns_name[MAX_BUFFER_SIZE]; /* Empty for the default namespace. */
+    pthread_mutex_t dump_mutex; /* Held while dumping the namespace. */
+    unsigned int n_users;   /* Threads waiting for or doing a dump. */
+    bool removed;           /* Flushed while in use, freed by last user. */
+    bool dumped;            /* False until the first dump. */
+    long long int when_ms;  /* Monotonic time of the dump. */
+    struct nl_if_stats *stats;
+    size_t n_stats;
+};
+
+/* nl_if_stats_mutex protects nl_if_stats_caches and the contents of the
+ * caches, except dump_mutex. It is not held during a dump, so a slow
+ * namespace only delays the pollers of that namespace. */
+static pthread_mutex_t nl_if_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct hmap nl_if_stats_caches = HMAP_INITIALIZER(&nl_if_stats_caches);
+
+/**************************************************************************
+* A namespace tracked by the interface locator.
+***************************************************************************/
+struct nl_locator_ns
+{
+    struct hmap_node node;  /* In nl_locator_namespaces. */
+    char ns_name[MAX_BUFFER_SIZE]; /* SWITCH_NAMESPACE for the default. */
+    char vrf_name[MAX_BUFFER_SIZE];
+    int event_sock;         /* Bound to RTMGRP_LINK, non-blocking. */
+};
+
+/* An interface known to the interface locator. */
+struct nl_locator_intf
+{
+    struct hmap_node name_node;  /* In nl_locator_by_name. */
+    struct hmap_node index_node; /* In nl_locator_by_index. */
+    struct nl_locator_ns *ns;    /* Namespace holding the interface. */
+    int ifindex;
+    char name[IFNAMSIZ];
+};
+
+/* nl_locator_mutex protects the interface locator state below. The event
+ * sockets of all the namespaces are registered in nl_locator_epoll_fd. */
+static pthread_mutex_t nl_locator_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct hmap nl_locator_namespaces =
+    HMAP_INITIALIZER(&nl_locator_namespaces);
+static struct hmap nl_locator_by_name = HMAP_INITIALIZER(&nl_locator_by_name);
+static struct hmap nl_locator_by_index =
+    HMAP_INITIALIZER(&nl_locator_by_index);
+static int nl_locator_epoll_fd = -1;
+
+/***************************************************************************
+* type of action to be performed inside the thread
+*
+* @param[in]  tdata : struct nlutils_op_data parameter for parsing
+*
+* executes desired operation and stores the result in tdata itself
+***************************************************************************/
+void nl_perform_socket_operation(struct nlutils_op_data *tdata)
+{
+   int ns_sock = -1;
+   switch (tdata->operation)
+   {
+       case NLUTILS_SOCKET_CREATE:
+           /* Open a socket in the namespace set by thread */
+           ns_sock = socket(tdata->params.s->family,
+                            tdata->params.s->type,
+                            tdata->params.s->protocol);
+
+           if (ns_sock < 0) {
+               VLOG_ERR("socket creation failed (%s) in namespace %s",
+                                      strerror(errno), tdata->ns_name);
+           }
+           tdata->result=ns_sock;
+           break;
+       case NLUTILS_IFINDEX_TO_NAME:
+           if_indextoname(tdata->params.in.ifindex, tdata->params.in.ifname);
+           tdata->result=0;
+           break;
+       case NLUTILS_IFNAME_TO_INDEX:
+           tdata->params.ni.ifindex = if_nametoindex(tdata->params.ni.ifname);
+           tdata->result=0;
+           break;
+       default:
+           VLOG_ERR("unsupported op %d in ns name %s",
+                                       tdata->operation, tdata->ns_name);
+           break;
+   }
+   return;
+}
+
+
+/***************************************************************************
+ * check if the ns_name is default namespace or not.
+ *
+ * @param[in]  ns_name  : the namespace name to used for comparision.
+ *
+ * @return 0 if default namespace, else 1
+ ***************************************************************************/
+static bool nl_is_nondefault_ns(const char *ns_name)
+{
+     if (!ns_name
+         || strncmp(ns_name, SWITCH_NAMESPACE, strlen(SWITCH_NAMESPACE)) == 0)
+     {
+        /* DEFAULT namespace. ignore entering this namespace again */
+        return 0;
+     }
+     return 1;
+}
+
+static void
+nl_batch_init (struct nl_batch *batch)
+{
+    memset(batch, 0, sizeof *batch);
+}
+
+static void
+nl_batch_destroy (struct nl_batch *batch)
+{
+    free(batch->data);
+}
+
+/***************************************************************************
+* Appends 'len' zeroed bytes, rounded up to the netlink alignment, to the
+* batch and returns their offset. Offsets stay valid when the buffer grows.
+***************************************************************************/
+static size_t
+nl_batch_reserve (struct nl_batch *batch, size_t len)
+{
+    size_t offset = batch->size;
+
+    len = NLMSG_ALIGN(len);
+    if (batch->size + len > batch->allocated) {
+        batch->allocated = MAX(batch->allocated * 2, batch->size + len);
+        batch->allocated = MAX(batch->allocated, 4096);
+        batch->data = xrealloc(batch->data, batch->allocated);
+    }
+    memset(batch->data + offset, 0, len);
+    batch->size += len;
+    return offset;
+}
+
+/***************************************************************************
+* Returns the last message of the batch.
+***************************************************************************/
+static struct nlmsghdr *
+nl_batch_msg (const struct nl_batch *batch)
+{
+    return (struct nlmsghdr *) (batch->data + batch->last);
+}
+
+/***************************************************************************
+* Starts a new request of the given type, with a fixed size payload.
+* NLM_F_REQUEST and NLM_F_ACK are always set.
+***************************************************************************/
+static void
+nl_batch_put_msg (struct nl_batch *batch, uint16_t type, uint16_t flags,
+                  const void *payload, size_t len)
+{
+    struct nlmsghdr *nlh;
+
+    batch->last = nl_batch_reserve(batch, NLMSG_HDRLEN + len);
+    nlh = nl_batch_msg(batch);
+    nlh->nlmsg_len = NLMSG_HDRLEN + NLMSG_ALIGN(len);
+    nlh->nlmsg_type = type;
+    nlh->nlmsg_flags = flags | NLM_F_REQUEST | NLM_F_ACK;
+    nlh->nlmsg_seq = batch->n_msgs++;
+    memcpy(NLMSG_DATA(nlh), payload, len);
+}
+
+/***************************************************************************
+* Appends an attribute to the last message of the batch.
+***************************************************************************/
+static void
+nl_batch_put_attr (struct nl_batch *batch, uint16_t type, const void *data,
+                   size_t len)
+{
+    size_t offset = nl_batch_reserve(batch, RTA_LENGTH(len));
+    struct rtattr *rta = (struct rtattr *) (batch->data + offset);
+
+    rta->rta_type = type;
+    rta->rta_len = RTA_LENGTH(len);
+    memcpy(RTA_DATA(rta), data, len);
+    nl_batch_msg(batch)->nlmsg_len = batch->size - batch->last;
+}
+
+/***************************************************************************
+* Starts a nested attribute in the last message of the batch and returns its
+* offset, to be passed to nl_batch_nest_end once its content is appended.
+***************************************************************************/
+static size_t
+nl_batch_nest_start (struct nl_batch *batch, uint16_t type)
+{
+    size_t offset = nl_batch_reserve(batch, RTA_LENGTH(0));
+    struct rtattr *rta = (struct rtattr *) (batch->data + offset);
+
+    rta->rta_type = type;
+    return offset;
+}
+
+/***************************************************************************
+* Ends the nested attribute that starts at 'offset'.
+***************************************************************************/
+static void
+nl_batch_nest_end (struct nl_batch *batch, size_t offset)
+{
+    struct rtattr *rta = (struct rtattr *) (batch->data + offset);
+
+    rta->rta_len = batch->size - offset;
+    nl_batch_msg(batch)->nlmsg_len = batch->size - batch->last;
+}
+
+/***************************************************************************
+* Opens a netlink route socket suitable for pipelined batches, in the
+* namespace of the calling thread.
+*
+* @return socket fd, or -1 on failure
+***************************************************************************/
+static int
+nl_batch_socket_open (void)
+{
+    struct sockaddr_nl s_addr;
+    struct timeval timeout = { NL_BATCH_TIMEOUT_SEC, 0 };
+    int bufsize = NL_BATCH_SOCK_BUFSIZE;
+    int one = 1;
+    int sock;
+
+    sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (sock < 0) {
+        VLOG_ERR("Netlink socket creation failed (%s)", strerror(errno));
+        return -1;
+    }
+
+    /* Larger buffers and short ACKs let more requests be in flight. */
+    setsockopt(sock, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof bufsize);
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof bufsize);
+    setsockopt(sock, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof one);
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    memset(&s_addr, 0, sizeof s_addr);
+    s_addr.nl_family = AF_NETLINK;
+    if (bind(sock, (struct sockaddr *) &s_addr, sizeof s_addr) < 0) {
+        VLOG_ERR("Netlink socket bind failed (%s)", strerror(errno));
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/***************************************************************************
+* Sends all the messages of a batch and collects their ACKs. Messages are
+* sent in chunks of whole messages, many per send(), and the ACKs of a
+* chunk are read before the next chunk is sent.
+*
+* @param[in]  sock   : netlink socket from nl_batch_socket_open.
+* @param[in]  batch  : requests to send.
+* @param[out] errors : errors[i] is set to 0 or to the errno of message i.
+*
+* @return 0 if every message was acknowledged, else -1
+***************************************************************************/
+static int
+nl_batch_transact (int sock, const struct nl_batch *batch, int *errors)
+{
+    char buf[NL_BATCH_RECV_SIZE];
+    size_t offset = 0, end, first, index = 0, outstanding, i;
+    const struct nlmsghdr *nlh;
+    const struct nlmsgerr *err;
+    int error;
+    ssize_t n;
+
+    for (i = 0; i < batch->n_msgs; i++) {
+        errors[i] = -1;
+    }
+
+    while (offset < batch->size) {
+        /* Take whole messages up to the chunk size. */
+        first = index;
+        end = offset;
+        do {
+            nlh = (const struct nlmsghdr *) (batch->data + end);
+            end += NLMSG_ALIGN(nlh->nlmsg_len);
+            index++;
+            nlh = (const struct nlmsghdr *) (batch->data + end);
+        } while (end < batch->size
+                 && end - offset + NLMSG_ALIGN(nlh->nlmsg_len)
+                    <= NL_BATCH_CHUNK_SIZE);
+
+        do {
+            n = send(sock, batch->data + offset, end - offset, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            error = errno;
+            VLOG_ERR("Netlink batch send failed (%s)", strerror(error));
+            goto error;
+        }
+
+        outstanding = index - first;
+        while (outstanding) {
+            n = recv(sock, buf, sizeof buf, 0);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error = errno;
+                VLOG_ERR("Netlink batch receive failed (%s)",
+                         strerror(error));
+                goto error;
+            }
+            for (nlh = (const struct nlmsghdr *) buf; NLMSG_OK(nlh, n);
+                 nlh = NLMSG_NEXT(nlh, n)) {
+                if (nlh->nlmsg_type != NLMSG_ERROR
+                    || nlh->nlmsg_seq < first || nlh->nlmsg_seq >= index
+                    || errors[nlh->nlmsg_seq] != -1) {
+                    continue;
+                }
+                err = NLMSG_DATA(nlh);
+                errors[nlh->nlmsg_seq] = -err->error;
+                outstanding--;
+            }
+        }
+        offset = end;
+    }
+    return 0;
+
+error:
+    for (i = 0; i < batch->n_msgs; i++) {
+        if (errors[i] == -1) {
+            errors[i] = error ? error : EIO;
+        }
+    }
+    return -1;
+}
+
+/***************************************************************************
+* Sends the requests reqs[items[0]], ..., reqs[items[n_items - 1]] (or the
+* first n_items requests if 'items' is NULL) as one batch in a namespace,
+* which is only entered to open the socket, and fills the error of each
+* request.
+*
+* @return number of requests that failed, or -1 if the batch could not be
+*         sent.
+***************************************************************************/
+static int
+nl_batch_run (const char *ns_name, void *reqs, const size_t *items,
+              size_t n_items, const struct nl_batch_ops *ops, void *aux)
+{
+    bool non_default_ns = nl_is_nondefault_ns(ns_name);
+    struct nl_batch batch;
+    size_t *msg_to_req;
+    int *errors = NULL;
+    int sock, failed = 0, rc = 0, error;
+    size_t i, item;
+
+    if (non_default_ns && nl_setns_with_name(ns_name)) {
+        sock = -1;
+        error = ENOENT;
+    } else {
+        sock = nl_batch_socket_open();
+        if (sock >= 0) {
+            for (i = 0; i < n_items; i++) {
+                *ops->error(reqs, items ? items[i] : i) = 0;
+            }
+            if (ops->in_ns) {
+                ops->in_ns(reqs, items, n_items, aux);
+            }
+        }
+        if (non_default_ns) {
+            nl_setns_with_name(SWITCH_NAMESPACE);
+        }
+        error = EIO;
+    }
+    if (sock < 0) {
+        for (i = 0; i < n_items; i++) {
+            *ops->error(reqs, items ? items[i] : i) = error;
+        }
+        return -1;
+    }
+
+    nl_batch_init(&batch);
+    msg_to_req = xmalloc(MAX(n_items, 1) * sizeof *msg_to_req);
+    for (i = 0; i < n_items; i++) {
+        item = items ? items[i] : i;
+        error = *ops->error(reqs, item);
+        if (!error) {
+            msg_to_req[batch.n_msgs] = item;
+            error = ops->put(&batch, reqs, item, aux);
+            *ops->error(reqs, item) = error;
+        }
+        failed += error != 0;
+    }
+
+    if (batch.n_msgs) {
+        errors = xmalloc(batch.n_msgs * sizeof *errors);
+        if (nl_batch_transact(sock, &batch, errors)) {
+            rc = -1;
+        }
+        for (i = 0; i < batch.n_msgs; i++) {
+            *ops->error(reqs, msg_to_req[i]) = errors[i];
+            failed += errors[i] != 0;
+        }
+    }
+
+    free(errors);
+    free(msg_to_req);
+    nl_batch_destroy(&batch);
+    close(sock);
+    return rc ? rc : failed;
+}
+
+/***************************************************************************
+* Sends a dump request and calls 'cb' for each message of the reply, until
+* the end of the dump.
+*
+* @param[in]  sock : netlink socket from nl_batch_socket_open.
+* @param[in]  req  : dump request, with NLM_F_DUMP set.
+*
+* @return 0 if sucessful, else an errno value
+***************************************************************************/
+static int
+nl_dump (int sock, const struct nlmsghdr *req, nl_dump_cb *cb, void *aux)
+{
+    char buf[NL_BATCH_RECV_SIZE];
+    const struct nlmsghdr *nlh;
+    const struct nlmsgerr *err;
+    ssize_t n;
+    int error;
+
+    if (send(sock, req, req->nlmsg_len, 0) < 0) {
+        error = errno;
+        VLOG_ERR("Netlink dump request failed (%s)", strerror(error));
+        return error;
+    }
+
+    for (;;) {
+        n = recv(sock, buf, sizeof buf, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = errno;
+            VLOG_ERR("Netlink dump failed (%s)", strerror(error));
+            return error;
+        }
+        for (nlh = (const struct nlmsghdr *) buf; NLMSG_OK(nlh, n);
+             nlh = NLMSG_NEXT(nlh, n)) {
+            if (nlh->nlmsg_type == NLMSG_DONE) {
+                return 0;
+            } else if (nlh->nlmsg_type == NLMSG_ERROR) {
+                err = NLMSG_DATA(nlh);
+                return -err->error;
+            }
+            cb(nlh, aux);
+        }
+    }
+}
+
+/***************************************************************************
+* Opens a non-blocking netlink route socket subscribed to 'groups', in the
+* namespace of the calling thread. Subscribe before dumping, so that no
+* change is missed: the events queued during the dump are applied on top of
+* it afterwards.
+*
+* @param[in]  groups : RTMGRP_* multicast groups to join.
+*
+* @return socket fd, or a negative errno value on failure
+***************************************************************************/
+static int
+nl_event_sock_open (unsigned int groups)
+{
+    int bufsize = NL_BATCH_SOCK_BUFSIZE;
+    struct sockaddr_nl s_addr;
+    int sock, error;
+
+    sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                  NETLINK_ROUTE);
+    if (sock < 0) {
+        error = errno;
+        VLOG_ERR("Netlink socket creation failed (%s)", strerror(error));
+        return -error;
+    }
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof bufsize);
+
+    memset(&s_addr, 0, sizeof s_addr);
+    s_addr.nl_family = AF_NETLINK;
+    s_addr.nl_groups = groups;
+    if (bind(sock, (struct sockaddr *) &s_addr, sizeof s_addr) < 0) {
+        error = errno;
+        VLOG_ERR("Netlink socket bind failed (%s)", strerror(error));
+        close(sock);
+        return -error;
+    }
+    return sock;
+}
+
+/***************************************************************************
+* Calls 'update' for each pending message of an event socket from
+* nl_event_sock_open. If events were lost because the socket overflowed,
+* drains it and calls 'redump' in its namespace instead.
+*
+* @param[in]  sock    : event socket.
+* @param[in]  ns_name : namespace of the socket, NULL for the default one.
+* @param[in]  update  : called for each event.
+* @param[in]  redump  : seeds the state again after lost events.
+* @param[in]  aux     : passed to update and redump.
+*
+* @return 0 if sucessful, else an errno value
+***************************************************************************/
+static int
+nl_event_sock_run (int sock, const char *ns_name, nl_dump_cb *update,
+                   nl_event_redump_fn *redump, void *aux)
+{
+    bool non_default_ns = nl_is_nondefault_ns(ns_name);
+    char buf[NL_BATCH_RECV_SIZE];
+    const struct nlmsghdr *nlh;
+    int error;
+    ssize_t n;
+
+    for (;;) {
+        n = recv(sock, buf, sizeof buf, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            } else if (errno != ENOBUFS) {
+                return errno;
+            }
+            break;
+        }
+        for (nlh = (const struct nlmsghdr *) buf; NLMSG_OK(nlh, n);
+             nlh = NLMSG_NEXT(nlh, n)) {
+            update(nlh, aux);
+        }
+    }
+
+    /* Events were dropped: drain what is queued and dump again. */
+    VLOG_DBG("Netlink events lost in namespace %s, dumping again",
+             non_default_ns ? ns_name : SWITCH_NAMESPACE);
+    while (recv(sock, buf, sizeof buf, 0) >= 0
+           || errno == EINTR || errno == ENOBUFS) {
+        continue;
+    }
+    if (non_default_ns && nl_setns_with_name(ns_name)) {
+        return ENOENT;
+    }
+    error = redump(aux);
+    if (non_default_ns) {
+        nl_setns_with_name(SWITCH_NAMESPACE);
+    }
+    return error;
+}
+
+/***************************************************************************
+* Fills the ifindex of the requests reqs[items[0]], ... (or the first
+* n_items if items is NULL) that only have a name, looking names up in the
+* namespace of the calling thread. Consecutive requests for the same
+* interface are looked up once.
+***************************************************************************/
+static void
+nl_addr_batch_resolve (struct nl_addr_req *reqs, const size_t *items,
+                       size_t n_items)
+{
+    const char *last_name = NULL;
+    int last_index = 0;
+    struct ifreq ifr;
+    size_t i;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return;
+    }
+    for (i = 0; i < n_items; i++) {
+        struct nl_addr_req *req = &reqs[items ? items[i] : i];
+
+        if (req->ifindex || !req->ifname[0]) {
+            continue;
+        }
+        if (!last_name || strncmp(last_name, req->ifname, IFNAMSIZ)) {
+            memset(&ifr, 0, sizeof ifr);
+            snprintf(ifr.ifr_name, IFNAMSIZ, "%s", req->ifname);
+            last_index = ioctl(sock, SIOCGIFINDEX, &ifr) ? 0 : ifr.ifr_ifindex;
+            last_name = req->ifname;
+        }
+        req->ifindex = last_index;
+    }
+    close(sock);
+}
+
+/***************************************************************************
+* Passes the requests reqs[items[0]], ... (or the first n_items if items is
+* NULL) to 'check', in the namespace of the calling thread, and sets the
+* error of those it rejects. The interface name of requests
+* that only have an ifindex is looked up, once for consecutive requests on
+* the same interface, without changing the request.
+***************************************************************************/
+static void
+nl_addr_batch_run_check (struct nl_addr_req *reqs, const size_t *items,
+                         size_t n_items, nl_addr_check_fn *check, void *aux)
+{
+    char ifname[IFNAMSIZ] = "";
+    int last_index = 0;
+    struct ifreq ifr;
+    size_t i;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    for (i = 0; i < n_items; i++) {
+        struct nl_addr_req *req = &reqs[items ? items[i] : i];
+
+        if (!req->ifname[0] && req->ifindex != last_index) {
+            memset(&ifr, 0, sizeof ifr);
+            ifr.ifr_ifindex = req->ifindex;
+            if (sock >= 0 && !ioctl(sock, SIOCGIFNAME, &ifr)) {
+                snprintf(ifname, sizeof ifname, "%s", ifr.ifr_name);
+            } else {
+                ifname[0] = '\0';
+            }
+            last_index = req->ifindex;
+        }
+        req->error = check(req, req->ifname[0] ? req->ifname : ifname, aux);
+    }
+    if (sock >= 0) {
+        close(sock);
+    }
+}
+
+/* Validation of an address batch, for nl_addr_batch_in_ns(). */
+struct nl_addr_batch_check
+{
+    nl_addr_check_fn *check;
+    void *aux;
+};
+
+/***************************************************************************
+* nl_batch_ops 'in_ns' of address batches: validates the requests and
+* resolves their interfaces.
+***************************************************************************/
+static void
+nl_addr_batch_in_ns (void *reqs, const size_t *items, size_t n_items,
+                     void *check_)
+{
+    const struct nl_addr_batch_check *check = check_;
+
+    if (check->check) {
+        nl_addr_batch_run_check(reqs, items, n_items, check->check,
+                                check->aux);
+    }
+    nl_addr_batch_resolve(reqs, items, n_items);
+}
+
+/***************************************************************************
+* nl_batch_ops 'put' of address batches.
+***************************************************************************/
+static int
+nl_addr_batch_put (struct nl_batch *batch, void *reqs, size_t i, void *aux)
+{
+    const struct nl_addr_req *req = &((struct nl_addr_req *) reqs)[i];
+    struct ifaddrmsg ifa;
+    size_t addr_len;
+
+    if (req->family == AF_INET) {
+        addr_len = sizeof req->addr.ipv4;
+    } else if (req->family == AF_INET6) {
+        addr_len = sizeof req->addr.ipv6;
+    } else {
+        return EAFNOSUPPORT;
+    }
+    if (!req->ifindex) {
+        return ENODEV;
+    }
+
+    memset(&ifa, 0, sizeof ifa);
+    ifa.ifa_family = req->family;
+    ifa.ifa_prefixlen = req->prefixlen;
+    ifa.ifa_index = req->ifindex;
+    if (req->add) {
+        nl_batch_put_msg(batch, RTM_NEWADDR, NLM_F_CREATE | NLM_F_REPLACE,
+                         &ifa, sizeof ifa);
+    } else {
+        nl_batch_put_msg(batch, RTM_DELADDR, 0, &ifa, sizeof ifa);
+    }
+    nl_batch_put_attr(batch, IFA_LOCAL, &req->addr, addr_len);
+    nl_batch_put_attr(batch, IFA_ADDRESS, &req->addr, addr_len);
+    return 0;
+}
+
+static int *
+nl_addr_batch_error (void *reqs, size_t i)
+{
+    return &((struct nl_addr_req *) reqs)[i].error;
+}
+
+static const struct nl_batch_ops nl_addr_batch_ops = {
+    nl_addr_batch_in_ns,
+    nl_addr_batch_put,
+    nl_addr_batch_error,
+};
+
+/***************************************************************************
+* Adds and removes a batch of interface addresses in a namespace.
+*
+* @param[in]  ns_name : namespace of the interfaces.
+* @param[in,out] reqs : addresses to program, 'error' is filled per item.
+* @param[in]  n_reqs  : number of items in reqs.
+*
+* @return number of items that failed, or -1 if the batch could not be sent.
+***************************************************************************/
+int
+nl_addr_batch (const char *ns_name, struct nl_addr_req *reqs, size_t n_reqs)
+{
+    return nl_addr_batch_check(ns_name, reqs, n_reqs, NULL, NULL);
+}
+
+/***************************************************************************
+* Adds and removes a batch of interface addresses in a namespace, after
+* passing each item to 'check' in the namespace.
+*
+* @param[in]  ns_name : namespace of the interfaces.
+* @param[in,out] reqs : addresses to program, 'error' is filled per item.
+* @param[in]  n_reqs  : number of items in reqs.
+* @param[in]  check   : validation of each item, may be NULL.
+* @param[in]  aux     : passed to 'check'.
+*
+* @return number of items that failed, or -1 if the batch could not be sent.
+***************************************************************************/
+int
+nl_addr_batch_check (const char *ns_name, struct nl_addr_req *reqs,
+                     size_t n_reqs, nl_addr_check_fn *check, void *aux)
+{
+    struct nl_addr_batch_check batch_check;
+
+    batch_check.check = check;
+    batch_check.aux = aux;
+    return nl_batch_run(ns_name, reqs, NULL, n_reqs, &nl_addr_batch_ops,
+                        &batch_check);
+}
+
+/***************************************************************************
+* nl_batch_ops 'put' of neighbor probes.
+***************************************************************************/
+static int
+nl_neigh_probe_put (struct nl_batch *batch, void *reqs, size_t i, void *aux)
+{
+    const struct nl_neigh_req *req = &((struct nl_neigh_req *) reqs)[i];
+    struct ndmsg ndm;
+    size_t addr_len;
+
+    if (req->family == AF_INET) {
+        addr_len = sizeof req->addr.ipv4;
+    } else if (req->family == AF_INET6) {
+        addr_len = sizeof req->addr.ipv6;
+    } else {
+        return EAFNOSUPPORT;
+    }
+    if (!req->ifindex) {
+        return ENODEV;
+    }
+
+    /* With NTF_USE the kernel does not change the entry itself, it starts
+     * resolution as if a packet were sent to the neighbor, creating the
+     * entry if needed. */
+    memset(&ndm, 0, sizeof ndm);
+    ndm.ndm_family = req->family;
+    ndm.ndm_ifindex = req->ifindex;
+    ndm.ndm_state = NUD_PROBE;
+    ndm.ndm_flags = NTF_USE;
+    nl_batch_put_msg(batch, RTM_NEWNEIGH, NLM_F_CREATE, &ndm, sizeof ndm);
+    nl_batch_put_attr(batch, NDA_DST, &req->addr, addr_len);
+    return 0;
+}
+
+static int *
+nl_neigh_probe_error (void *reqs, size_t i)
+{
+    return &((struct nl_neigh_req *) reqs)[i].error;
+}
+
+static const struct nl_batch_ops nl_neigh_probe_ops = {
+    NULL,
+    nl_neigh_probe_put,
+    nl_neigh_probe_error,
+};
+
+/* A neighbor probe request, ordered by namespace. */
+struct nl_neigh_probe_item
+{
+    const char *ns_name;        /* "" for the default namespace. */
+    size_t index;               /* In the requests. */
+};
+
+static int
+nl_neigh_probe_item_cmp (const void *a_, const void *b_)
+{
+    const struct nl_neigh_probe_item *a = a_;
+    const struct nl_neigh_probe_item *b = b_;
+    int cmp = strcmp(a->ns_name, b->ns_name);
+
+    if (cmp) {
+        return cmp;
+    }
+    return a->index < b->index ? -1 : a->index > b->index;
+}
+
+/***************************************************************************
+* Asks the kernel to resolve a batch of neighbors.
+*
+* @param[in,out] reqs : neighbors to resolve, 'error' is filled per item.
+* @param[in]  n_reqs  : number of items in reqs.
+*
+* @return number of items that failed, or -1 if a batch could not be sent.
+***************************************************************************/
+int
+nl_neigh_probe_batch (struct nl_neigh_req *reqs, size_t n_reqs)
+{
+    struct nl_neigh_probe_item *sorted;
+    size_t *items;
+    int failed = 0, rc = 0, n;
+    size_t i, first;
+
+    if (!n_reqs) {
+        return 0;
+    }
+
+    /* Sorting the requests by namespace, in their order within one, makes
+     * each namespace a run of 'items' sent as one batch. */
+    sorted = xmalloc(n_reqs * sizeof *sorted);
+    for (i = 0; i < n_reqs; i++) {
+        sorted[i].ns_name = nl_is_nondefault_ns(reqs[i].ns_name)
+                            ? reqs[i].ns_name : "";
+        sorted[i].index = i;
+    }
+    qsort(sorted, n_reqs, sizeof *sorted, nl_neigh_probe_item_cmp);
+    items = xmalloc(n_reqs * sizeof *items);
+    for (i = 0; i < n_reqs; i++) {
+        items[i] = sorted[i].index;
+    }
+
+    for (first = 0; first < n_reqs; first = i) {
+        for (i = first + 1; i < n_reqs
+             && !strcmp(sorted[i].ns_name, sorted[first].ns_name); i++) {
+            continue;
+        }
+        n = nl_batch_run(reqs[items[first]].ns_name, reqs, items + first,
+                         i - first, &nl_neigh_probe_ops, NULL);
+        if (n < 0) {
+            rc = -1;
+        } else {
+            failed += n;
+        }
+    }
+
+    free(items);
+    free(sorted);
+    return rc ? rc : failed;
+}
+
+/***************************************************************************
+* Appends the nexthops of a route to the last message of the batch: a single
+* nexthop as RTA_OIF and RTA_GATEWAY, several ones as RTA_MULTIPATH.
+***************************************************************************/
+static void
+nl_route_put_nexthops (struct nl_batch *batch,
+                       const struct nl_route_req *req, size_t addr_len)
+{
+    const struct nl_route_nexthop *nh;
+    struct rtnexthop *rtnh;
+    size_t mp, offset, i;
+    int ifindex;
+
+    if (req->n_nexthops == 1) {
+        nh = &req->nexthops[0];
+        if (nh->ifindex) {
+            ifindex = nh->ifindex;
+            nl_batch_put_attr(batch, RTA_OIF, &ifindex, sizeof ifindex);
+        }
+        if (nh->has_gateway) {
+            nl_batch_put_attr(batch, RTA_GATEWAY, &nh->gateway, addr_len);
+        }
+        return;
+    }
+
+    mp = nl_batch_nest_start(batch, RTA_MULTIPATH);
+    for (i = 0; i < req->n_nexthops; i++) {
+        nh = &req->nexthops[i];
+        offset = nl_batch_reserve(batch, sizeof *rtnh);
+        rtnh = (struct rtnexthop *) (batch->data + offset);
+        rtnh->rtnh_ifindex = nh->ifindex;
+        rtnh->rtnh_hops = nh->weight ? nh->weight - 1 : 0;
+        if (nh->has_gateway) {
+            nl_batch_put_attr(batch, RTA_GATEWAY, &nh->gateway, addr_len);
+        }
+        /* The buffer may have moved while appending the gateway. */
+        rtnh = (struct rtnexthop *) (batch->data + offset);
+        rtnh->rtnh_len = batch->size - offset;
+    }
+    nl_batch_nest_end(batch, mp);
+}
+
+/***************************************************************************
+* nl_batch_ops 'put' of routes, 'table' being the routing table id.
+***************************************************************************/
+static int
+nl_route_batch_put (struct nl_batch *batch, void *reqs, size_t i,
+                    void *table_)
+{
+    const struct nl_route_req *req = &((struct nl_route_req *) reqs)[i];
+    uint32_t table = *(uint32_t *) table_;
+    bool has_gateway = false;
+    struct rtmsg rtm;
+    size_t j, addr_len;
+
+    if (req->family == AF_INET) {
+        addr_len = sizeof req->prefix.ipv4;
+    } else if (req->family == AF_INET6) {
+        addr_len = sizeof req->prefix.ipv6;
+    } else {
+        return EAFNOSUPPORT;
+    }
+    if (req->prefixlen > addr_len * 8 || (req->add && !req->n_nexthops)) {
+        return EINVAL;
+    }
+
+    for (j = 0; j < req->n_nexthops; j++) {
+        has_gateway |= req->nexthops[j].has_gateway;
+    }
+
+    memset(&rtm, 0, sizeof rtm);
+    rtm.rtm_family = req->family;
+    rtm.rtm_dst_len = req->prefixlen;
+    rtm.rtm_table = table < 256 ? table : RT_TABLE_UNSPEC;
+    rtm.rtm_type = RTN_UNICAST;
+    if (req->add) {
+        rtm.rtm_protocol = RTPROT_STATIC;
+        rtm.rtm_scope = has_gateway ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK;
+        nl_batch_put_msg(batch, RTM_NEWROUTE, NLM_F_CREATE | NLM_F_REPLACE,
+                         &rtm, sizeof rtm);
+    } else {
+        rtm.rtm_scope = RT_SCOPE_NOWHERE;
+        nl_batch_put_msg(batch, RTM_DELROUTE, 0, &rtm, sizeof rtm);
+    }
+    nl_batch_put_attr(batch, RTA_TABLE, &table, sizeof table);
+    if (req->prefixlen) {
+        nl_batch_put_attr(batch, RTA_DST, &req->prefix, addr_len);
+    }
+    if (req->metric) {
+        nl_batch_put_attr(batch, RTA_PRIORITY, &req->metric,
+                          sizeof req->metric);
+    }
+    if (req->n_nexthops) {
+        nl_route_put_nexthops(batch, req, addr_len);
+    }
+    return 0;
+}
+
+static int *
+nl_route_batch_error (void *reqs, size_t i)
+{
+    return &((struct nl_route_req *) reqs)[i].error;
+}
+
+static const struct nl_batch_ops nl_route_batch_ops = {
+    NULL,
+    nl_route_batch_put,
+    nl_route_batch_error,
+};
+
+/***************************************************************************
+* Adds and removes a batch of routes in a routing table of a namespace.
+*
+* @param[in]  ns_name : namespace of the routing table.
+* @param[in]  table   : routing table id, 0 for the main table.
+* @param[in,out] reqs : routes to program, 'error' is filled per item.
+* @param[in]  n_reqs  : number of items in reqs.
+*
+* @return number of items that failed, or -1 if the batch could not be sent.
+***************************************************************************/
+int
+nl_route_batch (const char *ns_name, uint32_t table,
+                struct nl_route_req *reqs, size_t n_reqs)
+{
+    if (!table) {
+        table = RT_TABLE_MAIN;
+    }
+    return nl_batch_run(ns_name, reqs, NULL, n_reqs, &nl_route_batch_ops,
+                        &table);
+}
+
+static size_t
+nl_neigh_addr_len (int family)
+{
+    return family == AF_INET ? sizeof(struct in_addr)
+                             : sizeof(struct in6_addr);
+}
+
+static uint32_t
+nl_neigh_hash (int ifindex, int family, const void *addr)
+{
+    return hash_bytes(addr, nl_neigh_addr_len(family),
+                      hash_int(ifindex, family));
+}
+
+static struct nl_neigh_cache_node *
+nl_neigh_cache_find (const struct nl_neigh_cache *cache, int ifindex,
+                     int family, const void *addr, uint32_t hash)
+{
+    struct nl_neigh_cache_node *cn;
+
+    HMAP_FOR_EACH_WITH_HASH (cn, node, hash, &cache->entries) {
+        if (cn->entry.ifindex == ifindex && cn->entry.family == family
+            && !memcmp(&cn->entry.addr, addr, nl_neigh_addr_len(family))) {
+            return cn;
+        }
+    }
+    return NULL;
+}
+
+static void
+nl_neigh_cache_clear (struct nl_neigh_cache *cache)
+{
+    struct nl_neigh_cache_node *cn, *next;
+
+    HMAP_FOR_EACH_SAFE (cn, next, node, &cache->entries) {
+        hmap_remove(&cache->entries, &cn->node);
+        free(cn);
+    }
+}
+
+/***************************************************************************
+* Applies one RTM_NEWNEIGH or RTM_DELNEIGH message, from a dump or an event,
+* to the cache. Messages of other families (e.g. bridge FDB) are ignored.
+***************************************************************************/
+static void
+nl_neigh_cache_update (const struct nlmsghdr *nlh, void *cache_)
+{
+    struct nl_neigh_cache *cache = cache_;
+    const struct ndmsg *ndm = NLMSG_DATA(nlh);
+    const struct rtattr *rta;
+    const void *dst = NULL, *lladdr = NULL;
+    struct nl_neigh_cache_node *cn;
+    size_t lladdr_len = 0;
+    uint32_t hash;
+    int len;
+
+    if ((nlh->nlmsg_type != RTM_NEWNEIGH && nlh->nlmsg_type != RTM_DELNEIGH)
+        || nlh->nlmsg_len < NLMSG_LENGTH(sizeof *ndm)
+        || (ndm->ndm_family != AF_INET && ndm->ndm_family != AF_INET6)) {
+        return;
+    }
+
+    len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof *ndm);
+    for (rta = NDA_RTA(ndm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == NDA_DST
+            && RTA_PAYLOAD(rta) == nl_neigh_addr_len(ndm->ndm_family)) {
+            dst = RTA_DATA(rta);
+        } else if (rta->rta_type == NDA_LLADDR) {
+            lladdr = RTA_DATA(rta);
+            lladdr_len = MIN(RTA_PAYLOAD(rta), sizeof cn->entry.lladdr);
+        }
+    }
+    if (!dst) {
+        return;
+    }
+
+    hash = nl_neigh_hash(ndm->ndm_ifindex, ndm->ndm_family, dst);
+    cn = nl_neigh_cache_find(cache, ndm->ndm_ifindex, ndm->ndm_family, dst,
+                             hash);
+    if (nlh->nlmsg_type == RTM_DELNEIGH) {
+        if (cn) {
+            hmap_remove(&cache->entries, &cn->node);
+            free(cn);
+        }
+        return;
+    }
+
+    if (!cn) {
+        cn = xzalloc(sizeof *cn);
+        cn->entry.ifindex = ndm->ndm_ifindex;
+        cn->entry.family = ndm->ndm_family;
+        memcpy(&cn->entry.addr, dst, nl_neigh_addr_len(ndm->ndm_family));
+        hmap_insert(&cache->entries, &cn->node, hash);
+    }
+    cn->entry.state = ndm->ndm_state;
+    cn->entry.flags = ndm->ndm_flags;
+    /* Entries being resolved or failed have no link-layer address. */
+    cn->entry.lladdr_len = lladdr_len;
+    if (lladdr_len) {
+        memcpy(cn->entry.lladdr, lladdr, lladdr_len);
+    }
+}
+
+/***************************************************************************
+* Replaces the content of the cache with a RTM_GETNEIGH dump, read from a
+* new netlink socket of the namespace of the calling thread.
+*
+* @return 0 if sucessful, else an errno value
+***************************************************************************/
+static int
+nl_neigh_cache_dump (void *cache_)
+{
+    struct nl_neigh_cache *cache = cache_;
+    struct {
+        struct nlmsghdr n;
+        struct ndmsg ndm;
+    } req;
+    int sock, error;
+
+    sock = nl_batch_socket_open();
+    if (sock < 0) {
+        return EIO;
+    }
+
+    memset(&req, 0, sizeof req);
+    req.n.nlmsg_len = NLMSG_LENGTH(sizeof req.ndm);
+    req.n.nlmsg_type = RTM_GETNEIGH;
+    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.ndm.ndm_family = AF_UNSPEC;
+
+    nl_neigh_cache_clear(cache);
+    error = nl_dump(sock, &req.n, nl_neigh_cache_update, cache);
+    close(sock);
+    return error;
+}
+
+/***************************************************************************
+* Creates the neighbor cache of a namespace.
+*
+* @param[in]  ns_name : namespace to track, NULL for the default one.
+*
+* @return the new cache, or NULL on failure
+***************************************************************************/
+struct nl_neigh_cache *
+nl_neigh_cache_create (const char *ns_name)
+{
+    bool non_default_ns = nl_is_nondefault_ns(ns_name);
+    struct nl_neigh_cache *cache;
+    int error;
+
+    if (non_default_ns && nl_setns_with_name(ns_name)) {
+        return NULL;
+    }
+
+    cache = xzalloc(sizeof *cache);
+    hmap_init(&cache->entries);
+    if (non_default_ns) {
+        snprintf(cache->ns_name, sizeof cache->ns_name, "%s", ns_name);
+    }
+
+    cache->event_sock = nl_event_sock_open(RTMGRP_NEIGH);
+    error = cache->event_sock < 0 ? -cache->event_sock
+                                  : nl_neigh_cache_dump(cache);
+
+    if (non_default_ns) {
+        nl_setns_with_name(SWITCH_NAMESPACE);
+    }
+    if (error) {
+        nl_neigh_cache_destroy(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+/***************************************************************************
+* Destroys a neighbor cache.
+*
+* @param[in]  cache : cache to destroy, may be NULL.
+***************************************************************************/
+void
+nl_neigh_cache_destroy (struct nl_neigh_cache *cache)
+{
+    if (cache) {
+        if (cache->event_sock >= 0) {
+            close(cache->event_sock);
+        }
+        nl_neigh_cache_clear(cache);
+        hmap_destroy(&cache->entries);
+        free(cache);
+    }
+}
+
+/***************************************************************************
+* Returns the descriptor that becomes readable when neighbor events are
+* pending.
+***************************************************************************/
+int
+nl_neigh_cache_fd (const struct nl_neigh_cache *cache)
+{
+    return cache->event_sock;
+}
+
+/***************************************************************************
+* Applies the pending neighbor events to the cache. If events were lost
+* because the socket overflowed, the cache is seeded again from a dump.
+*
+* @param[in]  cache : cache to update.
+*
+* @return 0 if sucessful, else an errno value
+***************************************************************************/
+int
+nl_neigh_cache_run (struct nl_neigh_cache *cache)
+{
+    return nl_event_sock_run(cache->event_sock,
+                             cache->ns_name[0] ? cache->ns_name : NULL,
+                             nl_neigh_cache_update, nl_neigh_cache_dump,
+                             cache);
+}
+
+/***************************************************************************
+* Looks up a neighbor in the cache.
+*
+* @return true if found, with the entry copied to 'entry'
+***************************************************************************/
+bool
+nl_neigh_cache_lookup (const struct nl_neigh_cache *cache, int ifindex,
+                       int family, const void *addr,
+                       struct nl_neigh_entry *entry)
+{
+    struct nl_neigh_cache_node *cn;
+
+    if (family != AF_INET && family != AF_INET6) {
+        return false;
+    }
+    cn = nl_neigh_cache_find(cache, ifindex, family, addr,
+                             nl_neigh_hash(ifindex, family, addr));
+    if (cn && entry) {
+        *entry = cn->entry;
+    }
+    return cn != NULL;
+}
+
+/***************************************************************************
+* Calls 'cb' for every neighbor of the cache, in no particular order.
+***************************************************************************/
+void
+nl_neigh_cache_for_each (const struct nl_neigh_cache *cache,
+                         nl_neigh_cache_cb *cb, void *aux)
+{
+    struct nl_neigh_cache_node *cn;
+
+    HMAP_FOR_EACH (cn, node, &cache->entries) {
+        cb(&cn->entry, aux);
+    }
+}
+
+/***************************************************************************
+* Returns the number of neighbors in the cache.
+***************************************************************************/
+size_t
+nl_neigh_cache_count (const struct nl_neigh_cache *cache)
+{
+    return hmap_count(&cache->entries);
+}
+
+/* Interface counters being collected by a dump. */
+struct nl_if_stats_dump
+{
+    struct nl_if_stats *stats;
+    size_t n_stats;
+    size_t allocated;
+};
+
+static void
+nl_if_stats_add (struct nl_if_stats_dump *dump, int ifindex,
+                 const struct rtattr *rta)
+{
+    struct nl_if_stats *ifs;
+
+    if (dump->n_stats >= dump->allocated) {
+        dump->stats = x2nrealloc(dump->stats, &dump->allocated,
+                                 sizeof *dump->stats);
+    }
+    ifs = &dump->stats[dump->n_stats++];
+    memset(ifs, 0, sizeof *ifs);
+    ifs->ifindex = ifindex;
+    /* Older kernels send a shorter structure. */
+    memcpy(&ifs->stats, RTA_DATA(rta),
+           MIN(RTA_PAYLOAD(rta), sizeof ifs->stats));
+}
+
+#ifdef RTM_GETSTATS
+/***************************************************************************
+* nl_dump callback of a RTM_GETSTATS dump.
+***************************************************************************/
+static void
+nl_if_stats_parse_stats (const struct nlmsghdr *nlh, void *dump)
+{
+    const struct if_stats_msg *ifsm = NLMSG_DATA(nlh);
+    const struct rtattr *rta;
+    int len;
+
+    if (nlh->nlmsg_type != RTM_NEWSTATS
+        || nlh->nlmsg_len < NLMSG_LENGTH(sizeof *ifsm)) {
+        return;
+    }
+    len = nlh->nlmsg_len - NLMSG_LENGTH(NLMSG_ALIGN(sizeof *ifsm));
+    for (rta = (const struct rtattr *) ((const char *) ifsm
+                                        + NLMSG_ALIGN(sizeof *ifsm));
+         RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_STATS_LINK_64) {
+            nl_if_stats_add(dump, ifsm->ifindex, rta);
+        }
+    }
+}
+#endif
+
+/***************************************************************************
+* nl_dump callback of a RTM_GETLINK dump.
+***************************************************************************/
+static void
+nl_if_stats_parse_link (const struct nlmsghdr *nlh, void *dump)
+{
+    const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    const struct rtattr *rta;
+    int len;
+
+    if (nlh->nlmsg_type != RTM_NEWLINK
+        || nlh->nlmsg_len < NLMSG_LENGTH(sizeof *ifi)) {
+        return;
+    }
+    len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof *ifi);
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_STATS64) {
+            nl_if_stats_add(dump, ifi->ifi_index, rta);
+        }
+    }
+}
+
+/***************************************************************************
+* Dumps the counters of all the interfaces of the namespace of the calling
+* thread. RTM_GETSTATS, filtered to the 64 bits link counters, avoids
+* dumping all the link attributes; RTM_GETLINK is the fallback for kernels
+* without it.
+*
+* @return 0 if sucessful, else an errno value
+***************************************************************************/
+static int
+nl_if_stats_dump (struct nl_if_stats_dump *dump)
+{
+    struct {
+        struct nlmsghdr n;
+        struct ifinfomsg ifi;
+    } link_req;
+    int sock, error;
+
+    sock = nl_batch_socket_open();
+    if (sock < 0) {
+        return EIO;
+    }
+
+#ifdef RTM_GETSTATS
+    struct {
+        struct nlmsghdr n;
+        struct if_stats_msg ifsm;
+    } stats_req;
+
+    memset(&stats_req, 0, sizeof stats_req);
+    stats_req.n.nlmsg_len = NLMSG_LENGTH(sizeof stats_req.ifsm);
+    stats_req.n.nlmsg_type = RTM_GETSTATS;
+    stats_req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    stats_req.ifsm.filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+    error = nl_dump(sock, &stats_req.n, nl_if_stats_parse_stats, dump);
+    if (error != EOPNOTSUPP && error != EINVAL) {
+        close(sock);
+        return error;
+    }
+    dump->n_stats = 0;
+#endif
+
+    memset(&link_req, 0, sizeof link_req);
+    link_req.n.nlmsg_len = NLMSG_LENGTH(sizeof link_req.ifi);
+    link_req.n.nlmsg_type = RTM_GETLINK;
+    link_req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    link_req.ifi.ifi_family = AF_UNSPEC;
+    error = nl_dump(sock, &link_req.n, nl_if_stats_parse_link, dump);
+    close(sock);
+    return error;
+}
+
+static long long int
+nl_if_stats_now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 /***************************************************************************
-* type of action to be performed inside the thread
+* Returns the counters of all the interfaces of a namespace, from the last
+* dump if it is at most 'ttl_ms' old.
 *
-* @param[in]  tdata : struct nlutils_op_data parameter for parsing
+* @param[in]  ns_name : namespace of the interfaces.
+* @param[in]  ttl_ms  : maximum age of cached counters, 0 to dump.
+* @param[out] stats   : set to an array of counters to free with free().
+* @param[out] n_stats : set to the number of interfaces in 'stats'.
 *
-* executes desired operation and stores the result in tdata itself
+* @return 0 if sucessful, else an errno value
 ***************************************************************************/
-void nl_perform_socket_operation(struct nlutils_op_data *tdata)
+int
+nl_if_stats_get (const char *ns_name, unsigned int ttl_ms,
+                 struct nl_if_stats **stats, size_t *n_stats)
 {
-   int ns_sock = -1;
-   switch (tdata->operation)
-   {
-       case NLUTILS_SOCKET_CREATE:
-           /* Open a socket in the namespace set by thread */
-           ns_sock = socket(tdata->params.s->family,
-                            tdata->params.s->type,
-                            tdata->params.s->protocol);
+    bool non_default_ns = nl_is_nondefault_ns(ns_name);
+    const char *name = non_default_ns ? ns_name : "";
+    struct nl_if_stats_dump dump;
+    struct nl_if_stats_cache *c;
+    long long int start;
+    bool release;
+    int error = 0;
 
-           if (ns_sock < 0) {
-               VLOG_ERR("socket creation failed (%s) in namespace %s",
-                                      strerror(errno), tdata->ns_name);
-           }
-           tdata->result=ns_sock;
-           break;
-       case NLUTILS_IFINDEX_TO_NAME:
-           if_indextoname(tdata->params.in.ifindex, tdata->params.in.ifname);
-           tdata->result=0;
-           break;
-       case NLUTILS_IFNAME_TO_INDEX:
-           tdata->params.ni.ifindex = if_nametoindex(tdata->params.ni.ifname);
-           tdata->result=0;
-           break;
-       default:
-           VLOG_ERR("unsupported op %d in ns name %s",
-                                       tdata->operation, tdata->ns_name);
-           break;
-   }
-   return;
+    *stats = NULL;
+    *n_stats = 0;
+    memset(&dump, 0, sizeof dump);
+
+    pthread_mutex_lock(&nl_if_stats_mutex);
+    HMAP_FOR_EACH_WITH_HASH (c, node, hash_string(name, 0),
+                             &nl_if_stats_caches) {
+        if (!strcmp(c->ns_name, name)) {
+            break;
+        }
+    }
+    if (!c) {
+        c = xzalloc(sizeof *c);
+        snprintf(c->ns_name, sizeof c->ns_name, "%s", name);
+        pthread_mutex_init(&c->dump_mutex, NULL);
+        hmap_insert(&nl_if_stats_caches, &c->node, hash_string(name, 0));
+    }
+
+    start = nl_if_stats_now_ms();
+    if (!c->dumped || !ttl_ms || start - c->when_ms > ttl_ms) {
+        /* Concurrent pollers of the namespace wait for one dump instead of
+         * dumping too. */
+        c->n_users++;
+        pthread_mutex_unlock(&nl_if_stats_mutex);
+        pthread_mutex_lock(&c->dump_mutex);
+
+        pthread_mutex_lock(&nl_if_stats_mutex);
+        if (!c->dumped || c->when_ms < start) {
+            pthread_mutex_unlock(&nl_if_stats_mutex);
+            if (non_default_ns && nl_setns_with_name(ns_name)) {
+                error = ENOENT;
+            } else {
+                error = nl_if_stats_dump(&dump);
+                if (non_default_ns) {
+                    nl_setns_with_name(SWITCH_NAMESPACE);
+                }
+            }
+            pthread_mutex_lock(&nl_if_stats_mutex);
+            if (!error) {
+                free(c->stats);
+                c->stats = dump.stats;
+                c->n_stats = dump.n_stats;
+                c->when_ms = nl_if_stats_now_ms();
+                c->dumped = true;
+            } else {
+                free(dump.stats);
+            }
+        }
+        c->n_users--;
+        pthread_mutex_unlock(&c->dump_mutex);
+    }
+
+    if (!error && c->n_stats) {
+        *stats = xmemdup(c->stats, c->n_stats * sizeof *c->stats);
+        *n_stats = c->n_stats;
+    }
+    if (error && !c->dumped && !c->removed && !c->n_users) {
+        /* Keep no entry for a namespace that could not be dumped. */
+        hmap_remove(&nl_if_stats_caches, &c->node);
+        c->removed = true;
+    }
+    release = c->removed && !c->n_users;
+    pthread_mutex_unlock(&nl_if_stats_mutex);
+
+    if (release) {
+        pthread_mutex_destroy(&c->dump_mutex);
+        free(c->stats);
+        free(c);
+    }
+    return error;
+}
+
+/***************************************************************************
+* Drops the cached interface counters of a namespace.
+*
+* @param[in]  ns_name : namespace to forget, NULL for all namespaces.
+***************************************************************************/
+void
+nl_if_stats_flush (const char *ns_name)
+{
+    struct nl_if_stats_cache *c, *next;
+
+    pthread_mutex_lock(&nl_if_stats_mutex);
+    HMAP_FOR_EACH_SAFE (c, next, node, &nl_if_stats_caches) {
+        if (!ns_name
+            || !strcmp(c->ns_name,
+                       nl_is_nondefault_ns(ns_name) ? ns_name : "")) {
+            hmap_remove(&nl_if_stats_caches, &c->node);
+            if (c->n_users) {
+                c->removed = true;
+                continue;
+            }
+            pthread_mutex_destroy(&c->dump_mutex);
+            free(c->stats);
+            free(c);
+        }
+    }
+    pthread_mutex_unlock(&nl_if_stats_mutex);
 }
 
+/* VLANs of a bridge port being collected by a dump. */
+struct nl_bridge_vlan_dump
+{
+    int ifindex;            /* Bridge port. */
+    int *vlans;             /* vlans[vid] is set if the port has 'vid'. */
+};
 
 /***************************************************************************
- * check if the ns_name is default namespace or not.
- *
- * @param[in]  ns_name  : the namespace name to used for comparision.
- *
- * @return 0 if default namespace, else 1
- ***************************************************************************/
-static bool nl_is_nondefault_ns(const char *ns_name)
+* nl_dump callback of an AF_BRIDGE RTM_GETLINK dump: marks the VLANs of the
+* port, ranges included.
+***************************************************************************/
+static void
+nl_bridge_vlan_parse (const struct nlmsghdr *nlh, void *dump_)
 {
-     if (!ns_name
-         || strncmp(ns_name, SWITCH_NAMESPACE, strlen(SWITCH_NAMESPACE)) == 0)
-     {
-        /* DEFAULT namespace. ignore entering this namespace again */
-        return 0;
-     }
-     return 1;
+    const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    const struct nl_bridge_vlan_dump *dump = dump_;
+    const struct bridge_vlan_info *info;
+    const struct rtattr *rta, *nested;
+    int len, nested_len, begin = 0, vid;
+
+    if (nlh->nlmsg_type != RTM_NEWLINK
+        || nlh->nlmsg_len < NLMSG_LENGTH(sizeof *ifi)
+        || ifi->ifi_index != dump->ifindex) {
+        return;
+    }
+    len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof *ifi);
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type != IFLA_AF_SPEC) {
+            continue;
+        }
+        nested_len = RTA_PAYLOAD(rta);
+        for (nested = RTA_DATA(rta); RTA_OK(nested, nested_len);
+             nested = RTA_NEXT(nested, nested_len)) {
+            if (nested->rta_type != IFLA_BRIDGE_VLAN_INFO
+                || RTA_PAYLOAD(nested) < sizeof *info) {
+                continue;
+            }
+            info = RTA_DATA(nested);
+            if (!info->vid || info->vid > NL_VLAN_MAX) {
+                continue;
+            }
+            if (info->flags & BRIDGE_VLAN_INFO_RANGE_BEGIN) {
+                begin = info->vid;
+                continue;
+            }
+            if (!(info->flags & BRIDGE_VLAN_INFO_RANGE_END) || !begin) {
+                begin = info->vid;
+            }
+            for (vid = begin; vid <= info->vid; vid++) {
+                dump->vlans[vid] = 1;
+            }
+            begin = 0;
+        }
+    }
+}
+
+/***************************************************************************
+* Appends the VLANs set in 'vlans' to the last message of the batch, runs of
+* consecutive VLANs being sent as one BRIDGE_VLAN_INFO_RANGE_BEGIN and
+* BRIDGE_VLAN_INFO_RANGE_END pair.
+***************************************************************************/
+static void
+nl_bridge_vlan_put_ranges (struct nl_batch *batch, const int *vlans,
+                           uint16_t flags)
+{
+    struct bridge_vlan_info info;
+    int vid, end;
+
+    for (vid = 1; vid <= NL_VLAN_MAX; vid++) {
+        if (!vlans[vid]) {
+            continue;
+        }
+        for (end = vid; end < NL_VLAN_MAX && vlans[end + 1]; end++) {
+            continue;
+        }
+        info.vid = vid;
+        if (end == vid) {
+            info.flags = flags;
+            nl_batch_put_attr(batch, IFLA_BRIDGE_VLAN_INFO, &info,
+                              sizeof info);
+        } else {
+            info.flags = flags | BRIDGE_VLAN_INFO_RANGE_BEGIN;
+            nl_batch_put_attr(batch, IFLA_BRIDGE_VLAN_INFO, &info,
+                              sizeof info);
+            info.vid = end;
+            info.flags = flags | BRIDGE_VLAN_INFO_RANGE_END;
+            nl_batch_put_attr(batch, IFLA_BRIDGE_VLAN_INFO, &info,
+                              sizeof info);
+        }
+        vid = end;
+    }
+}
+
+/***************************************************************************
+* Sets the VLANs of a bridge port.
+*
+* @param[in]  ns_name          : namespace of the bridge.
+* @param[in]  ifindex          : ifindex of the bridge port.
+* @param[in]  tag              : untagged PVID of the port, 0 for none.
+* @param[in]  trunk_vlan_ids   : tagged VLANs of the port.
+* @param[in]  trunk_vlan_count : count of trunk VLANs.
+*
+* @return 0 if sucessful, else an errno value
+***************************************************************************/
+int
+nl_bridge_vlan_set (const char *ns_name, int ifindex, int tag,
+                    const int64_t *trunk_vlan_ids, int trunk_vlan_count)
+{
+    bool non_default_ns = nl_is_nondefault_ns(ns_name);
+    struct {
+        struct nlmsghdr n;
+        struct ifinfomsg ifi;
+        struct rtattr rta;
+        uint32_t ext_mask;
+    } req;
+    struct nl_bridge_vlan_dump dump;
+    struct bridge_vlan_info info;
+    int *have, *want, errors[2];
+    struct ifinfomsg ifi;
+    struct nl_batch batch;
+    int sock, error, vid, i;
+    bool del = false;
+    size_t nest;
+
+    if (tag < 0 || tag > NL_VLAN_MAX) {
+        return EINVAL;
+    }
+    for (i = 0; i < trunk_vlan_count; i++) {
+        if (trunk_vlan_ids[i] < 1 || trunk_vlan_ids[i] > NL_VLAN_MAX) {
+            return EINVAL;
+        }
+    }
+
+    if (non_default_ns && nl_setns_with_name(ns_name)) {
+        return ENOENT;
+    }
+    sock = nl_batch_socket_open();
+    if (non_default_ns) {
+        nl_setns_with_name(SWITCH_NAMESPACE);
+    }
+    if (sock < 0) {
+        return EIO;
+    }
+
+    /* Read the VLANs of the port, to remove the ones not wanted anymore. */
+    have = xzalloc((NL_VLAN_MAX + 1) * sizeof *have);
+    want = xzalloc((NL_VLAN_MAX + 1) * sizeof *want);
+    memset(&req, 0, sizeof req);
+    req.n.nlmsg_len = sizeof req;
+    req.n.nlmsg_type = RTM_GETLINK;
+    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.ifi.ifi_family = AF_BRIDGE;
+    req.rta.rta_type = IFLA_EXT_MASK;
+    req.rta.rta_len = RTA_LENGTH(sizeof req.ext_mask);
+    req.ext_mask = RTEXT_FILTER_BRVLAN_COMPRESSED;
+    dump.ifindex = ifindex;
+    dump.vlans = have;
+    error = nl_dump(sock, &req.n, nl_bridge_vlan_parse, &dump);
+    if (error) {
+        goto out;
+    }
+
+    for (i = 0; i < trunk_vlan_count; i++) {
+        want[trunk_vlan_ids[i]] = 1;
+    }
+    for (vid = 1; vid <= NL_VLAN_MAX; vid++) {
+        have[vid] = have[vid] && !want[vid] && vid != tag;
+        del |= have[vid];
+    }
+    if (tag) {
+        want[tag] = 0;
+    }
+
+    /* The port VLANs are set through the AF_BRIDGE link messages, one to
+     * remove and one to add, whatever the number of VLANs. */
+    nl_batch_init(&batch);
+    memset(&ifi, 0, sizeof ifi);
+    ifi.ifi_family = AF_BRIDGE;
+    ifi.ifi_index = ifindex;
+    if (del) {
+        nl_batch_put_msg(&batch, RTM_DELLINK, 0, &ifi, sizeof ifi);
+        nest = nl_batch_nest_start(&batch, IFLA_AF_SPEC);
+        nl_bridge_vlan_put_ranges(&batch, have, 0);
+        nl_batch_nest_end(&batch, nest);
+    }
+    if (tag || trunk_vlan_count) {
+        nl_batch_put_msg(&batch, RTM_SETLINK, 0, &ifi, sizeof ifi);
+        nest = nl_batch_nest_start(&batch, IFLA_AF_SPEC);
+        if (tag) {
+            /* A PVID can not be part of a range. */
+            info.vid = tag;
+            info.flags = BRIDGE_VLAN_INFO_PVID | BRIDGE_VLAN_INFO_UNTAGGED;
+            nl_batch_put_attr(&batch, IFLA_BRIDGE_VLAN_INFO, &info,
+                              sizeof info);
+        }
+        nl_bridge_vlan_put_ranges(&batch, want, 0);
+        nl_batch_nest_end(&batch, nest);
+    }
+    if (batch.n_msgs) {
+        if (nl_batch_transact(sock, &batch, errors) < 0) {
+            /* The batch could not be sent or its replies were lost. */
+            error = errors[0] > 0 ? errors[0] : EIO;
+        } else {
+            error = errors[0] ? errors[0]
+                    : batch.n_msgs > 1 ? errors[1] : 0;
+        }
+    }
+    nl_batch_destroy(&batch);
+
+out:
+    free(have);
+    free(want);
+    close(sock);
+    return error;
+}
+
+static struct nl_locator_ns *
+nl_locator_ns_find (const char *ns_name)
+{
+    struct nl_locator_ns *ns;
+
+    HMAP_FOR_EACH_WITH_HASH (ns, node, hash_string(ns_name, 0),
+                             &nl_locator_namespaces) {
+        if (!strcmp(ns->ns_name, ns_name)) {
+            return ns;
+        }
+    }
+    return NULL;
+}
+
+static struct nl_locator_intf *
+nl_locator_intf_find (const struct nl_locator_ns *ns, int ifindex)
+{
+    struct nl_locator_intf *intf;
+
+    HMAP_FOR_EACH_WITH_HASH (intf, index_node, hash_int(ifindex, 0),
+                             &nl_locator_by_index) {
+        if (intf->ns == ns && intf->ifindex == ifindex) {
+            return intf;
+        }
+    }
+    return NULL;
+}
+
+static void
+nl_locator_intf_remove (struct nl_locator_intf *intf)
+{
+    hmap_remove(&nl_locator_by_name, &intf->name_node);
+    hmap_remove(&nl_locator_by_index, &intf->index_node);
+    free(intf);
+}
+
+/* Forgets all the interfaces of a namespace. */
+static void
+nl_locator_ns_clear (const struct nl_locator_ns *ns)
+{
+    struct nl_locator_intf *intf, *next;
+
+    HMAP_FOR_EACH_SAFE (intf, next, index_node, &nl_locator_by_index) {
+        if (intf->ns == ns) {
+            nl_locator_intf_remove(intf);
+        }
+    }
+}
+
+/***************************************************************************
+* Applies one RTM_NEWLINK or RTM_DELLINK message of namespace 'ns_', from a
+* dump or an event. An interface moved to another namespace is reported as
+* deleted in the old one and as new in the other one, in whichever order
+* the two sockets are read: each namespace only ever removes its own
+* entries, so the interface ends up in the new namespace only.
+***************************************************************************/
+static void
+nl_locator_update (const struct nlmsghdr *nlh, void *ns_)
+{
+    struct nl_locator_ns *ns = ns_;
+    const struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+    const struct rtattr *rta;
+    struct nl_locator_intf *intf;
+    const char *name = NULL;
+    int len;
+
+    /* Bridge port messages (AF_BRIDGE) come and go with the port
+     * membership, not with the interface. */
+    if ((nlh->nlmsg_type != RTM_NEWLINK && nlh->nlmsg_type != RTM_DELLINK)
+        || nlh->nlmsg_len < NLMSG_LENGTH(sizeof *ifi)
+        || ifi->ifi_family == AF_BRIDGE) {
+        return;
+    }
+
+    intf = nl_locator_intf_find(ns, ifi->ifi_index);
+    if (nlh->nlmsg_type == RTM_DELLINK) {
+        if (intf) {
+            nl_locator_intf_remove(intf);
+        }
+        return;
+    }
+
+    len = nlh->nlmsg_len - NLMSG_LENGTH(sizeof *ifi);
+    for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFLA_IFNAME && RTA_PAYLOAD(rta) > 0) {
+            name = RTA_DATA(rta);
+        }
+    }
+    if (!name) {
+        return;
+    }
+
+    if (!intf) {
+        intf = xzalloc(sizeof *intf);
+        intf->ns = ns;
+        intf->ifindex = ifi->ifi_index;
+        hmap_insert(&nl_locator_by_index, &intf->index_node,
+                    hash_int(intf->ifindex, 0));
+    } else if (!strncmp(intf->name, name, sizeof intf->name - 1)) {
+        return;
+    } else {
+        /* Renamed. */
+        hmap_remove(&nl_locator_by_name, &intf->name_node);
+    }
+    snprintf(intf->name, sizeof intf->name, "%s", name);
+    hmap_insert(&nl_locator_by_name, &intf->name_node,
+                hash_string(intf->name, 0));
+}
+
+/***************************************************************************
+* Replaces the interfaces of a namespace with a RTM_GETLINK dump, read from
+* a new netlink socket of the namespace of the calling thread.
+*
+* @return 0 if sucessful, else an errno value
+***************************************************************************/
+static int
+nl_locator_dump (void *ns_)
+{
+    struct nl_locator_ns *ns = ns_;
+    struct {
+        struct nlmsghdr n;
+        struct ifinfomsg ifi;
+    } req;
+    int sock, error;
+
+    sock = nl_batch_socket_open();
+    if (sock < 0) {
+        return EIO;
+    }
+
+    memset(&req, 0, sizeof req);
+    req.n.nlmsg_len = NLMSG_LENGTH(sizeof req.ifi);
+    req.n.nlmsg_type = RTM_GETLINK;
+    req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.ifi.ifi_family = AF_UNSPEC;
+
+    nl_locator_ns_clear(ns);
+    error = nl_dump(sock, &req.n, nl_locator_update, ns);
+    close(sock);
+    return error;
+}
+
+static void
+nl_locator_ns_destroy (struct nl_locator_ns *ns)
+{
+    nl_locator_ns_clear(ns);
+    if (ns->event_sock >= 0) {
+        if (nl_locator_epoll_fd >= 0) {
+            epoll_ctl(nl_locator_epoll_fd, EPOLL_CTL_DEL, ns->event_sock,
+                      NULL);
+        }
+        close(ns->event_sock);
+    }
+    free(ns);
+}
+
+/***************************************************************************
+* Subscribes to the link events of the namespace of the calling thread,
+* then dumps its interfaces.
+*
+* @return 0 if sucessful, else an errno value
+***************************************************************************/
+static int
+nl_locator_ns_open (struct nl_locator_ns *ns)
+{
+    struct epoll_event ev;
+    int error;
+
+    ns->event_sock = nl_event_sock_open(RTMGRP_LINK);
+    if (ns->event_sock < 0) {
+        return -ns->event_sock;
+    }
+
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = ns;
+    if (epoll_ctl(nl_locator_epoll_fd, EPOLL_CTL_ADD, ns->event_sock,
+                  &ev) < 0) {
+        error = errno;
+        VLOG_ERR("Unable to watch netlink socket (%s)", strerror(error));
+        return error;
+    }
+    return nl_locator_dump(ns);
+}
+
+/***************************************************************************
+* Starts tracking the interfaces of a namespace.
+*
+* @param[in]  ns_name  : namespace to track, NULL for the default one.
+* @param[in]  vrf_name : VRF of the namespace.
+*
+* @return 0 if sucessful, else an errno value
+***************************************************************************/
+int
+nl_intf_locator_add_ns (const char *ns_name, const char *vrf_name)
+{
+    bool non_default_ns = nl_is_nondefault_ns(ns_name);
+    struct nl_locator_ns *ns;
+    int error = 0;
+
+    if (!non_default_ns) {
+        ns_name = SWITCH_NAMESPACE;
+    }
+
+    pthread_mutex_lock(&nl_locator_mutex);
+    if (nl_locator_epoll_fd < 0) {
+        nl_locator_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (nl_locator_epoll_fd < 0) {
+            error = errno;
+            VLOG_ERR("Unable to create epoll instance (%s)",
+                     strerror(error));
+            goto out;
+        }
+    }
+    ns = nl_locator_ns_find(ns_name);
+    if (ns) {
+        snprintf(ns->vrf_name, sizeof ns->vrf_name, "%s",
+                 vrf_name ? vrf_name : "");
+        goto out;
+    }
+
+    if (non_default_ns && nl_setns_with_name(ns_name)) {
+        error = ENOENT;
+        goto out;
+    }
+    ns = xzalloc(sizeof *ns);
+    snprintf(ns->ns_name, sizeof ns->ns_name, "%s", ns_name);
+    snprintf(ns->vrf_name, sizeof ns->vrf_name, "%s",
+             vrf_name ? vrf_name : "");
+    hmap_insert(&nl_locator_namespaces, &ns->node,
+                hash_string(ns->ns_name, 0));
+    error = nl_locator_ns_open(ns);
+    if (non_default_ns) {
+        nl_setns_with_name(SWITCH_NAMESPACE);
+    }
+    if (error) {
+        hmap_remove(&nl_locator_namespaces, &ns->node);
+        nl_locator_ns_destroy(ns);
+    }
+
+out:
+    pthread_mutex_unlock(&nl_locator_mutex);
+    return error;
+}
+
+/***************************************************************************
+* Stops tracking a namespace and forgets its interfaces.
+*
+* @param[in]  ns_name : namespace to forget, NULL for the default one.
+***************************************************************************/
+void
+nl_intf_locator_remove_ns (const char *ns_name)
+{
+    struct nl_locator_ns *ns;
+
+    pthread_mutex_lock(&nl_locator_mutex);
+    ns = nl_locator_ns_find(nl_is_nondefault_ns(ns_name) ? ns_name
+                                                          : SWITCH_NAMESPACE);
+    if (ns) {
+        hmap_remove(&nl_locator_namespaces, &ns->node);
+        nl_locator_ns_destroy(ns);
+    }
+    pthread_mutex_unlock(&nl_locator_mutex);
+}
+
+/***************************************************************************
+* Returns a descriptor that becomes readable when nl_intf_locator_run() has
+* link events to apply, or -1 if no namespace was ever added.
+***************************************************************************/
+int
+nl_intf_locator_fd (void)
+{
+    int fd;
+
+    pthread_mutex_lock(&nl_locator_mutex);
+    fd = nl_locator_epoll_fd;
+    pthread_mutex_unlock(&nl_locator_mutex);
+    return fd;
+}
+
+/***************************************************************************
+* Applies the pending link events of one namespace. If events were lost
+* because the socket overflowed, the namespace is dumped again.
+***************************************************************************/
+static int
+nl_locator_ns_run (struct nl_locator_ns *ns)
+{
+    return nl_event_sock_run(ns->event_sock, ns->ns_name, nl_locator_update,
+                             nl_locator_dump, ns);
+}
+
+/***************************************************************************
+* Applies the pending link events of all the tracked namespaces. Only the
+* namespaces with pending events are read.
+*
+* @return 0 if sucessful, else the errno value of the last failure
+***************************************************************************/
+int
+nl_intf_locator_run (void)
+{
+    struct epoll_event events[64];
+    int n, i, error = 0, retval;
+
+    pthread_mutex_lock(&nl_locator_mutex);
+    if (nl_locator_epoll_fd >= 0) {
+        do {
+            n = epoll_wait(nl_locator_epoll_fd, events, ARRAY_SIZE(events),
+                           0);
+            for (i = 0; i < n; i++) {
+                retval = nl_locator_ns_run(events[i].data.ptr);
+                if (retval) {
+                    error = retval;
+                }
+            }
+        } while (n == ARRAY_SIZE(events) || (n < 0 && errno == EINTR));
+    }
+    pthread_mutex_unlock(&nl_locator_mutex);
+    return error;
+}
+
+static void
+nl_locator_fill (const struct nl_locator_intf *intf,
+                 struct nl_intf_location *loc)
+{
+    if (loc) {
+        snprintf(loc->intf_name, sizeof loc->intf_name, "%s", intf->name);
+        loc->ifindex = intf->ifindex;
+        snprintf(loc->ns_name, sizeof loc->ns_name, "%s", intf->ns->ns_name);
+        snprintf(loc->vrf_name, sizeof loc->vrf_name, "%s",
+                 intf->ns->vrf_name);
+    }
+}
+
+/***************************************************************************
+* Finds the namespace of an interface by name.
+*
+* @param[in]  intf_name : interface to look for.
+* @param[out] loc       : location of the interface, may be NULL.
+*
+* @return 0 if found, ENOENT if not, EEXIST if several namespaces have an
+*         interface with that name ('loc' is then one of them)
+***************************************************************************/
+int
+nl_intf_locate (const char *intf_name, struct nl_intf_location *loc)
+{
+    struct nl_locator_intf *intf;
+    int error = ENOENT;
+
+    pthread_mutex_lock(&nl_locator_mutex);
+    HMAP_FOR_EACH_WITH_HASH (intf, name_node, hash_string(intf_name, 0),
+                             &nl_locator_by_name) {
+        if (!strcmp(intf->name, intf_name)) {
+            if (!error) {
+                error = EEXIST;
+                break;
+            }
+            nl_locator_fill(intf, loc);
+            error = 0;
+        }
+    }
+    pthread_mutex_unlock(&nl_locator_mutex);
+    return error;
+}
+
+/***************************************************************************
+* Finds the namespace of an interface by ifindex.
+*
+* @param[in]  ifindex : interface to look for.
+* @param[out] loc     : location of the interface, may be NULL.
+*
+* @return 0 if found, ENOENT if not, EEXIST if several namespaces have an
+*         interface with that ifindex ('loc' is then one of them)
+***************************************************************************/
+int
+nl_intf_locate_ifindex (int ifindex, struct nl_intf_location *loc)
+{
+    struct nl_locator_intf *intf;
+    int error = ENOENT;
+
+    pthread_mutex_lock(&nl_locator_mutex);
+    HMAP_FOR_EACH_WITH_HASH (intf, index_node, hash_int(ifindex, 0),
+                             &nl_locator_by_index) {
+        if (intf->ifindex == ifindex) {
+            if (!error) {
+                error = EEXIST;
+                break;
+            }
+            nl_locator_fill(intf, loc);
+            error = 0;
+        }
+    }
+    pthread_mutex_unlock(&nl_locator_mutex);
+    return error;
 }
 
 /***************************************************************************
@@ -196,7 +2346,9 @@ int nl_setns_with_name (const char *ns_name)
 /************************************************************************
 * moves an interface from one namespace to another namespace.
 *
-* @param[in]  setns_local_info : contains from and to ns names and intf name
+* @param[in]  setns_local_info : contains from and to ns names and intf name,
+*                                an empty from ns is looked up with
+*                                nl_intf_locate() and filled in.
 *
 * @return true if sucessful, else false on failure
 ***************************************************************************/
@@ -212,6 +2364,20 @@ bool nl_move_intf_to_vrf (struct setns_info *setns_local_info)
     int ns_sock = -1;
     bool rc = false;
     struct sockaddr_nl s_addr;
+    struct nl_intf_location loc;
+
+    /* The source namespace may be left empty when the interface locator
+     * tracks the namespaces. */
+    if (setns_local_info->from_ns[0] == '\0') {
+        nl_intf_locator_run();
+        if (nl_intf_locate(setns_local_info->intf_name, &loc)) {
+            VLOG_ERR("Unable to locate interface %s",
+                     setns_local_info->intf_name);
+            return false;
+        }
+        snprintf(setns_local_info->from_ns, sizeof setns_local_info->from_ns,
+                 "%s", loc.ns_name);
+    }
 
     /* open a FD to move the interface */
     snprintf(ns_path, sizeof(ns_path), "/var/run/netns/%s",
@@ -0,0 +1,770 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * @ingroup ping_prober
+ * This module contains the periodic reachability prober.
+ *
+ * Every target has one timer on a hierarchical timer wheel: PROBER_LEVELS
+ * levels of PROBER_SLOTS slots, level n counting in units of
+ * PROBER_SLOTS^n ticks. A timer goes to the lowest level whose range covers
+ * its expiry and is moved down (cascaded) when the level below wraps
+ * around, so adding, removing and expiring a timer costs the same whatever
+ * the number of targets. The probes of all the timers expiring in a run are
+ * sent with one ping_session_send() call, which batches them with
+ * sendmmsg().
+ *
+ * @file
+ * Source file for the ping_prober library.
+ *
+ ****************************************************************************/
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "openvswitch/vlog.h"
+#include "hash.h"
+#include "hmap.h"
+#include "util.h"
+#include "ping-prober.h"
+
+VLOG_DEFINE_THIS_MODULE(ping_prober);
+
+#define PROBER_LEVEL_BITS       8
+#define PROBER_SLOTS            (1 << PROBER_LEVEL_BITS)
+#define PROBER_SLOT_MASK        (PROBER_SLOTS - 1)
+#define PROBER_LEVELS           4
+#define PROBER_MAX_DELAY        ((1ULL << (PROBER_LEVEL_BITS \
+                                           * PROBER_LEVELS)) - 1)
+
+#define PROBER_TICK_MS          10
+#define PROBER_INTERVAL_MS      1000
+#define PROBER_UP_COUNT         1
+#define PROBER_DOWN_COUNT       3
+#define PROBER_MAX_OUTSTANDING  65536
+#define PROBER_EVENT_BATCH      256
+
+struct prober_target
+{
+    struct hmap_node hmap_node; /* In ping_prober 'targets'. */
+    struct ping_target target;
+    void *aux;
+
+    /* Timer. 'prev' and 'next' link the target in its wheel slot, or in
+     * the zombie list once removed. */
+    struct prober_target *prev;
+    struct prober_target *next;
+    struct prober_target **slot;  /* NULL if not on the wheel. */
+    uint64_t expires;           /* Tick of the next probe. */
+
+    /* Settings, in ticks. */
+    uint64_t interval;
+    uint64_t jitter;
+    uint64_t min_interval;
+    unsigned int up_count;
+    unsigned int down_count;
+
+    /* Probing. */
+    uint64_t last_sent;         /* Tick of the last probe sent. */
+    bool sent;                  /* 'last_sent' is valid. */
+    bool in_flight;             /* Waiting for the ping session event. */
+    bool probe_now;             /* ping_prober_probe_now() while in flight. */
+    bool removed;               /* On the zombie list. */
+
+    /* Reachability. */
+    unsigned int n_ok;          /* Consecutive replies. */
+    unsigned int n_failed;      /* Consecutive failures. */
+    enum ping_prober_state state;
+    struct ping_result last;
+};
+
+struct ping_prober
+{
+    struct ping_session *session;
+    ping_prober_cb *cb;
+    struct hmap targets;        /* Contains "struct prober_target"s. */
+    struct prober_target *zombies;  /* Removed while in flight. */
+
+    /* Timer wheel. */
+    struct prober_target *wheel[PROBER_LEVELS][PROBER_SLOTS];
+    size_t n_timers;
+    uint64_t tick;              /* Next tick to run. */
+    uint64_t tick_ns;
+    uint64_t start_ns;          /* Monotonic time of tick 0. */
+    uint64_t random;            /* xorshift64 state, for the jitter. */
+
+    /* Probes due in the current run. */
+    struct ping_probe *probes;
+    size_t n_probes;
+    size_t allocated_probes;
+
+    int epoll_fd;
+    int timer_fd;
+    int session_fds[2];         /* Session sockets added to 'epoll_fd'. */
+    uint64_t armed_tick;        /* Tick 'timer_fd' is armed for, or 0. */
+};
+
+static uint64_t
+prober_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Returns the tick the monotonic clock is in.
+ */
+static uint64_t
+prober_current_tick (const struct ping_prober *prober)
+{
+    return (prober_now_ns() - prober->start_ns) / prober->tick_ns;
+}
+
+/*
+ * Returns the next number of the xorshift64 generator of the prober.
+ */
+static uint64_t
+prober_random (struct ping_prober *prober)
+{
+    uint64_t x = prober->random;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    prober->random = x;
+    return x;
+}
+
+static uint32_t
+prober_target_hash (const struct ping_target *target)
+{
+    return target->family == AF_INET
+           ? hash_int(target->addr.ipv4.s_addr, 0)
+           : hash_bytes(&target->addr.ipv6, sizeof target->addr.ipv6, 0);
+}
+
+static struct prober_target *
+prober_target_find (const struct ping_prober *prober,
+                    const struct ping_target *target)
+{
+    struct prober_target *t;
+
+    HMAP_FOR_EACH_WITH_HASH (t, hmap_node, prober_target_hash(target),
+                             &prober->targets) {
+        if (t->target.family != target->family) {
+            continue;
+        }
+        if (target->family == AF_INET
+            ? t->target.addr.ipv4.s_addr == target->addr.ipv4.s_addr
+            : !memcmp(&t->target.addr.ipv6, &target->addr.ipv6,
+                      sizeof target->addr.ipv6)) {
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static void
+prober_list_push (struct prober_target **head, struct prober_target *t)
+{
+    t->prev = NULL;
+    t->next = *head;
+    if (*head) {
+        (*head)->prev = t;
+    }
+    *head = t;
+}
+
+static void
+prober_list_remove (struct prober_target **head, struct prober_target *t)
+{
+    if (t->prev) {
+        t->prev->next = t->next;
+    } else {
+        *head = t->next;
+    }
+    if (t->next) {
+        t->next->prev = t->prev;
+    }
+}
+
+/*
+ * Puts the timer of a target on the wheel, in the slot of the lowest level
+ * that covers its expiry. Expiries in the past run on the next tick.
+ */
+static void
+prober_timer_add (struct ping_prober *prober, struct prober_target *t)
+{
+    uint64_t delay;
+    int level;
+
+    if (t->expires < prober->tick) {
+        t->expires = prober->tick;
+    }
+    delay = t->expires - prober->tick;
+    if (delay > PROBER_MAX_DELAY) {
+        delay = PROBER_MAX_DELAY;
+        t->expires = prober->tick + delay;
+    }
+    for (level = 0; level < PROBER_LEVELS - 1; level++) {
+        if (delay < 1ULL << (PROBER_LEVEL_BITS * (level + 1))) {
+            break;
+        }
+    }
+    t->slot = &prober->wheel[level][(t->expires
+                                     >> (PROBER_LEVEL_BITS * level))
+                                    & PROBER_SLOT_MASK];
+    prober_list_push(t->slot, t);
+    prober->n_timers++;
+}
+
+static void
+prober_timer_remove (struct ping_prober *prober, struct prober_target *t)
+{
+    if (t->slot) {
+        prober_list_remove(t->slot, t);
+        t->slot = NULL;
+        prober->n_timers--;
+    }
+}
+
+static void
+prober_timer_set (struct ping_prober *prober, struct prober_target *t,
+                  uint64_t expires)
+{
+    prober_timer_remove(prober, t);
+    t->expires = expires;
+    prober_timer_add(prober, t);
+}
+
+/*
+ * Returns the earliest tick a target can be probed at without breaking its
+ * rate limit.
+ */
+static uint64_t
+prober_earliest (const struct ping_prober *prober,
+                 const struct prober_target *t)
+{
+    return t->sent ? MAX(t->last_sent + t->min_interval, prober->tick)
+                   : prober->tick;
+}
+
+/*
+ * Schedules the periodic probe of a target one interval, give or take the
+ * jitter, after 'base'.
+ */
+static void
+prober_schedule_next (struct ping_prober *prober, struct prober_target *t,
+                      uint64_t base)
+{
+    uint64_t next = base + t->interval;
+
+    if (t->jitter) {
+        next = next - t->jitter + prober_random(prober) % (2 * t->jitter + 1);
+    }
+    prober_timer_set(prober, t, MAX(next, prober_earliest(prober, t)));
+}
+
+/*
+ * Moves the timers of the current slot of an upper level down to the
+ * levels below it.
+ */
+static void
+prober_cascade (struct ping_prober *prober, int level)
+{
+    struct prober_target **slot;
+    struct prober_target *t, *next;
+
+    slot = &prober->wheel[level][(prober->tick
+                                  >> (PROBER_LEVEL_BITS * level))
+                                 & PROBER_SLOT_MASK];
+    for (t = *slot; t; t = next) {
+        next = t->next;
+        t->slot = NULL;
+        prober->n_timers--;
+        prober_timer_add(prober, t);
+    }
+    *slot = NULL;
+}
+
+/*
+ * Runs one tick of the wheel: the timers that expire in it are taken off
+ * the wheel and their targets queued in 'probes'.
+ */
+static void
+prober_run_tick (struct ping_prober *prober)
+{
+    struct prober_target **slot;
+    struct prober_target *t, *next;
+    int level;
+
+    /* Every level below 'level' wrapped around: refill them from the top
+     * down, since an upper level can cascade into the next one. */
+    for (level = 1; level < PROBER_LEVELS; level++) {
+        if (prober->tick & ((1ULL << (PROBER_LEVEL_BITS * level)) - 1)) {
+            break;
+        }
+    }
+    while (--level > 0) {
+        prober_cascade(prober, level);
+    }
+
+    slot = &prober->wheel[0][prober->tick & PROBER_SLOT_MASK];
+    for (t = *slot; t; t = next) {
+        next = t->next;
+        t->slot = NULL;
+        prober->n_timers--;
+
+        if (t->in_flight) {
+            /* Still waiting for the previous probe: skip this round. */
+            prober_schedule_next(prober, t, prober->tick);
+            continue;
+        }
+        if (prober->n_probes == prober->allocated_probes) {
+            prober->probes = x2nrealloc(prober->probes,
+                                        &prober->allocated_probes,
+                                        sizeof *prober->probes);
+        }
+        memset(&prober->probes[prober->n_probes], 0,
+               sizeof *prober->probes);
+        prober->probes[prober->n_probes].target = t->target;
+        prober->probes[prober->n_probes].aux = t;
+        prober->n_probes++;
+        t->in_flight = true;
+    }
+    *slot = NULL;
+    prober->tick++;
+}
+
+/*
+ * Sends the probes queued by the wheel. Probes the session has no room for
+ * are retried on the next tick.
+ */
+static void
+prober_send (struct ping_prober *prober)
+{
+    uint64_t now = prober->tick - 1;
+    size_t n_sent, i;
+
+    if (!prober->n_probes) {
+        return;
+    }
+    n_sent = ping_session_send(prober->session, prober->probes,
+                               prober->n_probes);
+    for (i = 0; i < prober->n_probes; i++) {
+        struct prober_target *t = prober->probes[i].aux;
+
+        if (i < n_sent) {
+            t->last_sent = now;
+            t->sent = true;
+            prober_schedule_next(prober, t, now);
+        } else {
+            t->in_flight = false;
+            prober_timer_set(prober, t, prober->tick);
+        }
+    }
+    if (n_sent < prober->n_probes) {
+        VLOG_DBG("%zu probes delayed, %zu probes in flight",
+                 prober->n_probes - n_sent,
+                 ping_session_pending(prober->session));
+    }
+    prober->n_probes = 0;
+}
+
+/*
+ * Updates the reachability of a target from the result of its probe and
+ * reports a change through the callback.
+ */
+static void
+prober_complete (struct ping_prober *prober, const struct ping_event *event)
+{
+    struct prober_target *t = event->aux;
+    enum ping_prober_state state = t->state;
+
+    if (t->removed) {
+        prober_list_remove(&prober->zombies, t);
+        free(t);
+        return;
+    }
+
+    t->in_flight = false;
+    t->last = event->result;
+    if (event->result.status == PING_REACHABLE) {
+        t->n_failed = 0;
+        if (++t->n_ok >= t->up_count) {
+            state = PING_PROBER_UP;
+        }
+    } else {
+        t->n_ok = 0;
+        if (++t->n_failed >= t->down_count) {
+            state = PING_PROBER_DOWN;
+        }
+    }
+    if (t->probe_now) {
+        t->probe_now = false;
+        if (prober_earliest(prober, t) < t->expires) {
+            prober_timer_set(prober, t, prober_earliest(prober, t));
+        }
+    }
+
+    if (state != t->state) {
+        t->state = state;
+        /* Last use of 't': the callback may remove it. */
+        prober->cb(&t->target, state, &event->result, t->aux);
+    }
+}
+
+/*
+ * Handles the probes the session has completed.
+ */
+static void
+prober_poll (struct ping_prober *prober)
+{
+    struct ping_event events[PROBER_EVENT_BATCH];
+    size_t n_events, i;
+
+    do {
+        n_events = ping_session_poll(prober->session, 0, events,
+                                     ARRAY_SIZE(events));
+        for (i = 0; i < n_events; i++) {
+            prober_complete(prober, &events[i]);
+        }
+    } while (n_events == ARRAY_SIZE(events));
+}
+
+/*
+ * Adds the session sockets opened since the last call to the epoll set.
+ */
+static void
+prober_watch_sockets (struct ping_prober *prober)
+{
+    int fds[2];
+    size_t i;
+
+    ping_session_fds(prober->session, fds);
+    for (i = 0; i < ARRAY_SIZE(fds); i++) {
+        struct epoll_event event;
+
+        if (fds[i] < 0 || fds[i] == prober->session_fds[i]) {
+            continue;
+        }
+        memset(&event, 0, sizeof event);
+        event.events = EPOLLIN;
+        event.data.fd = fds[i];
+        if (epoll_ctl(prober->epoll_fd, EPOLL_CTL_ADD, fds[i], &event)) {
+            VLOG_ERR("Failed to watch ping socket. errstr = %s",
+                     strerror(errno));
+            continue;
+        }
+        prober->session_fds[i] = fds[i];
+    }
+}
+
+/*
+ * Returns the next tick with work on the wheel: the next non-empty level 0
+ * slot, or the next cascade.
+ */
+static uint64_t
+prober_next_tick (const struct ping_prober *prober)
+{
+    uint64_t tick = prober->tick;
+
+    do {
+        if (prober->wheel[0][tick & PROBER_SLOT_MASK]) {
+            break;
+        }
+        tick++;
+    } while (tick & PROBER_SLOT_MASK);
+    return tick;
+}
+
+/*
+ * Arms the timer descriptor for the end of the next tick with work. While
+ * probes are in flight that is every tick, since their timeouts are only
+ * noticed by polling the session.
+ */
+static void
+prober_arm (struct ping_prober *prober)
+{
+    struct itimerspec its;
+    uint64_t tick, ns;
+
+    if (ping_session_pending(prober->session)) {
+        tick = prober->tick;
+    } else if (prober->n_timers) {
+        tick = prober_next_tick(prober);
+    } else {
+        tick = 0;
+    }
+    if (tick == prober->armed_tick) {
+        return;
+    }
+
+    memset(&its, 0, sizeof its);
+    if (tick) {
+        ns = prober->start_ns + (tick + 1) * prober->tick_ns;
+        its.it_value.tv_sec = ns / 1000000000ULL;
+        its.it_value.tv_nsec = ns % 1000000000ULL;
+    }
+    if (timerfd_settime(prober->timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+        VLOG_ERR("Failed to arm prober timer. errstr = %s", strerror(errno));
+        return;
+    }
+    prober->armed_tick = tick;
+}
+
+struct ping_prober *
+ping_prober_create (const struct ping_prober_options *options,
+                    ping_prober_cb *cb)
+{
+    struct ping_prober *prober = xzalloc(sizeof *prober);
+    struct ping_session_options session_options;
+    struct epoll_event event;
+    unsigned int tick_ms = PROBER_TICK_MS;
+
+    memset(&session_options, 0, sizeof session_options);
+    if (options) {
+        session_options = options->session;
+        if (options->tick_ms) {
+            tick_ms = options->tick_ms;
+        }
+    }
+    if (!session_options.max_outstanding) {
+        session_options.max_outstanding = PROBER_MAX_OUTSTANDING;
+    }
+
+    prober->cb = cb;
+    hmap_init(&prober->targets);
+    prober->tick_ns = tick_ms * 1000000ULL;
+    prober->start_ns = prober_now_ns();
+    /* Tick 0 is never armed, so that 0 can mean disarmed. */
+    prober->tick = 1;
+    prober->random = prober->start_ns | 1;
+    prober->session_fds[0] = -1;
+    prober->session_fds[1] = -1;
+
+    prober->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    prober->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                      TFD_NONBLOCK | TFD_CLOEXEC);
+    if (prober->epoll_fd < 0 || prober->timer_fd < 0) {
+        VLOG_ERR("Failed to create prober descriptors. errstr = %s",
+                 strerror(errno));
+        goto error;
+    }
+    memset(&event, 0, sizeof event);
+    event.events = EPOLLIN;
+    event.data.fd = prober->timer_fd;
+    if (epoll_ctl(prober->epoll_fd, EPOLL_CTL_ADD, prober->timer_fd,
+                  &event)) {
+        VLOG_ERR("Failed to watch prober timer. errstr = %s",
+                 strerror(errno));
+        goto error;
+    }
+
+    prober->session = ping_session_create(&session_options);
+    return prober;
+
+error:
+    if (prober->epoll_fd >= 0) {
+        close(prober->epoll_fd);
+    }
+    if (prober->timer_fd >= 0) {
+        close(prober->timer_fd);
+    }
+    hmap_destroy(&prober->targets);
+    free(prober);
+    return NULL;
+}
+
+void
+ping_prober_destroy (struct ping_prober *prober)
+{
+    struct prober_target *t, *next;
+
+    if (!prober) {
+        return;
+    }
+    HMAP_FOR_EACH_SAFE (t, next, hmap_node, &prober->targets) {
+        hmap_remove(&prober->targets, &t->hmap_node);
+        free(t);
+    }
+    hmap_destroy(&prober->targets);
+    for (t = prober->zombies; t; t = next) {
+        next = t->next;
+        free(t);
+    }
+    ping_session_destroy(prober->session);
+    close(prober->timer_fd);
+    close(prober->epoll_fd);
+    free(prober->probes);
+    free(prober);
+}
+
+bool
+ping_prober_add (struct ping_prober *prober, const struct ping_target *target,
+                 const struct ping_prober_target_options *options, void *aux)
+{
+    struct prober_target *t;
+    uint64_t interval_ms = PROBER_INTERVAL_MS;
+    uint64_t min_interval_ms = 0;
+    unsigned int jitter_percent = 0;
+
+    if (target->family != AF_INET && target->family != AF_INET6) {
+        VLOG_ERR("The given target family %d is not valid", target->family);
+        return false;
+    }
+    if (prober_target_find(prober, target)) {
+        return false;
+    }
+
+    t = xzalloc(sizeof *t);
+    t->target = *target;
+    t->aux = aux;
+    t->up_count = PROBER_UP_COUNT;
+    t->down_count = PROBER_DOWN_COUNT;
+    if (options) {
+        if (options->interval_ms) {
+            interval_ms = options->interval_ms;
+        }
+        min_interval_ms = options->min_interval_ms;
+        jitter_percent = MIN(options->jitter_percent, 100);
+        if (options->up_count) {
+            t->up_count = options->up_count;
+        }
+        if (options->down_count) {
+            t->down_count = options->down_count;
+        }
+    }
+    t->interval = MAX(DIV_ROUND_UP(interval_ms * 1000000ULL,
+                                   prober->tick_ns), 1);
+    t->min_interval = MAX(DIV_ROUND_UP(min_interval_ms * 1000000ULL,
+                                       prober->tick_ns), 1);
+    t->jitter = MIN(t->interval * jitter_percent / 100, t->interval - 1);
+    t->state = PING_PROBER_UNKNOWN;
+    t->last.status = PING_PENDING;
+    hmap_insert(&prober->targets, &t->hmap_node, prober_target_hash(target));
+
+    if (!prober->n_timers) {
+        /* An empty wheel can skip the ticks it was idle for. */
+        prober->tick = MAX(prober->tick, prober_current_tick(prober));
+    }
+    /* Spread the first probes of targets added together over an
+     * interval. */
+    prober_timer_set(prober, t,
+                     prober->tick + prober_random(prober) % t->interval);
+    prober_arm(prober);
+    return true;
+}
+
+bool
+ping_prober_remove (struct ping_prober *prober,
+                    const struct ping_target *target)
+{
+    struct prober_target *t = prober_target_find(prober, target);
+
+    if (!t) {
+        return false;
+    }
+    hmap_remove(&prober->targets, &t->hmap_node);
+    prober_timer_remove(prober, t);
+    if (t->in_flight) {
+        /* The session still refers to it: freed with its event. */
+        t->removed = true;
+        prober_list_push(&prober->zombies, t);
+    } else {
+        free(t);
+    }
+    return true;
+}
+
+void
+ping_prober_probe_now (struct ping_prober *prober,
+                       const struct ping_target *target)
+{
+    struct prober_target *t = prober_target_find(prober, target);
+
+    if (!t) {
+        return;
+    }
+    if (t->in_flight) {
+        t->probe_now = true;
+    } else if (prober_earliest(prober, t) < t->expires) {
+        prober_timer_set(prober, t, prober_earliest(prober, t));
+        prober_arm(prober);
+    }
+}
+
+enum ping_prober_state
+ping_prober_get_state (const struct ping_prober *prober,
+                       const struct ping_target *target,
+                       struct ping_result *last)
+{
+    const struct prober_target *t = prober_target_find(prober, target);
+
+    if (!t) {
+        if (last) {
+            memset(last, 0, sizeof *last);
+            last->status = PING_PENDING;
+        }
+        return PING_PROBER_UNKNOWN;
+    }
+    if (last) {
+        *last = t->last;
+    }
+    return t->state;
+}
+
+void
+ping_prober_run (struct ping_prober *prober)
+{
+    uint64_t expirations;
+    uint64_t now;
+
+    /* Clear the readiness of the timer, whether it fired or not. */
+    if (read(prober->timer_fd, &expirations, sizeof expirations) > 0) {
+        prober->armed_tick = 0;
+    }
+
+    prober_poll(prober);
+
+    now = prober_current_tick(prober);
+    while (prober->tick < now) {
+        if (!prober->n_timers) {
+            prober->tick = now;
+            break;
+        }
+        prober_run_tick(prober);
+    }
+    prober_send(prober);
+    prober_watch_sockets(prober);
+
+    /* Sends refused by the kernel complete on the next poll. */
+    prober_poll(prober);
+    prober_arm(prober);
+}
+
+int
+ping_prober_fd (const struct ping_prober *prober)
+{
+    return prober->epoll_fd;
+}
@@ -16,23 +16,66 @@
  * File:ping_send.c
 */
 
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <netinet/ip_icmp.h>
 #include <netinet/icmp6.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <errno.h>
 #include <unistd.h>
 #include "openvswitch/vlog.h"
+#include "hmap.h"
+#include "util.h"
+#include "vrf-utils.h"
 #include "ops-utils.h"
+#include "ping-send.h"
 
 #define DEFDATALEN  56
 #define MAXICMPLEN 76
 #define MAXIPLEN  60
 
 #define PACKETSIZE  64
+/* Echo request payload words, see ping_build_echo(). */
+#define PING_PAYLOAD_FLOW   0
+#define PING_PAYLOAD_SEQ    1
+/* Shortest echo request sent: the header and the payload words. */
+#define PING_MIN_ECHO_LEN   (ICMP_MINLEN + 2 * sizeof(uint16_t))
+
+/* Messages handed to the kernel per sendmmsg() call. */
+#define PING_BATCH_MAX      1024
+/* Time to wait for socket buffer space when a batch fills it. */
+#define PING_SEND_WAIT_MS   100
+/* Messages per recvmmsg() call, and size of each received packet kept. */
+#define PING_RECV_BATCH     64
+#define PING_RECV_SIZE      512
+#define PING_CONTROL_SIZE   128
+#define PING_RCVBUF         (4 * 1024 * 1024)
+
+/* Session defaults. */
+#define PING_TIMEOUT_MS         1000
+#define PING_MAX_OUTSTANDING    4096
+/* Path MTU search defaults. */
+#define PING_PMTU_MIN4          68
+#define PING_PMTU_MIN6          1280
+#define PING_PMTU_MAX           9216
+#define PING_PMTU_RETRIES       1
+/* Trace defaults and limits. */
+#define PING_TRACE_MAX_TTL      30
+#define PING_TRACE_MAX_FLOWS    256
+
+/* From <linux/icmp.h>, which clashes with <netinet/ip_icmp.h>. */
+#ifndef ICMP_FILTER
+#define ICMP_FILTER         1
+#endif
 
 VLOG_DEFINE_THIS_MODULE(ping_util);
 
@@ -54,22 +97,84 @@ static int create_icmp6_socket(void)
     return sock;
 }
 
+/*This function adds data to a one's complement sum. 32-bit words are
+* accumulated in 64 bits, which cannot overflow for any packet size, and the
+* sum is folded to 16 bits at the end. The sum is in the byte order of the
+* data, as the one's complement sum does not depend on it (RFC 1071).
+*/
+static uint16_t ping_checksum_fold(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint64_t sum = 0;
+    uint32_t w[4];
+    uint16_t half;
+    uint8_t tail[2];
+
+    while (len >= sizeof w) {
+        memcpy(w, p, sizeof w);
+        sum += (uint64_t) w[0] + w[1] + w[2] + w[3];
+        p += sizeof w;
+        len -= sizeof w;
+    }
+    while (len >= sizeof w[0]) {
+        memcpy(w, p, sizeof w[0]);
+        sum += w[0];
+        p += sizeof w[0];
+        len -= sizeof w[0];
+    }
+    if (len >= sizeof half) {
+        memcpy(&half, p, sizeof half);
+        sum += half;
+        p += sizeof half;
+        len -= sizeof half;
+    }
+    if (len) {
+        /* An odd byte is padded with a zero byte after it. */
+        tail[0] = *p;
+        tail[1] = 0;
+        memcpy(&half, tail, sizeof half);
+        sum += half;
+    }
+
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    return sum;
+}
+
+uint16_t ping_checksum(const void *data, size_t len)
+{
+    return ~ping_checksum_fold(data, len);
+}
+
+/*This function patches a checksum for a 16-bit word that changed from
+* old_word to new_word, with eqn. 3 of RFC 1624: HC' = ~(~HC + ~m + m').
+*/
+uint16_t ping_checksum_update(uint16_t csum, uint16_t old_word,
+                              uint16_t new_word)
+{
+    uint32_t sum;
+
+    sum = (uint16_t) ~csum + (uint16_t) ~old_word + new_word;
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+    return ~sum;
+}
+
+uint16_t ping_checksum_update32(uint16_t csum, uint32_t old_word,
+                                uint32_t new_word)
+{
+    csum = ping_checksum_update(csum, old_word >> 16, new_word >> 16);
+    return ping_checksum_update(csum, old_word & 0xffff, new_word & 0xffff);
+}
+
 /*--------------------------------------------------------------------
 *--- checksum - standard 1s complement checksum                   ---
 *--------------------------------------------------------------------*/
 unsigned short checksum(void *b, int len)
-{   unsigned short *buf = b;
-    unsigned int sum=0;
-    unsigned short result;
-
-    for ( sum = 0; len > 1; len -= 2 )
-        sum += *buf++;
-    if ( len == 1 )
-        sum += *(unsigned char*)buf;
-    sum = (sum >> 16) + (sum & 0xFFFF);
-    sum += (sum >> 16);
-    result = ~sum;
-    return result;
+{
+    return ping_checksum(b, len);
 }
 
 /*This function creates a socket to send icmp packet
@@ -84,31 +189,1483 @@ static int create_icmp4_socket(void)
     return sock;
 }
 
-/*This function sends a ICMP_ECHO packet to the target.
+/* Send-only ICMP and ICMPv6 sockets of the namespaces, kept open for
+ * ping4(), ping6() and ping_send_batch() in socks[0] and socks[1] of the
+ * cache entries. ping_vrf_rwlock is held for reading while a cached socket
+ * is in use and for writing to close sockets. ping_mutex protects the cache
+ * contents and the echo id and sequence counters. */
+static pthread_rwlock_t ping_vrf_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t ping_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct hmap ping_vrf_cache = HMAP_INITIALIZER(&ping_vrf_cache);
+static uint16_t ping_seq;
+/* Zeros padding large probes; only read. */
+static char ping_pad[IP_MAXPACKET];
+
+/*This function creates an icmp socket of the given type (SOCK_RAW or
+* SOCK_DGRAM) in a VRF namespace through the vrf-utils socket path, which
+* never moves the calling thread. For the default namespace the socket is
+* created in the namespace of the calling thread.
+*/
+static int ping_vrf_create_socket(const char *vrf_ns_name, int family,
+                                  int type)
+{
+    struct vrf_sock_params params;
+    char ns_name[MAX_BUFFER_SIZE];
+    int protocol = family == AF_INET ? IPPROTO_ICMP : IPPROTO_ICMPV6;
+
+    if (!is_nondefault_vrf(vrf_ns_name)) {
+        if (type == SOCK_DGRAM) {
+            return socket(family, SOCK_DGRAM, protocol);
+        }
+        return family == AF_INET ? create_icmp4_socket()
+                                 : create_icmp6_socket();
+    }
+    snprintf(ns_name, sizeof ns_name, "%s", vrf_ns_name);
+    params.nl_params.family = family;
+    params.nl_params.type = type;
+    params.nl_params.protocol = protocol;
+    return vrf_create_socket(ns_name, &params);
+}
+
+/*This function opens a send-only icmp socket for the socket cache.
+* All incoming ICMP messages are filtered out, since replies are not read,
+* so that the socket does not queue every ICMP packet of the system.
+* Without the privilege for raw sockets, an ICMP datagram socket is used
+* if net.ipv4.ping_group_range allows it.
+*/
+static int ping_socket_open(const char *vrf_ns_name, int family)
+{
+    uint32_t filter4 = ~0U;
+    struct icmp6_filter filter6;
+    const int ttl = 255;
+    const int offset = 2;
+    int sock;
+
+    if ((sock = ping_vrf_create_socket(vrf_ns_name, family, SOCK_RAW)) < 0) {
+        if ((sock = ping_vrf_create_socket(vrf_ns_name, family,
+                                           SOCK_DGRAM)) < 0) {
+            VLOG_ERR("can not create icmp socket in %s. errstr = %s",
+                     vrf_ns_name ? vrf_ns_name : SWITCH_NAMESPACE,
+                     strerror(errno));
+            return -1;
+        }
+        if (family == AF_INET
+            && setsockopt(sock, SOL_IP, IP_TTL, &ttl, sizeof ttl)) {
+            VLOG_ERR("Set icmp4_socket options. errstr = %s",
+                     strerror(errno));
+            close(sock);
+            return -1;
+        }
+        return sock;
+    }
+    if (family == AF_INET) {
+        if (setsockopt(sock, SOL_IP, IP_TTL, &ttl, sizeof ttl)
+            || setsockopt(sock, SOL_RAW, ICMP_FILTER, &filter4,
+                          sizeof filter4)) {
+            VLOG_ERR("Set icmp4_socket options. errstr = %s",
+                     strerror(errno));
+            close(sock);
+            return -1;
+        }
+    } else {
+        ICMP6_FILTER_SETBLOCKALL(&filter6);
+        if (setsockopt(sock, SOL_RAW, IPV6_CHECKSUM, &offset, sizeof offset)
+            || setsockopt(sock, IPPROTO_ICMPV6, ICMP6_FILTER, &filter6,
+                          sizeof filter6)) {
+            VLOG_ERR("Set icmp6_socket options. errstr = %s",
+                     strerror(errno));
+            close(sock);
+            return -1;
+        }
+    }
+    return sock;
+}
+
+/*This function returns the cached socket of the family for a VRF
+* namespace, opening it on first use. A NULL or default namespace name
+* selects the namespace of the calling thread. ping_vrf_rwlock must be held
+* for reading until the socket is no longer used.
+*/
+static int ping_vrf_socket(const char *vrf_ns_name, int family)
+{
+    struct vrf_sock_cache_entry *entry;
+    int *sockp;
+    int sock = -1;
+
+    pthread_mutex_lock(&ping_mutex);
+    entry = vrf_sock_cache_get(&ping_vrf_cache, vrf_ns_name);
+    if (entry) {
+        sockp = &entry->socks[family == AF_INET ? 0 : 1];
+        if (*sockp < 0) {
+            *sockp = ping_socket_open(is_nondefault_vrf(vrf_ns_name)
+                                      ? vrf_ns_name : NULL, family);
+        }
+        sock = *sockp;
+    }
+    pthread_mutex_unlock(&ping_mutex);
+    return sock;
+}
+
+/*This function closes the cached sockets of a VRF namespace, or of all
+* namespaces if vrf_ns_name is NULL.
+*/
+void ping_vrf_sockets_flush(const char *vrf_ns_name)
+{
+    pthread_rwlock_wrlock(&ping_vrf_rwlock);
+    vrf_sock_cache_flush(&ping_vrf_cache, vrf_ns_name);
+    pthread_rwlock_unlock(&ping_vrf_rwlock);
+}
+
+/*This function builds an echo request of PACKETSIZE bytes in buf.
+* The first payload words hold the flow and the one's complement of the
+* sequence number, so that the checksum only depends on the id and the
+* flow: ECMP routers that hash the ICMP checksum keep all the probes of a
+* flow on one path (Paris traceroute). The ICMPv6 checksum is left to the
+* kernel (IPV6_CHECKSUM), which preserves this as well.
+*/
+static size_t ping_build_echo(void *buf, int family, uint16_t id,
+                              uint16_t seq, uint16_t flow)
+{
+    struct packet *pckt = buf;
+    struct icmp6_hdr *pkt6 = buf;
+    uint16_t *payload = (uint16_t *) ((char *) buf + sizeof pckt->hdr);
+
+    memset(buf, 0, PACKETSIZE);
+    payload[PING_PAYLOAD_FLOW] = htons(flow);
+    payload[PING_PAYLOAD_SEQ] = htons(~seq);
+    if (family == AF_INET) {
+        pckt->hdr.type = ICMP_ECHO;
+        pckt->hdr.un.echo.id = htons(id);
+        pckt->hdr.un.echo.sequence = htons(seq);
+        pckt->hdr.checksum = ping_checksum(pckt, sizeof *pckt);
+    } else {
+        pkt6->icmp6_type = ICMP6_ECHO_REQUEST;
+        pkt6->icmp6_id = htons(id);
+        pkt6->icmp6_seq = htons(seq);
+    }
+    return PACKETSIZE;
+}
+
+/*This function changes the sequence number of an echo request built by
+* ping_build_echo(). The compensating payload word changes with it, so the
+* sum of the packet and its checksum stay the same.
+*/
+static void ping_echo_set_seq(void *buf, int family, uint16_t seq)
+{
+    struct packet *pckt = buf;
+    struct icmp6_hdr *pkt6 = buf;
+    uint16_t *payload = (uint16_t *) ((char *) buf + sizeof pckt->hdr);
+
+    payload[PING_PAYLOAD_SEQ] = htons(~seq);
+    if (family == AF_INET) {
+        pckt->hdr.un.echo.sequence = htons(seq);
+    } else {
+        pkt6->icmp6_seq = htons(seq);
+    }
+}
+
+/*This function sends n messages with sendmmsg(), waiting for buffer space
+* when the socket is full. A message the kernel refuses (e.g. no route) is
+* skipped; if errors is not NULL, the errno of each message (0 if sent) is
+* stored there. On a socket with IP_RECVERR set (recverr), a refused
+* message is tried twice, since the error may be a pending ICMP error of an
+* earlier probe, which the failed send clears. Returns the number of
+* messages sent.
+*/
+static size_t ping_sendmmsg(int sock, struct mmsghdr *msgs, size_t n,
+                            bool recverr, int *errors)
+{
+    struct pollfd pfd;
+    size_t done = 0, sent = 0;
+    bool retried = false;
+    int rc;
+
+    while (done < n) {
+        rc = sendmmsg(sock, msgs + done, n - done, MSG_DONTWAIT);
+        if (rc > 0) {
+            if (errors) {
+                memset(&errors[done], 0, rc * sizeof *errors);
+            }
+            done += rc;
+            sent += rc;
+            retried = false;
+        } else if (errno == EAGAIN || errno == ENOBUFS) {
+            pfd.fd = sock;
+            pfd.events = POLLOUT;
+            if (poll(&pfd, 1, PING_SEND_WAIT_MS) <= 0) {
+                VLOG_ERR("error:sendmmsg: socket stays full");
+                break;
+            }
+        } else if (errno != EINTR && recverr && !retried) {
+            retried = true;
+        } else if (errno != EINTR) {
+            VLOG_DBG("error:sendmmsg: errstr = %s", strerror(errno));
+            if (errors) {
+                errors[done] = errno;
+            }
+            done++;
+            retried = false;
+        }
+    }
+    if (errors) {
+        while (done < n) {
+            errors[done++] = EAGAIN;
+        }
+    }
+    return sent;
+}
+
+/*This function fills a ping target from an ipv4 or ipv6 address string.
+*/
+bool ping_target_parse(const char *address, struct ping_target *target)
+{
+    memset(target, 0, sizeof *target);
+    if (inet_pton(AF_INET, address, &target->addr.ipv4) == 1) {
+        target->family = AF_INET;
+        return true;
+    }
+    if (inet_pton(AF_INET6, address, &target->addr.ipv6) == 1) {
+        target->family = AF_INET6;
+        return true;
+    }
+    return false;
+}
+
+/*This function sends an echo request to every target from a VRF
+* namespace, in batches of PING_BATCH_MAX messages per sendmmsg() call.
+* Consecutive targets of the same family share a batch.
+*/
+int ping_send_batch_vrf(const char *vrf_ns_name,
+                        const struct ping_target *targets, size_t n_targets)
+{
+    size_t chunk = MIN(n_targets, PING_BATCH_MAX);
+    char (*packets)[PACKETSIZE];
+    char template4[PACKETSIZE], template6[PACKETSIZE];
+    struct sockaddr_in6 *addrs;
+    struct iovec *iovs;
+    struct mmsghdr *msgs;
+    size_t i, n = 0, sent = 0;
+    int family = AF_UNSPEC, sock = -1;
+    uint16_t id = getpid() & 0xffff;
+    uint16_t seq;
+    bool opened = false;
+
+    if (!n_targets) {
+        return 0;
+    }
+
+    packets = xmalloc(chunk * sizeof *packets);
+    addrs = xmalloc(chunk * sizeof *addrs);
+    iovs = xmalloc(chunk * sizeof *iovs);
+    msgs = xmalloc(chunk * sizeof *msgs);
+
+    pthread_mutex_lock(&ping_mutex);
+    seq = ping_seq;
+    ping_seq += n_targets;
+    pthread_mutex_unlock(&ping_mutex);
+
+    /* Packets only differ in their sequence number: copy a template and
+     * set it. */
+    ping_build_echo(template4, AF_INET, id, seq, 0);
+    ping_build_echo(template6, AF_INET6, id, seq, 0);
+
+    pthread_rwlock_rdlock(&ping_vrf_rwlock);
+    for (i = 0; i <= n_targets; i++) {
+        const struct ping_target *target = i < n_targets ? &targets[i] : NULL;
+
+        /* Flush at the end, when the batch is full or the family changes. */
+        if (n && (!target || n == chunk || target->family != family)) {
+            if (sock >= 0) {
+                sent += ping_sendmmsg(sock, msgs, n, false, NULL);
+            }
+            n = 0;
+        }
+        if (!target) {
+            break;
+        }
+        if (target->family != AF_INET && target->family != AF_INET6) {
+            VLOG_ERR("The given target family %d is not valid",
+                     target->family);
+            continue;
+        }
+        if (target->family != family) {
+            family = target->family;
+            sock = ping_vrf_socket(vrf_ns_name, family);
+            opened |= sock >= 0;
+        }
+
+        memset(&addrs[n], 0, sizeof addrs[n]);
+        if (family == AF_INET) {
+            struct sockaddr_in *sin = (struct sockaddr_in *) &addrs[n];
+
+            sin->sin_family = AF_INET;
+            sin->sin_addr = target->addr.ipv4;
+            msgs[n].msg_hdr.msg_namelen = sizeof *sin;
+        } else {
+            addrs[n].sin6_family = AF_INET6;
+            addrs[n].sin6_addr = target->addr.ipv6;
+            msgs[n].msg_hdr.msg_namelen = sizeof addrs[n];
+        }
+        memcpy(packets[n], family == AF_INET ? template4 : template6,
+               PACKETSIZE);
+        ping_echo_set_seq(packets[n], family, seq + i);
+        iovs[n].iov_base = packets[n];
+        iovs[n].iov_len = PACKETSIZE;
+        msgs[n].msg_hdr.msg_name = &addrs[n];
+        msgs[n].msg_hdr.msg_iov = &iovs[n];
+        msgs[n].msg_hdr.msg_iovlen = 1;
+        msgs[n].msg_hdr.msg_control = NULL;
+        msgs[n].msg_hdr.msg_controllen = 0;
+        msgs[n].msg_hdr.msg_flags = 0;
+        n++;
+    }
+    pthread_rwlock_unlock(&ping_vrf_rwlock);
+
+    free(packets);
+    free(addrs);
+    free(iovs);
+    free(msgs);
+    return opened ? (int) sent : -1;
+}
+
+int ping_send_batch(const struct ping_target *targets, size_t n_targets)
+{
+    return ping_send_batch_vrf(NULL, targets, n_targets);
+}
+
+/* An outstanding probe of a ping session, stored at seq & mask. */
+struct ping_slot
+{
+    bool busy;                  /* Waiting for its event. */
+    uint16_t seq;
+    int error;                  /* errno if the send failed. */
+    void *aux;
+    struct ping_target target;
+    uint64_t sent_ns;           /* CLOCK_REALTIME, as SO_TIMESTAMPNS. */
+    uint64_t deadline_ns;       /* CLOCK_MONOTONIC. */
+};
+
+struct ping_session
+{
+    char vrf_ns_name[MAX_BUFFER_SIZE]; /* Empty for the calling thread's. */
+    enum ping_mode mode;
+    int sock4;                  /* -1 until the first IPv4 probe. */
+    int sock6;                  /* -1 until the first IPv6 probe. */
+    bool dgram4;                /* sock4 is an ICMP datagram socket. */
+    bool dgram6;                /* sock6 is an ICMPv6 datagram socket. */
+    uint16_t id;                /* Echo id of all probes, with raw sockets. */
+    uint16_t next_seq;          /* Sequence of the next probe. */
+    uint16_t oldest_seq;        /* No probe older than this is busy. */
+    size_t n_busy;
+    uint64_t timeout_ns;
+
+    struct ping_slot *slots;
+    size_t mask;                /* Number of slots - 1. */
+
+    uint16_t *failed;           /* Sequences of failed sends to report. */
+    size_t n_failed;
+
+    /* Send and receive buffers, PING_RECV_BATCH entries each, and two
+     * iovecs per message when sending. */
+    char (*packets)[PING_RECV_SIZE];
+    struct sockaddr_in6 *addrs;
+    struct iovec *iovs;
+    struct mmsghdr *msgs;
+    char (*controls)[PING_CONTROL_SIZE];
+    int *errors;
+};
+
+/* A reply or ICMP error as parsed from a received packet. */
+struct ping_reply
+{
+    uint16_t id;
+    uint16_t seq;
+    struct ping_target target;  /* Destination of the original probe. */
+    struct ping_result result;
+};
+
+static uint16_t ping_next_id;
+static bool ping_next_id_set;
+
+static uint64_t ping_now_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*This function returns an echo id no other session of the process uses.
+*/
+static uint16_t ping_id_alloc(void)
+{
+    uint16_t id;
+
+    pthread_mutex_lock(&ping_mutex);
+    if (!ping_next_id_set) {
+        ping_next_id = getpid() & 0xffff;
+        ping_next_id_set = true;
+    }
+    id = ping_next_id++;
+    pthread_mutex_unlock(&ping_mutex);
+    return id;
+}
+
+static bool ping_target_equal(const struct ping_target *a,
+                              const struct ping_target *b)
+{
+    if (a->family != b->family) {
+        return false;
+    }
+    return a->family == AF_INET
+           ? a->addr.ipv4.s_addr == b->addr.ipv4.s_addr
+           : !memcmp(&a->addr.ipv6, &b->addr.ipv6, sizeof a->addr.ipv6);
+}
+
+/*This function opens the receiving icmp socket of a session. Only echo
+* replies and the ICMP errors that can quote an echo request are let in,
+* and packets are timestamped by the kernel.
+*/
+static int ping_session_socket_open(const char *vrf_ns_name, int family,
+                                    enum ping_mode mode, bool *dgram)
+{
+    uint32_t filter4 = ~((1U << ICMP_ECHOREPLY) | (1U << ICMP_DEST_UNREACH)
+                         | (1U << ICMP_TIME_EXCEEDED)
+                         | (1U << ICMP_PARAMETERPROB));
+    struct icmp6_filter filter6;
+    const int rcvbuf = PING_RCVBUF;
+    const int on = 1;
+    const int ttl = 255;
+    const int offset = 2;
+    const int pmtudisc4 = IP_PMTUDISC_PROBE;
+    const int pmtudisc6 = IPV6_PMTUDISC_PROBE;
+    int sock = -1;
+
+    if (mode != PING_MODE_RAW) {
+        sock = ping_vrf_create_socket(vrf_ns_name, family, SOCK_DGRAM);
+    }
+    *dgram = sock >= 0;
+    if (sock < 0 && mode != PING_MODE_DGRAM) {
+        sock = ping_vrf_create_socket(vrf_ns_name, family, SOCK_RAW);
+    }
+    if (sock < 0) {
+        VLOG_ERR("can not create icmp socket in %s. errstr = %s",
+                 vrf_ns_name ? vrf_ns_name : SWITCH_NAMESPACE,
+                 strerror(errno));
+        return -1;
+    }
+
+    if (*dgram) {
+        /* ICMP errors are queued on the error queue of the socket. */
+        if (family == AF_INET
+            ? setsockopt(sock, SOL_IP, IP_TTL, &ttl, sizeof ttl)
+              || setsockopt(sock, SOL_IP, IP_RECVERR, &on, sizeof on)
+            : setsockopt(sock, SOL_IPV6, IPV6_RECVERR, &on, sizeof on)) {
+            goto error;
+        }
+    } else if (family == AF_INET) {
+        if (setsockopt(sock, SOL_IP, IP_TTL, &ttl, sizeof ttl)
+            || setsockopt(sock, SOL_RAW, ICMP_FILTER, &filter4,
+                          sizeof filter4)) {
+            goto error;
+        }
+    } else {
+        ICMP6_FILTER_SETBLOCKALL(&filter6);
+        ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter6);
+        ICMP6_FILTER_SETPASS(ICMP6_DST_UNREACH, &filter6);
+        ICMP6_FILTER_SETPASS(ICMP6_PACKET_TOO_BIG, &filter6);
+        ICMP6_FILTER_SETPASS(ICMP6_TIME_EXCEEDED, &filter6);
+        ICMP6_FILTER_SETPASS(ICMP6_PARAM_PROB, &filter6);
+        if (setsockopt(sock, SOL_RAW, IPV6_CHECKSUM, &offset, sizeof offset)
+            || setsockopt(sock, IPPROTO_ICMPV6, ICMP6_FILTER, &filter6,
+                          sizeof filter6)) {
+            goto error;
+        }
+    }
+    /* Probes are never fragmented, and their size is not limited by the
+     * path MTU the kernel learnt, so that it can be probed. */
+    if (family == AF_INET
+        ? setsockopt(sock, SOL_IP, IP_MTU_DISCOVER, &pmtudisc4,
+                     sizeof pmtudisc4)
+        : setsockopt(sock, SOL_IPV6, IPV6_MTU_DISCOVER, &pmtudisc6,
+                     sizeof pmtudisc6)
+          || setsockopt(sock, SOL_IPV6, IPV6_DONTFRAG, &on, sizeof on)) {
+        goto error;
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof on)) {
+        goto error;
+    }
+    /* Replies to a full window of probes can arrive back to back. */
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof rcvbuf)) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    }
+    return sock;
+
+error:
+    VLOG_ERR("Set icmp socket options. errstr = %s", strerror(errno));
+    close(sock);
+    return -1;
+}
+
+/*This function returns the socket of a session for the family, opening it
+* on first use.
+*/
+static int ping_session_socket(struct ping_session *session, int family)
+{
+    int *sockp = family == AF_INET ? &session->sock4 : &session->sock6;
+    bool *dgramp = family == AF_INET ? &session->dgram4 : &session->dgram6;
+
+    if (*sockp < 0) {
+        *sockp = ping_session_socket_open(session->vrf_ns_name[0]
+                                          ? session->vrf_ns_name : NULL,
+                                          family, session->mode, dgramp);
+    }
+    return *sockp;
+}
+
+struct ping_session *
+ping_session_create(const struct ping_session_options *options)
+{
+    struct ping_session *session = xzalloc(sizeof *session);
+    size_t max_outstanding = PING_MAX_OUTSTANDING;
+    size_t n_slots = 1;
+
+    session->timeout_ns = PING_TIMEOUT_MS * 1000000ULL;
+    if (options) {
+        if (options->timeout_ms) {
+            session->timeout_ns = options->timeout_ms * 1000000ULL;
+        }
+        if (options->max_outstanding) {
+            max_outstanding = MIN(options->max_outstanding, 65536);
+        }
+        session->mode = options->mode;
+        if (options->vrf_ns_name) {
+            snprintf(session->vrf_ns_name, sizeof session->vrf_ns_name,
+                     "%s", options->vrf_ns_name);
+        }
+    }
+    while (n_slots < max_outstanding) {
+        n_slots <<= 1;
+    }
+
+    session->sock4 = -1;
+    session->sock6 = -1;
+    session->id = ping_id_alloc();
+    session->slots = xzalloc(n_slots * sizeof *session->slots);
+    session->mask = n_slots - 1;
+    session->failed = xmalloc(n_slots * sizeof *session->failed);
+
+    session->packets = xmalloc(PING_RECV_BATCH * sizeof *session->packets);
+    session->addrs = xmalloc(PING_RECV_BATCH * sizeof *session->addrs);
+    session->iovs = xmalloc(2 * PING_RECV_BATCH * sizeof *session->iovs);
+    session->msgs = xmalloc(PING_RECV_BATCH * sizeof *session->msgs);
+    session->controls = xmalloc(PING_RECV_BATCH * sizeof *session->controls);
+    session->errors = xmalloc(PING_RECV_BATCH * sizeof *session->errors);
+    return session;
+}
+
+void ping_session_destroy(struct ping_session *session)
+{
+    if (!session) {
+        return;
+    }
+    if (session->sock4 >= 0) {
+        close(session->sock4);
+    }
+    if (session->sock6 >= 0) {
+        close(session->sock6);
+    }
+    free(session->slots);
+    free(session->failed);
+    free(session->packets);
+    free(session->addrs);
+    free(session->iovs);
+    free(session->msgs);
+    free(session->controls);
+    free(session->errors);
+    free(session);
+}
+
+size_t ping_session_pending(const struct ping_session *session)
+{
+    return session->n_busy;
+}
+
+void ping_session_fds(const struct ping_session *session, int fds[2])
+{
+    fds[0] = session->sock4;
+    fds[1] = session->sock6;
+}
+
+/*This function sends the n messages prepared in the session buffers and
+* records the sends that failed.
+*/
+static void ping_session_flush(struct ping_session *session, int family,
+                               const uint16_t *seqs, size_t n)
+{
+    int sock = ping_session_socket(session, family);
+    bool dgram = family == AF_INET ? session->dgram4 : session->dgram6;
+    uint64_t now = ping_now_ns(CLOCK_REALTIME);
+    size_t i;
+
+    if (sock >= 0) {
+        ping_sendmmsg(sock, session->msgs, n, dgram, session->errors);
+    }
+    for (i = 0; i < n; i++) {
+        struct ping_slot *slot = &session->slots[seqs[i] & session->mask];
+
+        slot->sent_ns = now;
+        slot->error = sock < 0 ? EAFNOSUPPORT : session->errors[i];
+        if (slot->error) {
+            session->failed[session->n_failed++] = seqs[i];
+        }
+    }
+}
+
+/*This function builds the echo request of a session probe in buf and
+* points iov at it. Probes larger than PACKETSIZE are padded with zeros,
+* from a second iovec, which leaves the checksum unchanged. Returns the
+* number of iovecs used.
+*/
+static size_t ping_build_echo_iov(struct iovec *iov, void *buf, int family,
+                                  uint16_t id, uint16_t seq,
+                                  const struct ping_probe *probe)
+{
+    size_t hlen = family == AF_INET ? sizeof(struct ip)
+                                    : sizeof(struct ip6_hdr);
+    size_t len = PACKETSIZE;
+
+    if (probe->size) {
+        len = probe->size > hlen ? probe->size - hlen : 0;
+        len = MAX(len, PING_MIN_ECHO_LEN);
+    }
+    iov[0].iov_base = buf;
+    iov[0].iov_len = MIN(ping_build_echo(buf, family, id, seq, probe->flow),
+                         len);
+    if (len <= iov[0].iov_len) {
+        return 1;
+    }
+    iov[1].iov_base = ping_pad;
+    iov[1].iov_len = MIN(len - iov[0].iov_len, sizeof ping_pad);
+    return 2;
+}
+
+/*This function attaches a TTL (hop limit) to one message, in control, a
+* buffer of PING_CONTROL_SIZE bytes.
+*/
+static void ping_set_ttl(struct msghdr *msg, void *control, int family,
+                         uint8_t ttl)
+{
+    struct cmsghdr *cmsg = control;
+    int value = ttl;
+
+    cmsg->cmsg_level = family == AF_INET ? SOL_IP : SOL_IPV6;
+    cmsg->cmsg_type = family == AF_INET ? IP_TTL : IPV6_HOPLIMIT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof value);
+    memcpy(CMSG_DATA(cmsg), &value, sizeof value);
+    msg->msg_control = control;
+    msg->msg_controllen = CMSG_SPACE(sizeof value);
+}
+
+size_t ping_session_send(struct ping_session *session,
+                         const struct ping_probe *probes, size_t n_probes)
+{
+    uint16_t seqs[PING_RECV_BATCH];
+    uint64_t deadline;
+    size_t i, n = 0;
+    int family = AF_UNSPEC;
+
+    deadline = ping_now_ns(CLOCK_MONOTONIC) + session->timeout_ns;
+    for (i = 0; i < n_probes; i++) {
+        const struct ping_probe *probe = &probes[i];
+        uint16_t seq = session->next_seq;
+        struct ping_slot *slot = &session->slots[seq & session->mask];
+
+        if (slot->busy) {
+            /* The oldest probe still owns this slot: the table is full. */
+            break;
+        }
+        slot->busy = true;
+        slot->seq = seq;
+        slot->aux = probe->aux;
+        slot->target = probe->target;
+        slot->deadline_ns = deadline;
+        session->next_seq++;
+        session->n_busy++;
+
+        if (probe->target.family != AF_INET
+            && probe->target.family != AF_INET6) {
+            VLOG_ERR("The given target family %d is not valid",
+                     probe->target.family);
+            slot->error = EAFNOSUPPORT;
+            session->failed[session->n_failed++] = seq;
+            continue;
+        }
+        if (n && (n == PING_RECV_BATCH || probe->target.family != family)) {
+            ping_session_flush(session, family, seqs, n);
+            n = 0;
+        }
+        family = probe->target.family;
+
+        memset(&session->addrs[n], 0, sizeof session->addrs[n]);
+        if (family == AF_INET) {
+            struct sockaddr_in *sin = (struct sockaddr_in *)
+                                      &session->addrs[n];
+
+            sin->sin_family = AF_INET;
+            sin->sin_addr = probe->target.addr.ipv4;
+            session->msgs[n].msg_hdr.msg_namelen = sizeof *sin;
+        } else {
+            session->addrs[n].sin6_family = AF_INET6;
+            session->addrs[n].sin6_addr = probe->target.addr.ipv6;
+            session->msgs[n].msg_hdr.msg_namelen = sizeof session->addrs[n];
+        }
+        session->msgs[n].msg_hdr.msg_name = &session->addrs[n];
+        session->msgs[n].msg_hdr.msg_iov = &session->iovs[2 * n];
+        session->msgs[n].msg_hdr.msg_iovlen =
+            ping_build_echo_iov(&session->iovs[2 * n], session->packets[n],
+                                family, session->id, seq, probe);
+        session->msgs[n].msg_hdr.msg_control = NULL;
+        session->msgs[n].msg_hdr.msg_controllen = 0;
+        session->msgs[n].msg_hdr.msg_flags = 0;
+        if (probe->ttl) {
+            ping_set_ttl(&session->msgs[n].msg_hdr, session->controls[n],
+                         family, probe->ttl);
+        }
+        seqs[n++] = seq;
+    }
+    if (n) {
+        ping_session_flush(session, family, seqs, n);
+    }
+    return i;
+}
+
+/*This function maps the type and code of an ICMP or ICMPv6 error to a
+* status.
+*/
+static enum ping_status ping_icmp_status(int family, uint8_t type,
+                                         uint8_t code)
+{
+    if (family == AF_INET) {
+        switch (type) {
+        case ICMP_DEST_UNREACH:
+            return code == ICMP_FRAG_NEEDED ? PING_TOO_BIG : PING_UNREACHABLE;
+        case ICMP_TIME_EXCEEDED:
+            return PING_TIME_EXCEEDED;
+        }
+    } else {
+        switch (type) {
+        case ICMP6_DST_UNREACH:
+            return PING_UNREACHABLE;
+        case ICMP6_PACKET_TOO_BIG:
+            return PING_TOO_BIG;
+        case ICMP6_TIME_EXCEEDED:
+            return PING_TIME_EXCEEDED;
+        }
+    }
+    return PING_ICMP_ERROR;
+}
+
+/*This function parses an ICMP packet read from an icmp socket. Packets
+* from a raw socket start with the IP header and can be echo replies or
+* ICMP errors quoting an echo request; a datagram socket only queues its
+* own echo replies, without IP header.
+*/
+static bool ping_parse4(const uint8_t *buf, size_t len, bool dgram,
+                        const struct sockaddr_in6 *from,
+                        struct ping_reply *reply)
+{
+    const struct ip *ip = (const struct ip *) buf;
+    const struct icmp *icmp, *inner_icmp;
+    const struct ip *inner;
+    size_t hlen, inner_hlen;
+
+    reply->result.from.family = AF_INET;
+    reply->target.family = AF_INET;
+    if (dgram) {
+        icmp = (const struct icmp *) buf;
+        if (len < ICMP_MINLEN || icmp->icmp_type != ICMP_ECHOREPLY) {
+            return false;
+        }
+        reply->result.from.addr.ipv4 =
+            ((const struct sockaddr_in *) from)->sin_addr;
+        hlen = 0;
+    } else {
+        if (len < sizeof *ip
+            || len < (hlen = ip->ip_hl * 4) + ICMP_MINLEN) {
+            return false;
+        }
+        icmp = (const struct icmp *) (buf + hlen);
+        reply->result.from.addr.ipv4 = ip->ip_src;
+    }
+
+    if (icmp->icmp_type == ICMP_ECHOREPLY) {
+        reply->id = ntohs(icmp->icmp_id);
+        reply->seq = ntohs(icmp->icmp_seq);
+        reply->target.addr.ipv4 = reply->result.from.addr.ipv4;
+        reply->result.status = PING_REACHABLE;
+        return true;
+    }
+
+    /* An error quotes the IP header and the first 8 bytes of the probe. */
+    inner = (const struct ip *) (buf + hlen + ICMP_MINLEN);
+    if (len < hlen + ICMP_MINLEN + sizeof *inner
+        || len < hlen + ICMP_MINLEN + (inner_hlen = inner->ip_hl * 4)
+                 + ICMP_MINLEN
+        || inner->ip_p != IPPROTO_ICMP) {
+        return false;
+    }
+    inner_icmp = (const struct icmp *) ((const uint8_t *) inner + inner_hlen);
+    if (inner_icmp->icmp_type != ICMP_ECHO) {
+        return false;
+    }
+    reply->id = ntohs(inner_icmp->icmp_id);
+    reply->seq = ntohs(inner_icmp->icmp_seq);
+    reply->target.addr.ipv4 = inner->ip_dst;
+    reply->result.icmp_type = icmp->icmp_type;
+    reply->result.icmp_code = icmp->icmp_code;
+    reply->result.status = ping_icmp_status(AF_INET, icmp->icmp_type,
+                                            icmp->icmp_code);
+    if (reply->result.status == PING_TOO_BIG) {
+        reply->result.mtu = ntohs(icmp->icmp_nextmtu);
+    }
+    return true;
+}
+
+/*This function parses an ICMPv6 packet read from an icmp6 socket, which
+* carries no IPv6 header. As for ICMP, a datagram socket only queues echo
+* replies.
+*/
+static bool ping_parse6(const uint8_t *buf, size_t len, bool dgram,
+                        const struct sockaddr_in6 *from,
+                        struct ping_reply *reply)
+{
+    const struct icmp6_hdr *icmp6 = (const struct icmp6_hdr *) buf;
+    const struct icmp6_hdr *inner_icmp6;
+    const struct ip6_hdr *inner;
+
+    if (len < sizeof *icmp6) {
+        return false;
+    }
+    reply->result.from.family = AF_INET6;
+    reply->result.from.addr.ipv6 = from->sin6_addr;
+    reply->target.family = AF_INET6;
+
+    if (icmp6->icmp6_type == ICMP6_ECHO_REPLY) {
+        reply->id = ntohs(icmp6->icmp6_id);
+        reply->seq = ntohs(icmp6->icmp6_seq);
+        reply->target.addr.ipv6 = from->sin6_addr;
+        reply->result.status = PING_REACHABLE;
+        return true;
+    }
+    if (dgram) {
+        return false;
+    }
+
+    inner = (const struct ip6_hdr *) (buf + sizeof *icmp6);
+    if (len < sizeof *icmp6 + sizeof *inner + sizeof *inner_icmp6
+        || inner->ip6_nxt != IPPROTO_ICMPV6) {
+        return false;
+    }
+    inner_icmp6 = (const struct icmp6_hdr *) (inner + 1);
+    if (inner_icmp6->icmp6_type != ICMP6_ECHO_REQUEST) {
+        return false;
+    }
+    reply->id = ntohs(inner_icmp6->icmp6_id);
+    reply->seq = ntohs(inner_icmp6->icmp6_seq);
+    reply->target.addr.ipv6 = inner->ip6_dst;
+    reply->result.icmp_type = icmp6->icmp6_type;
+    reply->result.icmp_code = icmp6->icmp6_code;
+    reply->result.status = ping_icmp_status(AF_INET6, icmp6->icmp6_type,
+                                            icmp6->icmp6_code);
+    if (reply->result.status == PING_TOO_BIG) {
+        reply->result.mtu = ntohl(icmp6->icmp6_mtu);
+    }
+    return true;
+}
+
+/*This function parses a message of the error queue of a datagram socket
+* (IP_RECVERR). The data is the echo request that caused the error, the
+* destination is the message name, and the error itself is in a control
+* message: an ICMP error and its sender, or a local error such as
+* EMSGSIZE.
+*/
+static bool ping_parse_errqueue(const struct msghdr *msg, const uint8_t *buf,
+                                size_t len, int family,
+                                struct ping_reply *reply)
+{
+    const struct sockaddr_in6 *dst = msg->msg_name;
+    const struct icmp6_hdr *echo = (const struct icmp6_hdr *) buf;
+    const struct sock_extended_err *ee = NULL;
+    const struct sockaddr_in6 *offender;
+    struct cmsghdr *cmsg;
+
+    /* ICMP and ICMPv6 echo headers share the same layout. */
+    if (len < sizeof *echo) {
+        return false;
+    }
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg;
+         cmsg = CMSG_NXTHDR((struct msghdr *) msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+            || (cmsg->cmsg_level == SOL_IPV6
+                && cmsg->cmsg_type == IPV6_RECVERR)) {
+            ee = (const struct sock_extended_err *) CMSG_DATA(cmsg);
+        }
+    }
+    if (!ee) {
+        return false;
+    }
+
+    reply->id = ntohs(echo->icmp6_id);
+    reply->seq = ntohs(echo->icmp6_seq);
+    reply->target.family = family;
+    if (family == AF_INET) {
+        reply->target.addr.ipv4 = ((const struct sockaddr_in *) dst)->sin_addr;
+    } else {
+        reply->target.addr.ipv6 = dst->sin6_addr;
+    }
+
+    if (ee->ee_origin == SO_EE_ORIGIN_ICMP
+        || ee->ee_origin == SO_EE_ORIGIN_ICMP6) {
+        offender = (const struct sockaddr_in6 *) SO_EE_OFFENDER(ee);
+        reply->result.from.family = family;
+        if (family == AF_INET) {
+            reply->result.from.addr.ipv4 =
+                ((const struct sockaddr_in *) offender)->sin_addr;
+        } else {
+            reply->result.from.addr.ipv6 = offender->sin6_addr;
+        }
+        reply->result.icmp_type = ee->ee_type;
+        reply->result.icmp_code = ee->ee_code;
+        reply->result.status = ping_icmp_status(family, ee->ee_type,
+                                                ee->ee_code);
+        if (reply->result.status == PING_TOO_BIG) {
+            reply->result.mtu = ee->ee_info;
+        }
+    } else if (ee->ee_errno == EMSGSIZE) {
+        /* Larger than the MTU of the outgoing interface. */
+        reply->result.status = PING_TOO_BIG;
+        reply->result.mtu = ee->ee_info;
+    } else {
+        reply->result.status = PING_SEND_FAILED;
+        reply->result.error = ee->ee_errno;
+    }
+    return true;
+}
+
+/*This function completes the slot of a probe with an event.
+*/
+static void ping_session_complete(struct ping_session *session,
+                                  struct ping_slot *slot,
+                                  const struct ping_result *result,
+                                  struct ping_event *event)
+{
+    event->aux = slot->aux;
+    event->result = *result;
+    slot->busy = false;
+    session->n_busy--;
+}
+
+/*This function reads the replies queued on a socket of the session, up to
+* max_events matched ones, from the error queue if flags has MSG_ERRQUEUE.
+* Packets that belong to no outstanding probe of the session (other
+* sessions or processes, late replies) are dropped.
+*/
+static size_t ping_session_recv(struct ping_session *session, int family,
+                                int flags, struct ping_event *events,
+                                size_t max_events)
+{
+    int sock = family == AF_INET ? session->sock4 : session->sock6;
+    bool dgram = family == AF_INET ? session->dgram4 : session->dgram6;
+    size_t n_events = 0;
+    int i, n;
+
+    if (sock < 0 || ((flags & MSG_ERRQUEUE) && !dgram)) {
+        return 0;
+    }
+    while (n_events < max_events && session->n_busy) {
+        unsigned int vlen = MIN(max_events - n_events, PING_RECV_BATCH);
+
+        for (i = 0; i < vlen; i++) {
+            struct msghdr *msg = &session->msgs[i].msg_hdr;
+
+            session->iovs[i].iov_base = session->packets[i];
+            session->iovs[i].iov_len = PING_RECV_SIZE;
+            msg->msg_name = &session->addrs[i];
+            msg->msg_namelen = sizeof session->addrs[i];
+            msg->msg_iov = &session->iovs[i];
+            msg->msg_iovlen = 1;
+            msg->msg_control = session->controls[i];
+            msg->msg_controllen = PING_CONTROL_SIZE;
+            msg->msg_flags = 0;
+        }
+        n = recvmmsg(sock, session->msgs, vlen, flags | MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN && errno != EINTR) {
+                VLOG_ERR("error:recvmmsg: errstr = %s", strerror(errno));
+            }
+            break;
+        }
+
+        for (i = 0; i < n; i++) {
+            struct msghdr *msg = &session->msgs[i].msg_hdr;
+            const uint8_t *buf = session->iovs[i].iov_base;
+            size_t len = MIN(session->msgs[i].msg_len, PING_RECV_SIZE);
+            struct ping_reply reply;
+            struct ping_slot *slot;
+            struct cmsghdr *cmsg;
+            uint64_t rx_ns = 0;
+            bool ok;
+
+            memset(&reply, 0, sizeof reply);
+            if (flags & MSG_ERRQUEUE) {
+                ok = ping_parse_errqueue(msg, buf, len, family, &reply);
+            } else if (family == AF_INET) {
+                ok = ping_parse4(buf, len, dgram, &session->addrs[i], &reply);
+            } else {
+                ok = ping_parse6(buf, len, dgram, &session->addrs[i], &reply);
+            }
+            /* The kernel sets the id of datagram sockets. */
+            if (!ok || (!dgram && reply.id != session->id)) {
+                continue;
+            }
+            slot = &session->slots[reply.seq & session->mask];
+            if (!slot->busy || slot->seq != reply.seq || slot->error
+                || !ping_target_equal(&slot->target, &reply.target)) {
+                continue;
+            }
+
+            for (cmsg = CMSG_FIRSTHDR(msg); cmsg;
+                 cmsg = CMSG_NXTHDR(msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET
+                    && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                    struct timespec ts;
+
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+                    rx_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+                }
+            }
+            if (!rx_ns) {
+                rx_ns = ping_now_ns(CLOCK_REALTIME);
+            }
+            reply.result.rtt_ns = rx_ns > slot->sent_ns
+                                  ? rx_ns - slot->sent_ns : 0;
+            ping_session_complete(session, slot, &reply.result,
+                                  &events[n_events++]);
+        }
+        if (n < vlen) {
+            break;
+        }
+    }
+    return n_events;
+}
+
+/*This function reports failed sends, then the probes whose deadline has
+* passed. Probes expire in send order, so only the oldest ones are looked
+* at.
+*/
+static size_t ping_session_expire(struct ping_session *session,
+                                  struct ping_event *events,
+                                  size_t max_events)
+{
+    struct ping_result result;
+    uint64_t now = ping_now_ns(CLOCK_MONOTONIC);
+    size_t n_events = 0;
+
+    while (session->n_failed && n_events < max_events) {
+        uint16_t seq = session->failed[--session->n_failed];
+        struct ping_slot *slot = &session->slots[seq & session->mask];
+
+        memset(&result, 0, sizeof result);
+        if (slot->error == EMSGSIZE) {
+            /* Larger than the MTU of the outgoing interface, which the
+             * kernel does not tell. */
+            result.status = PING_TOO_BIG;
+        } else {
+            result.status = PING_SEND_FAILED;
+            result.error = slot->error;
+        }
+        ping_session_complete(session, slot, &result, &events[n_events++]);
+    }
+
+    while (session->n_busy && n_events < max_events) {
+        struct ping_slot *slot;
+
+        slot = &session->slots[session->oldest_seq & session->mask];
+        if (slot->busy && slot->seq == session->oldest_seq) {
+            if (slot->error || slot->deadline_ns > now) {
+                break;
+            }
+            memset(&result, 0, sizeof result);
+            result.status = PING_TIMEOUT;
+            ping_session_complete(session, slot, &result,
+                                  &events[n_events++]);
+        }
+        session->oldest_seq++;
+    }
+    return n_events;
+}
+
+/*This function reads the replies and errors queued on all the sockets of
+* the session.
+*/
+static size_t ping_session_recv_all(struct ping_session *session,
+                                    struct ping_event *events,
+                                    size_t max_events)
+{
+    static const int families[] = {AF_INET, AF_INET6};
+    size_t n_events = 0;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(families); i++) {
+        n_events += ping_session_recv(session, families[i], 0,
+                                      events + n_events,
+                                      max_events - n_events);
+        n_events += ping_session_recv(session, families[i], MSG_ERRQUEUE,
+                                      events + n_events,
+                                      max_events - n_events);
+    }
+    return n_events;
+}
+
+size_t ping_session_poll(struct ping_session *session, int wait_ms,
+                         struct ping_event *events, size_t max_events)
+{
+    struct pollfd pfds[2];
+    size_t n_events = 0;
+    int n_pfds = 0;
+
+    n_events += ping_session_recv_all(session, events, max_events);
+    n_events += ping_session_expire(session, events + n_events,
+                                    max_events - n_events);
+    if (n_events || !wait_ms || !session->n_busy) {
+        return n_events;
+    }
+
+    /* Nothing yet: sleep until a socket is readable or the oldest probe
+     * times out. */
+    if (!session->n_failed) {
+        const struct ping_slot *oldest;
+        uint64_t now = ping_now_ns(CLOCK_MONOTONIC);
+        int timeout_ms;
+
+        oldest = &session->slots[session->oldest_seq & session->mask];
+        timeout_ms = oldest->deadline_ns > now
+                     ? (oldest->deadline_ns - now + 999999) / 1000000 : 0;
+        if (wait_ms < 0 || timeout_ms < wait_ms) {
+            wait_ms = timeout_ms;
+        }
+        if (session->sock4 >= 0) {
+            pfds[n_pfds].fd = session->sock4;
+            pfds[n_pfds++].events = POLLIN;
+        }
+        if (session->sock6 >= 0) {
+            pfds[n_pfds].fd = session->sock6;
+            pfds[n_pfds++].events = POLLIN;
+        }
+        poll(pfds, n_pfds, wait_ms);
+    }
+
+    n_events += ping_session_recv_all(session, events, max_events);
+    n_events += ping_session_expire(session, events + n_events,
+                                    max_events - n_events);
+    return n_events;
+}
+
+size_t ping_probe_batch(const struct ping_target *targets, size_t n_targets,
+                        const struct ping_session_options *options,
+                        struct ping_result *results)
+{
+    struct ping_session *session = ping_session_create(options);
+    struct ping_event events[PING_RECV_BATCH];
+    struct ping_probe probes[PING_RECV_BATCH];
+    size_t next = 0, n_reachable = 0;
+    size_t i, n;
+
+    for (i = 0; i < n_targets; i++) {
+        memset(&results[i], 0, sizeof results[i]);
+        results[i].status = PING_PENDING;
+    }
+
+    while (next < n_targets || ping_session_pending(session)) {
+        /* Keep the outstanding table full. */
+        while (next < n_targets) {
+            size_t n_probes = MIN(n_targets - next, PING_RECV_BATCH);
+
+            memset(probes, 0, n_probes * sizeof *probes);
+            for (i = 0; i < n_probes; i++) {
+                probes[i].target = targets[next + i];
+                probes[i].aux = (void *) (uintptr_t) (next + i);
+            }
+            n = ping_session_send(session, probes, n_probes);
+            next += n;
+            if (n < n_probes) {
+                break;
+            }
+        }
+
+        n = ping_session_poll(session, -1, events, PING_RECV_BATCH);
+        for (i = 0; i < n; i++) {
+            struct ping_result *result;
+
+            result = &results[(uintptr_t) events[i].aux];
+            *result = events[i].result;
+            n_reachable += result->status == PING_REACHABLE;
+        }
+    }
+
+    ping_session_destroy(session);
+    return n_reachable;
+}
+
+/* Binary search of the path MTU of one target: sizes up to lo passed,
+ * sizes from hi on are too big. */
+struct ping_pmtu_search
+{
+    unsigned int lo;
+    unsigned int hi;
+    unsigned int size;          /* Size probed. */
+    unsigned int attempts;      /* Timeouts at this size. */
+    bool ok;                    /* A probe passed: lo is an MTU. */
+};
+
+/*This function updates a path MTU search with the result of its probe and
+* chooses the next size to probe. Returns false when the search is over.
+*/
+static bool ping_pmtu_next(struct ping_pmtu_search *search,
+                           const struct ping_result *result,
+                           unsigned int retries)
+{
+    unsigned int next = 0;
+
+    switch (result->status) {
+    case PING_REACHABLE:
+        search->lo = search->size;
+        search->ok = true;
+        break;
+    case PING_TOO_BIG:
+        /* The reported MTU is exact: try it next, as the last size, since
+         * nothing above it can pass. */
+        search->hi = search->size;
+        if (result->mtu > search->lo && result->mtu < search->hi) {
+            next = result->mtu;
+            search->hi = result->mtu + 1;
+        }
+        break;
+    case PING_TIMEOUT:
+        /* A black hole drops large packets silently, but so does a lossy
+         * link: retry before deciding. */
+        if (++search->attempts <= retries) {
+            return true;
+        }
+        search->hi = search->size;
+        break;
+    default:
+        /* The target is not reachable at any size. */
+        return false;
+    }
+    search->attempts = 0;
+    if (search->hi - search->lo <= 1) {
+        return false;
+    }
+    search->size = next ? next : search->lo + (search->hi - search->lo) / 2;
+    return true;
+}
+
+size_t ping_pmtu_discover(const struct ping_target *targets, size_t n_targets,
+                          const struct ping_pmtu_options *options,
+                          unsigned int *mtus)
+{
+    struct ping_session_options session_options;
+    struct ping_session *session;
+    struct ping_pmtu_search *searches;
+    struct ping_event events[PING_RECV_BATCH];
+    struct ping_probe probes[PING_RECV_BATCH];
+    unsigned int min_mtu = 0, max_mtu = PING_PMTU_MAX;
+    unsigned int retries = PING_PMTU_RETRIES;
+    size_t *queue, n_queued, n_found = 0;
+    size_t i, n;
+
+    memset(&session_options, 0, sizeof session_options);
+    if (options) {
+        session_options = options->session;
+        min_mtu = options->min_mtu;
+        if (options->max_mtu) {
+            max_mtu = MIN(options->max_mtu, IP_MAXPACKET);
+        }
+        if (options->retries) {
+            retries = options->retries;
+        }
+    }
+    session = ping_session_create(&session_options);
+
+    /* Every search starts with the largest size, the common case. */
+    searches = xmalloc(n_targets * sizeof *searches);
+    queue = xmalloc(n_targets * sizeof *queue);
+    for (i = 0; i < n_targets; i++) {
+        unsigned int min = min_mtu ? min_mtu
+                           : targets[i].family == AF_INET6 ? PING_PMTU_MIN6
+                                                           : PING_PMTU_MIN4;
+
+        searches[i].lo = MIN(min, max_mtu) - 1;
+        searches[i].hi = max_mtu + 1;
+        searches[i].size = max_mtu;
+        searches[i].attempts = 0;
+        searches[i].ok = false;
+        queue[i] = i;
+        mtus[i] = 0;
+    }
+    n_queued = n_targets;
+
+    while (n_queued || ping_session_pending(session)) {
+        /* Probe the searches waiting for their next size. Completed probes
+         * requeue at most one search each, so the queue cannot overflow. */
+        while (n_queued) {
+            size_t n_probes = MIN(n_queued, PING_RECV_BATCH);
+            const size_t *next = &queue[n_queued - n_probes];
+
+            memset(probes, 0, n_probes * sizeof *probes);
+            for (i = 0; i < n_probes; i++) {
+                probes[i].target = targets[next[i]];
+                probes[i].size = searches[next[i]].size;
+                probes[i].aux = (void *) (uintptr_t) next[i];
+            }
+            n = ping_session_send(session, probes, n_probes);
+            memmove(&queue[n_queued - n_probes],
+                    &queue[n_queued - n_probes + n],
+                    (n_probes - n) * sizeof *queue);
+            n_queued -= n;
+            if (n < n_probes) {
+                break;
+            }
+        }
+
+        n = ping_session_poll(session, -1, events, PING_RECV_BATCH);
+        for (i = 0; i < n; i++) {
+            size_t target = (uintptr_t) events[i].aux;
+            struct ping_pmtu_search *search = &searches[target];
+
+            if (ping_pmtu_next(search, &events[i].result, retries)) {
+                queue[n_queued++] = target;
+            } else if (search->ok) {
+                mtus[target] = search->lo;
+                n_found++;
+            }
+        }
+    }
+
+    ping_session_destroy(session);
+    free(searches);
+    free(queue);
+    return n_found;
+}
+
+/*This function returns whether a trace can stop: every flow reached the
+* target and every hop before it answered or timed out.
+*/
+static bool ping_trace_done(const struct ping_result *hops,
+                            unsigned int max_ttl, unsigned int n_flows)
+{
+    unsigned int flow, ttl;
+
+    for (flow = 0; flow < n_flows; flow++) {
+        const struct ping_result *path = &hops[flow * max_ttl];
+
+        for (ttl = 0; ttl < max_ttl; ttl++) {
+            if (path[ttl].status == PING_PENDING) {
+                return false;
+            }
+            if (path[ttl].status == PING_REACHABLE) {
+                break;
+            }
+        }
+        if (ttl == max_ttl) {
+            return false;
+        }
+    }
+    return true;
+}
+
+unsigned int ping_trace(const struct ping_target *target,
+                        const struct ping_trace_options *options,
+                        struct ping_result *hops)
+{
+    struct ping_session_options session_options;
+    struct ping_session *session;
+    struct ping_event events[PING_RECV_BATCH];
+    struct ping_probe *probes;
+    unsigned int max_ttl = PING_TRACE_MAX_TTL;
+    unsigned int n_flows = 1;
+    unsigned int n_hops = 0;
+    size_t i, n, n_probes, sent = 0;
+
+    memset(&session_options, 0, sizeof session_options);
+    if (options) {
+        session_options = options->session;
+        if (options->max_ttl) {
+            max_ttl = MIN(options->max_ttl, 255);
+        }
+        if (options->n_flows) {
+            n_flows = MIN(options->n_flows, PING_TRACE_MAX_FLOWS);
+        }
+    }
+    n_probes = max_ttl * n_flows;
+    session_options.max_outstanding = n_probes;
+    session = ping_session_create(&session_options);
+
+    /* Lowest TTLs first, so that the first hops are not queued behind the
+     * probes that reach the target. */
+    probes = xzalloc(n_probes * sizeof *probes);
+    for (i = 0; i < n_probes; i++) {
+        unsigned int ttl = i / n_flows + 1;
+        unsigned int flow = i % n_flows;
+
+        probes[i].target = *target;
+        probes[i].ttl = ttl;
+        probes[i].flow = flow;
+        probes[i].aux = (void *) (uintptr_t) (flow * max_ttl + ttl - 1);
+        memset(&hops[i], 0, sizeof hops[i]);
+        hops[i].status = PING_PENDING;
+    }
+    while (sent < n_probes) {
+        sent += ping_session_send(session, probes + sent, n_probes - sent);
+    }
+    free(probes);
+
+    while (ping_session_pending(session)
+           && !ping_trace_done(hops, max_ttl, n_flows)) {
+        n = ping_session_poll(session, -1, events, PING_RECV_BATCH);
+        for (i = 0; i < n; i++) {
+            hops[(uintptr_t) events[i].aux] = events[i].result;
+        }
+    }
+    ping_session_destroy(session);
+
+    for (i = 0; i < n_probes; i++) {
+        unsigned int ttl = i % max_ttl + 1;
+
+        if (hops[i].status == PING_REACHABLE && (!n_hops || ttl < n_hops)) {
+            n_hops = ttl;
+        }
+    }
+    return n_hops;
+}
+
+/*This function sends a ICMP_ECHO packet to the target on the cached
+* socket of a VRF namespace, NULL for the namespace of the calling thread.
 * target must be a ipv4 address string.
 */
-int ping4(const char *target)
+static int ping4_ns(const char *vrf_ns_name, const char *target)
 {
     struct sockaddr_in pingaddr;
     struct packet pckt;
-    const int val=255;
     int pingsock;
     int err = -1;
-    if((pingsock = create_icmp4_socket())< 0){
-        VLOG_ERR("can not create icmp4_socket. errstr = %s",strerror(errno));
-        return pingsock;
-    }
-    if ((err = setsockopt(pingsock, SOL_IP, IP_TTL, &val, sizeof(val))) != 0){
-        VLOG_ERR("Set TTL option");
-        close(pingsock);
-        return err;
-    }
 
     memset(&pingaddr, 0, sizeof(struct sockaddr_in));
     pingaddr.sin_family = AF_INET;
     if((err = inet_pton(AF_INET, target, &pingaddr.sin_addr)) <= 0){
         VLOG_ERR("The given target_ip_add is not valid. error: %d",err);
-        close(pingsock);
         return err;
     }
 
@@ -118,34 +1675,35 @@ int ping4(const char *target)
     pckt.hdr.un.echo.sequence = 1;
     pckt.hdr.checksum = checksum(&pckt, sizeof(pckt));
 
+    pthread_rwlock_rdlock(&ping_vrf_rwlock);
+    if((pingsock = ping_vrf_socket(vrf_ns_name, AF_INET))< 0){
+        pthread_rwlock_unlock(&ping_vrf_rwlock);
+        return pingsock;
+    }
     if ((err = sendto(pingsock, &pckt, sizeof(pckt), MSG_DONTWAIT,
                  (struct sockaddr*)&pingaddr, sizeof(pingaddr))) <= 0 ){
         VLOG_ERR("error:sendto: errstr = %s",strerror(errno) );
-        close(pingsock);
+        pthread_rwlock_unlock(&ping_vrf_rwlock);
         return err;
     }
-    close(pingsock);
+    pthread_rwlock_unlock(&ping_vrf_rwlock);
     return 0;
 }
 
 
-/*This function sends a ICMP6_ECHO_REQUEST packet to the target.
-* target must be the ipv6 address string.
+/*This function sends a ICMP6_ECHO_REQUEST packet to the target on the
+* cached socket of a VRF namespace, NULL for the namespace of the calling
+* thread. target must be the ipv6 address string.
 */
-int ping6(const char *target)
+static int ping6_ns(const char *vrf_ns_name, const char *target)
 {
     struct sockaddr_in6 pingaddr;
     struct icmp6_hdr *pkt;
     int pingsock, c;
-    int sockopt;
     int err;
     char packet[DEFDATALEN + MAXIPLEN + MAXICMPLEN];
 
-    if((pingsock = create_icmp6_socket())< 0){
-        VLOG_ERR("can not create icmp6_socket. errstr = %s",strerror(errno));
-        return pingsock;
-    }
-    memset(&pingaddr, 0, sizeof(struct sockaddr_in));
+    memset(&pingaddr, 0, sizeof(struct sockaddr_in6));
     pingaddr.sin6_family = AF_INET6;
 
     if((err = inet_pton(AF_INET6, target, &pingaddr.sin6_addr)) <= 0){
@@ -157,17 +1715,94 @@ int ping6(const char *target)
     memset(pkt, 0, sizeof(packet));
     pkt->icmp6_type = ICMP6_ECHO_REQUEST;
 
-    sockopt = 2;
-    setsockopt(pingsock, SOL_RAW, IPV6_CHECKSUM, (char *) &sockopt,
-               sizeof(sockopt));
-
+    pthread_rwlock_rdlock(&ping_vrf_rwlock);
+    if((pingsock = ping_vrf_socket(vrf_ns_name, AF_INET6))< 0){
+        pthread_rwlock_unlock(&ping_vrf_rwlock);
+        return pingsock;
+    }
     c = sendto(pingsock, packet, sizeof(packet), MSG_DONTWAIT,
                (struct sockaddr *) &pingaddr, sizeof(struct sockaddr_in6));
+    pthread_rwlock_unlock(&ping_vrf_rwlock);
 
     if (c < 0 ) {
         VLOG_ERR("error:sendto: errno = %s",strerror(errno) );
-        close(pingsock);
         return c;
     }
     return 0;
 }
+
+/*This function sends a ICMP_ECHO packet to the target from the namespace
+* of the calling thread.
+*/
+int ping4(const char *target)
+{
+    return ping4_ns(NULL, target);
+}
+
+/*This function sends a ICMP6_ECHO_REQUEST packet to the target from the
+* namespace of the calling thread.
+*/
+int ping6(const char *target)
+{
+    return ping6_ns(NULL, target);
+}
+
+/*This function sends a ICMP_ECHO packet to the target from a VRF, given
+* by name.
+*/
+int ping4_vrf(const struct ovsdb_idl *idl, const char *vrf_name,
+              const char *target)
+{
+    char vrf_ns_name[UUID_LEN+1] = {0};
+
+    if (get_vrf_ns_from_name(idl, vrf_name, vrf_ns_name)) {
+        VLOG_ERR("VRF %s not found", vrf_name);
+        return -1;
+    }
+    return ping4_ns(vrf_ns_name, target);
+}
+
+/*This function sends a ICMP6_ECHO_REQUEST packet to the target from a
+* VRF, given by name.
+*/
+int ping6_vrf(const struct ovsdb_idl *idl, const char *vrf_name,
+              const char *target)
+{
+    char vrf_ns_name[UUID_LEN+1] = {0};
+
+    if (get_vrf_ns_from_name(idl, vrf_name, vrf_ns_name)) {
+        VLOG_ERR("VRF %s not found", vrf_name);
+        return -1;
+    }
+    return ping6_ns(vrf_ns_name, target);
+}
+
+/*This function sends a ICMP_ECHO packet to the target from a VRF, given
+* by table_id.
+*/
+int ping4_vrf_table_id(const struct ovsdb_idl *idl, int64_t table_id,
+                       const char *target)
+{
+    char vrf_ns_name[UUID_LEN+1] = {0};
+
+    if (get_vrf_ns_from_table_id(idl, table_id, vrf_ns_name)) {
+        VLOG_ERR("VRF with table_id %ld not found", (long int) table_id);
+        return -1;
+    }
+    return ping4_ns(vrf_ns_name, target);
+}
+
+/*This function sends a ICMP6_ECHO_REQUEST packet to the target from a
+* VRF, given by table_id.
+*/
+int ping6_vrf_table_id(const struct ovsdb_idl *idl, int64_t table_id,
+                       const char *target)
+{
+    char vrf_ns_name[UUID_LEN+1] = {0};
+
+    if (get_vrf_ns_from_table_id(idl, table_id, vrf_ns_name)) {
+        VLOG_ERR("VRF with table_id %ld not found", (long int) table_id);
+        return -1;
+    }
+    return ping6_ns(vrf_ns_name, target);
+}
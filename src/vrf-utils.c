@@ -32,13 +32,89 @@
 #include <errno.h>
 
 #include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <linux/filter.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
+#include <time.h>
+#include "hash.h"
+#include "hmap.h"
+#include "util.h"
+#include "arp-send.h"
+#include "ping-send.h"
 #include "vrf-utils.h"
 #include "vswitch-idl.h"
 #include "openswitch-idl.h"
 #include "openvswitch/vlog.h"
 
 VLOG_DEFINE_THIS_MODULE(vrf_utils);
+
+#define VRF_NETNS_DIR          "/var/run/netns"
+/* Worker threads of a batch when the caller does not say. */
+#define VRF_DEFAULT_THREADS    8
+/* A vrf_exec() worker exits after being idle that long, which releases its
+ * namespace. */
+#define VRF_EXEC_IDLE_MS       30000
+
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT           15
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+/* Function run on each item of a vrf_parallel_run() batch. */
+typedef void vrf_parallel_fn(size_t i, void *aux);
+
+/* Items shared by the worker threads of vrf_parallel_run(). */
+struct vrf_parallel
+{
+    size_t n_items;
+    size_t next;            /* Next item to take, under 'mutex'. */
+    pthread_mutex_t mutex;
+    vrf_parallel_fn *fn;
+    void *aux;
+};
+
+/* A function queued on a namespace worker by vrf_exec() or
+ * vrf_exec_async(). */
+struct vrf_exec_task
+{
+    struct vrf_exec_task *next; /* In the queue of 'worker'. */
+    struct vrf_exec_worker *worker;
+    vrf_exec_fn *fn;
+    void *ctx;
+    vrf_exec_done_fn *done;     /* Asynchronous completion, or NULL. */
+    long long int deadline_ms;  /* Latest start time, LLONG_MAX for none. */
+
+    /* Synchronous tasks, owned by the caller of vrf_exec(). */
+    bool sync;
+    bool finished;
+    int error;
+    pthread_cond_t cond;        /* Signaled when 'finished' is set. */
+};
+
+/* A thread that stays in one namespace and runs the tasks queued for it. */
+struct vrf_exec_worker
+{
+    struct hmap_node node;      /* In vrf_exec_workers, unless exiting. */
+    char ns_name[MAX_BUFFER_SIZE]; /* SWITCH_NAMESPACE for the default. */
+    struct vrf_exec_task *head, *tail;
+    pthread_cond_t cond;        /* Signaled when a task is queued. */
+    bool exiting;               /* Removed from vrf_exec_workers. */
+};
+
+/* vrf_exec_mutex protects vrf_exec_workers and the workers' queues. */
+static pthread_mutex_t vrf_exec_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct hmap vrf_exec_workers = HMAP_INITIALIZER(&vrf_exec_workers);
+static pthread_once_t vrf_exec_atfork_once = PTHREAD_ONCE_INIT;
 /************************************************************************//**
  * Reads the vrf row from a ovsdb based on vrf name.
  *
@@ -262,27 +338,361 @@ get_vrf_name_from_uuid (const struct ovsdb_idl *idl, const struct uuid *uuid)
     return NULL;
 }
 
+static long long int
+vrf_exec_now_ms (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long int) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Initializes 'cond' to wait on CLOCK_MONOTONIC deadlines. */
+static void
+vrf_exec_cond_init (pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+/* Waits on 'cond' until 'deadline_ms', on the CLOCK_MONOTONIC clock.
+ * Returns ETIMEDOUT once the deadline has passed. */
+static int
+vrf_exec_cond_wait (pthread_cond_t *cond, long long int deadline_ms)
+{
+    struct timespec ts;
+
+    if (deadline_ms == LLONG_MAX) {
+        return pthread_cond_wait(cond, &vrf_exec_mutex);
+    }
+    ts.tv_sec = deadline_ms / 1000;
+    ts.tv_nsec = (deadline_ms % 1000) * 1000000;
+    return pthread_cond_timedwait(cond, &vrf_exec_mutex, &ts);
+}
+
 /***************************************************************************
-* thread routine to enter the namespace and execute the given task.
-*
-* @param[in]  arg : struct nlutils_op_data parameter for parsing
-*
-* executes desired operation and stores the result in arg itself
-***************************************************************************/
-static void *vrfThread (void *arg)
+ * Reports the result of a task, with vrf_exec_mutex held: wakes up the
+ * caller of vrf_exec(), or calls the completion callback of an
+ * asynchronous task, without the mutex.
+ ***************************************************************************/
+static void
+vrf_exec_complete (struct vrf_exec_task *task, int error)
+{
+    if (task->sync) {
+        task->error = error;
+        task->finished = true;
+        pthread_cond_signal(&task->cond);
+        return;
+    }
+    pthread_mutex_unlock(&vrf_exec_mutex);
+    if (task->done) {
+        task->done(error, task->ctx);
+    }
+    free(task);
+    pthread_mutex_lock(&vrf_exec_mutex);
+}
+
+/* Removes a worker from vrf_exec_workers, with vrf_exec_mutex held, so that
+ * it exits once its queue is empty. */
+static void
+vrf_exec_worker_detach (struct vrf_exec_worker *w)
+{
+    if (!w->exiting) {
+        w->exiting = true;
+        hmap_remove(&vrf_exec_workers, &w->node);
+        pthread_cond_signal(&w->cond);
+    }
+}
+
+/***************************************************************************
+ * Worker thread of a namespace: enters it once, then runs the queued tasks
+ * in order. Tasks queued once the worker is detached or could not enter
+ * its namespace complete with an error instead of running.
+ ***************************************************************************/
+static void *
+vrf_exec_worker_main (void *w_)
+{
+    struct vrf_exec_worker *w = w_;
+    struct vrf_exec_task *task;
+    int ns_error = 0, error;
+
+    /* The default namespace is entered too: the worker starts in the
+     * namespace of the thread that created it, which may be another VRF. */
+    if (nl_setns_with_name(w->ns_name)) {
+        ns_error = ENOENT;
+    }
+
+    pthread_mutex_lock(&vrf_exec_mutex);
+    if (ns_error) {
+        vrf_exec_worker_detach(w);
+    }
+    for (;;) {
+        while (!w->head && !w->exiting) {
+            if (vrf_exec_cond_wait(&w->cond,
+                                   vrf_exec_now_ms() + VRF_EXEC_IDLE_MS)
+                == ETIMEDOUT && !w->head) {
+                vrf_exec_worker_detach(w);
+            }
+        }
+        task = w->head;
+        if (!task) {
+            break;
+        }
+        w->head = task->next;
+        if (!w->head) {
+            w->tail = NULL;
+        }
+        task->worker = NULL;
+
+        if (ns_error) {
+            error = ns_error;
+        } else if (w->exiting) {
+            error = ECANCELED;
+        } else if (vrf_exec_now_ms() > task->deadline_ms) {
+            error = ETIMEDOUT;
+        } else {
+            pthread_mutex_unlock(&vrf_exec_mutex);
+            error = task->fn(task->ctx);
+            pthread_mutex_lock(&vrf_exec_mutex);
+        }
+        vrf_exec_complete(task, error);
+    }
+    pthread_mutex_unlock(&vrf_exec_mutex);
+
+    pthread_cond_destroy(&w->cond);
+    free(w);
+    return NULL;
+}
+
+static void
+vrf_exec_atfork_prepare (void)
+{
+    pthread_mutex_lock(&vrf_exec_mutex);
+}
+
+static void
+vrf_exec_atfork_parent (void)
+{
+    pthread_mutex_unlock(&vrf_exec_mutex);
+}
+
+/***************************************************************************
+ * Forgets the workers in a forked child, where their threads do not exist:
+ * the child creates its own workers on its first vrf_exec(). The parent
+ * tasks left in the queues are not the child's to complete.
+ ***************************************************************************/
+static void
+vrf_exec_atfork_child (void)
+{
+    struct vrf_exec_worker *w, *next;
+
+    HMAP_FOR_EACH_SAFE (w, next, node, &vrf_exec_workers) {
+        hmap_remove(&vrf_exec_workers, &w->node);
+        free(w);
+    }
+    pthread_mutex_init(&vrf_exec_mutex, NULL);
+}
+
+static void
+vrf_exec_atfork_register (void)
+{
+    pthread_atfork(vrf_exec_atfork_prepare, vrf_exec_atfork_parent,
+                   vrf_exec_atfork_child);
+}
+
+/***************************************************************************
+ * Queues a task on the worker of a namespace, which is created if needed.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+static int
+vrf_exec_submit (const char *vrf_ns_name, struct vrf_exec_task *task,
+                 unsigned int timeout_ms)
+{
+    struct vrf_exec_worker *w = NULL, *iter;
+    pthread_attr_t attr;
+    pthread_t tid;
+    uint32_t hash;
+    int err_no;
+
+    if (!is_nondefault_vrf(vrf_ns_name)) {
+        vrf_ns_name = SWITCH_NAMESPACE;
+    }
+    pthread_once(&vrf_exec_atfork_once, vrf_exec_atfork_register);
+    hash = hash_string(vrf_ns_name, 0);
+    task->next = NULL;
+    task->deadline_ms = timeout_ms ? vrf_exec_now_ms() + timeout_ms
+                                   : LLONG_MAX;
+
+    pthread_mutex_lock(&vrf_exec_mutex);
+    HMAP_FOR_EACH_WITH_HASH (iter, node, hash, &vrf_exec_workers) {
+        if (!strcmp(iter->ns_name, vrf_ns_name)) {
+            w = iter;
+            break;
+        }
+    }
+    if (!w) {
+        w = xzalloc(sizeof *w);
+        snprintf(w->ns_name, sizeof w->ns_name, "%s", vrf_ns_name);
+        vrf_exec_cond_init(&w->cond);
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        err_no = pthread_create(&tid, &attr, vrf_exec_worker_main, w);
+        pthread_attr_destroy(&attr);
+        if (err_no) {
+            pthread_mutex_unlock(&vrf_exec_mutex);
+            VLOG_ERR("thread create failed with error code %d", err_no);
+            pthread_cond_destroy(&w->cond);
+            free(w);
+            return err_no;
+        }
+        hmap_insert(&vrf_exec_workers, &w->node, hash);
+    }
+
+    task->worker = w;
+    if (w->tail) {
+        w->tail->next = task;
+    } else {
+        w->head = task;
+    }
+    w->tail = task;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&vrf_exec_mutex);
+    return 0;
+}
+
+/* Takes a task that has not started yet out of its worker queue, with
+ * vrf_exec_mutex held. */
+static void
+vrf_exec_dequeue (struct vrf_exec_task *task)
 {
-   struct nlutils_op_data *tdata=(struct nlutils_op_data *)arg;
+    struct vrf_exec_worker *w = task->worker;
+    struct vrf_exec_task **prev, *last = NULL;
 
-   if (nl_setns_with_name(tdata->ns_name) != 0)
-   {
-	   _exit(EXIT_SUCCESS);
-   }
-   nl_perform_socket_operation(tdata);
-   pthread_exit(NULL);
+    for (prev = &w->head; *prev != task; prev = &(*prev)->next) {
+        last = *prev;
+    }
+    *prev = task->next;
+    if (w->tail == task) {
+        w->tail = last;
+    }
+    task->worker = NULL;
 }
 
 /***************************************************************************
-* Helper routine to enter the invoke vrf thread for the given task.
+ * Runs a function in a VRF namespace, on the worker thread of that
+ * namespace, and waits for its result.
+ *
+ * @param[in]  vrf_ns_name : namespace to run in, NULL for the default one.
+ * @param[in]  fn          : function to run.
+ * @param[in]  ctx         : argument of fn.
+ * @param[in]  timeout_ms  : how long fn may wait to start, 0 for ever.
+ *
+ * @return the value returned by fn, ENOENT if the namespace could not be
+ *         entered, ETIMEDOUT if fn did not start in time.
+ ***************************************************************************/
+int
+vrf_exec (const char *vrf_ns_name, vrf_exec_fn *fn, void *ctx,
+          unsigned int timeout_ms)
+{
+    struct vrf_exec_task task;
+    int error;
+
+    memset(&task, 0, sizeof task);
+    task.fn = fn;
+    task.ctx = ctx;
+    task.sync = true;
+    vrf_exec_cond_init(&task.cond);
+
+    error = vrf_exec_submit(vrf_ns_name, &task, timeout_ms);
+    if (!error) {
+        pthread_mutex_lock(&vrf_exec_mutex);
+        while (!task.finished) {
+            /* A task that started can not be abandoned, since it uses
+             * 'ctx': only a task still queued times out here, and a task
+             * that started is waited for without a deadline. */
+            if (vrf_exec_cond_wait(&task.cond,
+                                   task.worker ? task.deadline_ms : LLONG_MAX)
+                == ETIMEDOUT && !task.finished && task.worker) {
+                vrf_exec_dequeue(&task);
+                task.error = ETIMEDOUT;
+                task.finished = true;
+            }
+        }
+        pthread_mutex_unlock(&vrf_exec_mutex);
+        error = task.error;
+    }
+    pthread_cond_destroy(&task.cond);
+    return error;
+}
+
+/***************************************************************************
+ * Queues a function to run in a VRF namespace, on the worker thread of
+ * that namespace, and returns without waiting.
+ *
+ * @param[in]  vrf_ns_name : namespace to run in, NULL for the default one.
+ * @param[in]  fn          : function to run.
+ * @param[in]  ctx         : argument of fn and done.
+ * @param[in]  done        : called with the result, may be NULL.
+ * @param[in]  timeout_ms  : how long fn may wait to start, 0 for ever.
+ *
+ * @return 0 if queued, else an errno value
+ ***************************************************************************/
+int
+vrf_exec_async (const char *vrf_ns_name, vrf_exec_fn *fn, void *ctx,
+                vrf_exec_done_fn *done, unsigned int timeout_ms)
+{
+    struct vrf_exec_task *task;
+    int error;
+
+    task = xzalloc(sizeof *task);
+    task->fn = fn;
+    task->ctx = ctx;
+    task->done = done;
+    error = vrf_exec_submit(vrf_ns_name, task, timeout_ms);
+    if (error) {
+        free(task);
+    }
+    return error;
+}
+
+/***************************************************************************
+ * Stops the worker thread of a VRF namespace, e.g. before the namespace is
+ * deleted, since the worker keeps it alive. Its queued tasks complete with
+ * ECANCELED; a task already running completes normally.
+ *
+ * @param[in]  vrf_ns_name : namespace of the worker, or NULL for all the
+ *                           workers.
+ ***************************************************************************/
+void
+vrf_exec_flush (const char *vrf_ns_name)
+{
+    struct vrf_exec_worker *w, *next;
+
+    pthread_mutex_lock(&vrf_exec_mutex);
+    HMAP_FOR_EACH_SAFE (w, next, node, &vrf_exec_workers) {
+        if (!vrf_ns_name || !strcmp(w->ns_name, vrf_ns_name)) {
+            vrf_exec_worker_detach(w);
+        }
+    }
+    pthread_mutex_unlock(&vrf_exec_mutex);
+}
+
+/* vrf_exec() function running one of the nlutils_op operations. */
+static int
+vrf_socket_op_run (void *tdata)
+{
+    nl_perform_socket_operation(tdata);
+    return 0;
+}
+
+/***************************************************************************
+* Helper routine to run the given task in its vrf namespace.
 *
 * @param[in]  tdata : struct nlutils_op_data parameter for parsing
 *
@@ -290,13 +700,15 @@ static void *vrfThread (void *arg)
 ***************************************************************************/
 static bool vrf_perform_socket_operation (struct nlutils_op_data *tdata)
 {
-    int err_no;
-    pthread_t tid;
+    int error;
 
-    if (!(err_no = pthread_create(&tid, NULL, vrfThread, (void *)tdata))) {
-        pthread_join(tid, NULL);
-    } else {
-        VLOG_ERR("thread create failed with error code %d", err_no);
+    error = vrf_exec(tdata->ns_name, vrf_socket_op_run, tdata, 0);
+    if (error) {
+        VLOG_ERR("Unable to run op %d in namespace %s, error %d",
+                 tdata->operation, tdata->ns_name, error);
+        tdata->result = -1;
+        tdata->params.ni.ifindex = 0;
+        tdata->params.in.ifname[0] = '\0';
         return false;
     }
     return true;
@@ -551,3 +963,714 @@ vrf_is_ready (const struct ovsdb_idl *idl, char *vrf_name)
     }
     return false;
 }
+
+/***************************************************************************
+ * Brings up the loopback interface of the namespace of the calling thread.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+static int
+vrf_ns_loopback_up (void)
+{
+    struct ifreq ifr;
+    int sock, error = 0;
+
+    sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        return errno;
+    }
+    memset(&ifr, 0, sizeof ifr);
+    snprintf(ifr.ifr_name, IFNAMSIZ, "lo");
+    if (ioctl(sock, SIOCGIFFLAGS, &ifr) < 0) {
+        error = errno;
+    } else if (!(ifr.ifr_flags & IFF_UP)) {
+        ifr.ifr_flags |= IFF_UP;
+        if (ioctl(sock, SIOCSIFFLAGS, &ifr) < 0) {
+            error = errno;
+        }
+    }
+    close(sock);
+    return error;
+}
+
+/***************************************************************************
+ * Creates a namespace the way "ip netns add" does: the calling thread moves
+ * to a new network namespace, which is kept alive by a bind mount on
+ * /var/run/netns/<ns_name>, then returns to the namespace 'orig_ns'.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+static int
+vrf_ns_create_one (const char *ns_name, int orig_ns)
+{
+    char path[PATH_MAX], self[PATH_MAX];
+    int fd, error = 0;
+
+    snprintf(path, sizeof path, VRF_NETNS_DIR "/%s", ns_name);
+    fd = open(path, O_RDONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return errno;
+    }
+    close(fd);
+
+    if (unshare(CLONE_NEWNET) < 0) {
+        error = errno;
+        unlink(path);
+        return error;
+    }
+    snprintf(self, sizeof self, "/proc/self/task/%ld/ns/net",
+             (long int) syscall(SYS_gettid));
+    if (mount(self, path, "none", MS_BIND, NULL) < 0) {
+        error = errno;
+    } else {
+        error = vrf_ns_loopback_up();
+    }
+
+    if (setns(orig_ns, CLONE_NEWNET) < 0) {
+        VLOG_ERR("Unable to return to the parent namespace, errno %d", errno);
+        error = error ? error : errno;
+    }
+    if (error) {
+        umount2(path, MNT_DETACH);
+        unlink(path);
+    }
+    return error;
+}
+
+/***************************************************************************
+ * Removes a namespace created by vrf_ns_create_one(). The namespace goes
+ * away once no process, socket or interface refers to it anymore.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+static int
+vrf_ns_delete_one (const char *ns_name)
+{
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof path, VRF_NETNS_DIR "/%s", ns_name);
+    if (umount2(path, MNT_DETACH) < 0 && errno != EINVAL) {
+        return errno;
+    }
+    if (unlink(path) < 0) {
+        return errno;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Worker thread of vrf_parallel_run(): takes items until there is none
+ * left.
+ ***************************************************************************/
+static void *
+vrf_parallel_worker (void *p_)
+{
+    struct vrf_parallel *p = p_;
+    size_t i;
+
+    for (;;) {
+        pthread_mutex_lock(&p->mutex);
+        i = p->next++;
+        pthread_mutex_unlock(&p->mutex);
+        if (i >= p->n_items) {
+            break;
+        }
+        p->fn(i, p->aux);
+    }
+    return NULL;
+}
+
+/***************************************************************************
+ * Runs 'fn' on items 0 to n_items - 1 on up to 'n_threads' worker threads,
+ * and returns when all are done. Since the workers are created for the
+ * batch, 'fn' may change the namespace of its thread.
+ ***************************************************************************/
+static void
+vrf_parallel_run (size_t n_items, unsigned int n_threads,
+                  vrf_parallel_fn *fn, void *aux)
+{
+    struct vrf_parallel p;
+    pthread_t *tids;
+    size_t i, n_started = 0;
+    int err_no;
+
+    if (!n_items) {
+        return;
+    }
+    if (!n_threads) {
+        n_threads = VRF_DEFAULT_THREADS;
+    }
+    n_threads = MIN(n_threads, n_items);
+
+    memset(&p, 0, sizeof p);
+    p.n_items = n_items;
+    p.fn = fn;
+    p.aux = aux;
+    pthread_mutex_init(&p.mutex, NULL);
+
+    tids = xmalloc(n_threads * sizeof *tids);
+    for (i = 0; i < n_threads; i++) {
+        err_no = pthread_create(&tids[n_started], NULL, vrf_parallel_worker,
+                                &p);
+        if (err_no) {
+            VLOG_ERR("thread create failed with error code %d", err_no);
+            break;
+        }
+        n_started++;
+    }
+    if (!n_started) {
+        /* Do the work in a thread anyway, since 'fn' may change its
+         * namespace. */
+        if (!pthread_create(&tids[0], NULL, vrf_parallel_worker, &p)) {
+            n_started++;
+        }
+    }
+    for (i = 0; i < n_started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    free(tids);
+    pthread_mutex_destroy(&p.mutex);
+}
+
+/***************************************************************************
+ * Returns a descriptor of the network namespace of the calling thread, or
+ * -1 on failure.
+ ***************************************************************************/
+static int
+vrf_thread_ns_open (void)
+{
+    char self[PATH_MAX];
+
+    snprintf(self, sizeof self, "/proc/self/task/%ld/ns/net",
+             (long int) syscall(SYS_gettid));
+    return open(self, O_RDONLY | O_CLOEXEC);
+}
+
+/***************************************************************************
+ * vrf_parallel_run() function creating the namespace of reqs[i].
+ ***************************************************************************/
+static void
+vrf_ns_create_item (size_t i, void *reqs_)
+{
+    struct vrf_ns_req *req = &((struct vrf_ns_req *) reqs_)[i];
+    int orig_ns;
+
+    orig_ns = vrf_thread_ns_open();
+    if (orig_ns < 0) {
+        req->error = errno;
+        return;
+    }
+    req->error = vrf_ns_create_one(req->ns_name, orig_ns);
+    close(orig_ns);
+}
+
+/***************************************************************************
+ * vrf_parallel_run() function removing the namespace of reqs[i]. The
+ * threads and sockets the library keeps in the namespace are released
+ * first, since they would keep it alive, and so is its cached state.
+ ***************************************************************************/
+static void
+vrf_ns_delete_item (size_t i, void *reqs_)
+{
+    struct vrf_ns_req *req = &((struct vrf_ns_req *) reqs_)[i];
+
+    vrf_exec_flush(req->ns_name);
+    ping_vrf_sockets_flush(req->ns_name);
+    arp_send_sockets_flush(req->ns_name);
+    nl_if_stats_flush(req->ns_name);
+    nl_intf_locator_remove_ns(req->ns_name);
+    req->error = vrf_ns_delete_one(req->ns_name);
+}
+
+/***************************************************************************
+ * Makes /var/run/netns a shared mount point, as "ip netns add" does, so
+ * that the namespaces mounted there are seen from every mount namespace.
+ ***************************************************************************/
+static void
+vrf_ns_dir_init (void)
+{
+    if (mkdir(VRF_NETNS_DIR, 0755) < 0 && errno != EEXIST) {
+        VLOG_ERR("Unable to create %s, errno %d", VRF_NETNS_DIR, errno);
+        return;
+    }
+    if (mount("", VRF_NETNS_DIR, "none", MS_SHARED | MS_REC, NULL) < 0) {
+        /* Not a mount point yet. */
+        if (mount(VRF_NETNS_DIR, VRF_NETNS_DIR, "none", MS_BIND | MS_REC,
+                  NULL) < 0
+            || mount("", VRF_NETNS_DIR, "none", MS_SHARED | MS_REC,
+                     NULL) < 0) {
+            VLOG_DBG("Unable to share %s, errno %d", VRF_NETNS_DIR, errno);
+        }
+    }
+}
+
+/***************************************************************************
+ * Runs a namespace batch on worker threads.
+ *
+ * @return number of requests that failed
+ ***************************************************************************/
+static int
+vrf_ns_batch_run (struct vrf_ns_req *reqs, size_t n_reqs,
+                  unsigned int n_threads, bool create)
+{
+    int failed = 0;
+    size_t i;
+
+    for (i = 0; i < n_reqs; i++) {
+        reqs[i].error = ECANCELED;
+    }
+    vrf_parallel_run(n_reqs, n_threads,
+                     create ? vrf_ns_create_item : vrf_ns_delete_item, reqs);
+
+    for (i = 0; i < n_reqs; i++) {
+        if (reqs[i].error) {
+            VLOG_ERR("Unable to %s namespace %s, errno %d",
+                     create ? "create" : "delete", reqs[i].ns_name,
+                     reqs[i].error);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/***************************************************************************
+ * Marks the namespace of a VRF as ready in its status column.
+ *
+ * @param[in]  vrf : VRF row, in an open transaction.
+ ***************************************************************************/
+void
+vrf_set_ready (const struct ovsrec_vrf *vrf)
+{
+    struct smap status;
+
+    smap_clone(&status, &vrf->status);
+    smap_replace(&status, VRF_STATUS_KEY, VRF_STATUS_VALUE);
+    ovsrec_vrf_set_status(vrf, &status);
+    smap_destroy(&status);
+}
+
+/***************************************************************************
+ * Creates the namespaces of a list of VRFs on worker threads.
+ *
+ * @param[in,out] reqs   : namespaces to create, 'error' is filled per item.
+ * @param[in]  n_reqs    : number of items in reqs.
+ * @param[in]  n_threads : number of worker threads, 0 for the default.
+ *
+ * @return number of items that failed
+ ***************************************************************************/
+int
+vrf_ns_create_batch (struct vrf_ns_req *reqs, size_t n_reqs,
+                     unsigned int n_threads)
+{
+    int failed;
+    size_t i;
+
+    vrf_ns_dir_init();
+    failed = vrf_ns_batch_run(reqs, n_reqs, n_threads, true);
+
+    /* OVSDB rows are only updated from the calling thread. */
+    for (i = 0; i < n_reqs; i++) {
+        if (!reqs[i].error && reqs[i].vrf) {
+            vrf_set_ready(reqs[i].vrf);
+        }
+    }
+    return failed;
+}
+
+/***************************************************************************
+ * Removes the namespaces of a list of VRFs on worker threads.
+ *
+ * @param[in,out] reqs   : namespaces to remove, 'error' is filled per item.
+ * @param[in]  n_reqs    : number of items in reqs.
+ * @param[in]  n_threads : number of worker threads, 0 for the default.
+ *
+ * @return number of items that failed
+ ***************************************************************************/
+int
+vrf_ns_delete_batch (struct vrf_ns_req *reqs, size_t n_reqs,
+                     unsigned int n_threads)
+{
+    return vrf_ns_batch_run(reqs, n_reqs, n_threads, false);
+}
+
+/* Sysctls to write in each namespace of a vrf_sysctl_batch() call. */
+struct vrf_sysctl_batch
+{
+    const char *const *ns_names;
+    const struct vrf_sysctl *sysctls;
+    size_t n_sysctls;
+    int *errors;
+};
+
+/***************************************************************************
+ * Converts a sysctl key to a path relative to /proc/sys: "a.b.c" becomes
+ * "a/b/c", keys that already contain a '/' (for interface names with a
+ * dot) are kept as they are.
+ ***************************************************************************/
+static void
+vrf_sysctl_path (const char *key, char *path, size_t size)
+{
+    char *p;
+
+    if (!strncmp(key, "/proc/sys/", strlen("/proc/sys/"))) {
+        key += strlen("/proc/sys/");
+    }
+    snprintf(path, size, "%s", key);
+    if (!strchr(path, '/')) {
+        for (p = path; *p; p++) {
+            if (*p == '.') {
+                *p = '/';
+            }
+        }
+    }
+}
+
+/***************************************************************************
+ * vrf_parallel_run() function writing all the sysctls in namespace i. The
+ * namespace is entered once, and the keys are opened relative to one
+ * /proc/sys descriptor, which resolves them in the current namespace.
+ ***************************************************************************/
+static void
+vrf_sysctl_item (size_t i, void *batch_)
+{
+    struct vrf_sysctl_batch *batch = batch_;
+    const char *ns_name = batch->ns_names[i];
+    int *errors = &batch->errors[i * batch->n_sysctls];
+    bool non_default_ns = is_nondefault_vrf(ns_name);
+    char path[PATH_MAX];
+    int orig_ns = -1, dir, fd, error = 0;
+    size_t k, len;
+    ssize_t n;
+
+    if (non_default_ns) {
+        orig_ns = vrf_thread_ns_open();
+        if (orig_ns < 0 || nl_setns_with_name(ns_name)) {
+            error = orig_ns < 0 ? errno : ENOENT;
+            goto out;
+        }
+    }
+    dir = open("/proc/sys", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir < 0) {
+        error = errno;
+        goto out;
+    }
+
+    for (k = 0; k < batch->n_sysctls; k++) {
+        vrf_sysctl_path(batch->sysctls[k].key, path, sizeof path);
+        fd = openat(dir, path, O_WRONLY | O_CLOEXEC);
+        if (fd < 0) {
+            errors[k] = errno;
+            continue;
+        }
+        len = strlen(batch->sysctls[k].value);
+        n = write(fd, batch->sysctls[k].value, len);
+        errors[k] = n < 0 ? errno : (size_t) n != len ? EIO : 0;
+        close(fd);
+    }
+    close(dir);
+
+out:
+    if (error) {
+        for (k = 0; k < batch->n_sysctls; k++) {
+            errors[k] = error;
+        }
+    }
+    if (orig_ns >= 0) {
+        if (setns(orig_ns, CLONE_NEWNET) < 0) {
+            VLOG_ERR("Unable to return to the parent namespace, errno %d",
+                     errno);
+        }
+        close(orig_ns);
+    }
+}
+
+/***************************************************************************
+ * Writes a list of sysctls in a list of VRF namespaces.
+ *
+ * @param[in]  ns_names  : namespaces, NULL or SWITCH_NAMESPACE for the
+ *                         default one.
+ * @param[in]  n_ns      : number of namespaces.
+ * @param[in]  sysctls   : sysctls to write in every namespace.
+ * @param[in]  n_sysctls : number of sysctls.
+ * @param[out] errors    : n_ns * n_sysctls results, errors[i * n_sysctls +
+ *                         k] for sysctl k in namespace i.
+ * @param[in]  n_threads : number of worker threads, 0 for the default.
+ *
+ * @return number of writes that failed
+ ***************************************************************************/
+int
+vrf_sysctl_batch (const char *const *ns_names, size_t n_ns,
+                  const struct vrf_sysctl *sysctls, size_t n_sysctls,
+                  int *errors, unsigned int n_threads)
+{
+    struct vrf_sysctl_batch batch;
+    int failed = 0;
+    size_t i;
+
+    for (i = 0; i < n_ns * n_sysctls; i++) {
+        errors[i] = ECANCELED;
+    }
+    if (!n_sysctls) {
+        return 0;
+    }
+
+    batch.ns_names = ns_names;
+    batch.sysctls = sysctls;
+    batch.n_sysctls = n_sysctls;
+    batch.errors = errors;
+    vrf_parallel_run(n_ns, n_threads, vrf_sysctl_item, &batch);
+
+    for (i = 0; i < n_ns * n_sysctls; i++) {
+        if (errors[i]) {
+            VLOG_DBG("Unable to set %s in namespace %s, errno %d",
+                     sysctls[i % n_sysctls].key,
+                     ns_names[i / n_sysctls] ? ns_names[i / n_sysctls]
+                                             : SWITCH_NAMESPACE,
+                     errors[i]);
+            failed++;
+        }
+    }
+    return failed;
+}
+
+/* Sockets of a vrf_create_reuseport_group() call. */
+struct vrf_reuseport_group
+{
+    const struct vrf_sock_params *params;
+    const struct sockaddr *addr;
+    socklen_t addrlen;
+    int *fds;
+    size_t n_socks;
+    bool cpu_steering;
+};
+
+/***************************************************************************
+ * Makes the kernel pick the socket of a reuseport group from the CPU that
+ * received the packet: socket (cpu % n_socks).
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+static int
+vrf_reuseport_steer_cpu (int fd, size_t n_socks)
+{
+    struct sock_filter code[] = {
+        /* A = CPU of the packet. */
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },
+        /* A = A % n_socks. */
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, n_socks },
+        /* Socket A of the group. */
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog prog;
+
+    prog.len = ARRAY_SIZE(code);
+    prog.filter = code;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                   sizeof prog) < 0) {
+        return errno;
+    }
+    return 0;
+}
+
+/***************************************************************************
+ * Creates and binds the sockets of a reuseport group in the namespace of
+ * the calling thread. Nothing is left open on failure.
+ ***************************************************************************/
+static int
+vrf_reuseport_group_open (void *group_)
+{
+    struct vrf_reuseport_group *group = group_;
+    const struct nl_sock_params *params = &group->params->nl_params;
+    int one = 1, error = 0;
+    size_t i, n_open;
+
+    for (n_open = 0; n_open < group->n_socks; n_open++) {
+        group->fds[n_open] = socket(params->family, params->type,
+                                    params->protocol);
+        if (group->fds[n_open] < 0) {
+            error = errno;
+            group->fds[n_open] = -1;
+            break;
+        }
+        if (setsockopt(group->fds[n_open], SOL_SOCKET, SO_REUSEPORT, &one,
+                       sizeof one) < 0
+            || bind(group->fds[n_open], group->addr, group->addrlen) < 0) {
+            error = errno;
+            close(group->fds[n_open]);
+            group->fds[n_open] = -1;
+            break;
+        }
+    }
+    if (!error && group->cpu_steering) {
+        error = vrf_reuseport_steer_cpu(group->fds[0], group->n_socks);
+    }
+
+    if (error) {
+        for (i = 0; i < n_open; i++) {
+            close(group->fds[i]);
+            group->fds[i] = -1;
+        }
+    }
+    return error;
+}
+
+/***************************************************************************
+ * Creates a group of sockets bound to the same address with SO_REUSEPORT
+ * in a VRF namespace, one per receiving thread.
+ *
+ * @param[in]  vrf_ns_name  : namespace of the sockets.
+ * @param[in]  params       : family, type and protocol of the sockets.
+ * @param[in]  addr         : address to bind the sockets to.
+ * @param[in]  addrlen      : length of addr.
+ * @param[out] fds          : the n_socks sockets, -1 on failure.
+ * @param[in]  n_socks      : number of sockets.
+ * @param[in]  cpu_steering : true to pick the socket from the receive CPU.
+ *
+ * @return 0 if sucessful, else an errno value
+ ***************************************************************************/
+int
+vrf_create_reuseport_group (const char *vrf_ns_name,
+                            const struct vrf_sock_params *params,
+                            const struct sockaddr *addr, socklen_t addrlen,
+                            int *fds, size_t n_socks, bool cpu_steering)
+{
+    struct vrf_reuseport_group group;
+    size_t i;
+    int error;
+
+    if (!n_socks) {
+        return EINVAL;
+    }
+    for (i = 0; i < n_socks; i++) {
+        fds[i] = -1;
+    }
+
+    group.params = params;
+    group.addr = addr;
+    group.addrlen = addrlen;
+    group.fds = fds;
+    group.n_socks = n_socks;
+    group.cpu_steering = cpu_steering;
+    if (is_nondefault_vrf(vrf_ns_name)) {
+        error = vrf_exec(vrf_ns_name, vrf_reuseport_group_open, &group, 0);
+    } else {
+        error = vrf_reuseport_group_open(&group);
+    }
+
+    if (error) {
+        VLOG_ERR("Unable to create %d reuseport sockets in namespace %s, "
+                 "error %d", (int) n_socks,
+                 vrf_ns_name ? vrf_ns_name : SWITCH_NAMESPACE, error);
+    }
+    return error;
+}
+
+/***************************************************************************
+ * Finds the name under VRF_NETNS_DIR of the namespace with the given
+ * identity, empty if it has none.
+ ***************************************************************************/
+static void
+vrf_ns_name_lookup (dev_t dev, ino_t ino, char *ns_name, size_t size)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+    DIR *dir;
+
+    ns_name[0] = '\0';
+    if (!(dir = opendir(VRF_NETNS_DIR))) {
+        return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        snprintf(path, sizeof path, VRF_NETNS_DIR "/%s", de->d_name);
+        if (de->d_name[0] != '.' && !stat(path, &st)
+            && st.st_dev == dev && st.st_ino == ino) {
+            snprintf(ns_name, size, "%s", de->d_name);
+            break;
+        }
+    }
+    closedir(dir);
+}
+
+/************************************************************************//**
+ * Returns the entry of a VRF namespace in a socket cache, adding it with
+ * all its sockets set to -1 on first use. Entries are keyed by the device
+ * and inode of the namespace, which cannot be reused while a cached socket
+ * pins the namespace. The caller serializes access to the cache.
+ *
+ * @param[in]  cache       : hmap of struct vrf_sock_cache_entry.
+ * @param[in]  vrf_ns_name : namespace name, NULL or SWITCH_NAMESPACE for
+ *                           the namespace of the calling thread.
+ *
+ * @return the entry, or NULL if the namespace does not exist
+ ***************************************************************************/
+struct vrf_sock_cache_entry *
+vrf_sock_cache_get (struct hmap *cache, const char *vrf_ns_name)
+{
+    struct vrf_sock_cache_entry *entry;
+    char path[PATH_MAX];
+    struct stat st;
+    uint32_t hash;
+    size_t i;
+
+    if (is_nondefault_vrf(vrf_ns_name)) {
+        snprintf(path, sizeof path, VRF_NETNS_DIR "/%s", vrf_ns_name);
+    } else {
+        snprintf(path, sizeof path, "/proc/self/task/%ld/ns/net",
+                 (long int) syscall(SYS_gettid));
+    }
+    if (stat(path, &st)) {
+        VLOG_ERR("namespace %s not found. errstr = %s", path,
+                 strerror(errno));
+        return NULL;
+    }
+    hash = hash_int(st.st_ino, st.st_dev);
+
+    HMAP_FOR_EACH_WITH_HASH (entry, node, hash, cache) {
+        if (entry->dev == st.st_dev && entry->ino == st.st_ino) {
+            return entry;
+        }
+    }
+
+    entry = xzalloc(sizeof *entry);
+    entry->dev = st.st_dev;
+    entry->ino = st.st_ino;
+    for (i = 0; i < ARRAY_SIZE(entry->socks); i++) {
+        entry->socks[i] = -1;
+    }
+    if (is_nondefault_vrf(vrf_ns_name)) {
+        snprintf(entry->ns_name, sizeof entry->ns_name, "%s", vrf_ns_name);
+    } else {
+        vrf_ns_name_lookup(st.st_dev, st.st_ino, entry->ns_name,
+                           sizeof entry->ns_name);
+    }
+    hmap_insert(cache, &entry->node, hash);
+    return entry;
+}
+
+/************************************************************************//**
+ * Closes the sockets of a VRF namespace in a socket cache and removes its
+ * entry. The caller serializes access to the cache.
+ *
+ * @param[in]  cache       : hmap of struct vrf_sock_cache_entry.
+ * @param[in]  vrf_ns_name : namespace name, NULL for all of them.
+ ***************************************************************************/
+void
+vrf_sock_cache_flush (struct hmap *cache, const char *vrf_ns_name)
+{
+    struct vrf_sock_cache_entry *entry, *next;
+    size_t i;
+
+    HMAP_FOR_EACH_SAFE (entry, next, node, cache) {
+        if (vrf_ns_name && strcmp(entry->ns_name, vrf_ns_name)) {
+            continue;
+        }
+        for (i = 0; i < ARRAY_SIZE(entry->socks); i++) {
+            if (entry->socks[i] >= 0) {
+                close(entry->socks[i]);
+            }
+        }
+        hmap_remove(cache, &entry->node);
+        free(entry);
+    }
+}
@@ -0,0 +1,254 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * @ingroup vrf_utils
+ * Test of vrf_ns_create_batch(), vrf_ns_delete_batch() and vrf_exec().
+ *
+ * The test first moves to new user, mount and network namespaces, as
+ * "unshare -Urnm" does, and mounts a tmpfs on /var/run, so that it needs no
+ * privilege and leaves the host namespaces alone. It exits with 77 (skipped)
+ * when user namespaces are not available.
+ *
+ * @file
+ * Source file for the opsutils-vrf-ns-test program.
+ *
+ ****************************************************************************/
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "vrf-utils.h"
+
+#define TEST_N_NAMESPACES       16
+#define TEST_N_THREADS          4
+#define TEST_SKIP               77
+#define TEST_SLOW_MS            300
+#define TEST_SLOW_TIMEOUT_MS    50
+
+static int test_failures;
+
+#define TEST_CHECK(COND)                                                \
+    do {                                                                \
+        if (!(COND)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,      \
+                    __LINE__, #COND);                                   \
+            test_failures++;                                            \
+        }                                                               \
+    } while (0)
+
+/*
+ * Writes 'content' to the file 'path'.
+ */
+static int
+test_write_file (const char *path, const char *content)
+{
+    int fd, rc;
+
+    fd = open(path, O_WRONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    rc = write(fd, content, strlen(content)) == strlen(content) ? 0 : -1;
+    close(fd);
+    return rc;
+}
+
+/*
+ * Moves the process to new user, mount and network namespaces, mapped to
+ * root in the user namespace, with a private /var/run.
+ */
+static int
+test_enter_sandbox (void)
+{
+    char map[64];
+    uid_t uid = getuid();
+    gid_t gid = getgid();
+
+    if (unshare(CLONE_NEWUSER | CLONE_NEWNS | CLONE_NEWNET) < 0) {
+        return -1;
+    }
+    test_write_file("/proc/self/setgroups", "deny");
+    snprintf(map, sizeof map, "0 %u 1", (unsigned int) uid);
+    if (test_write_file("/proc/self/uid_map", map) < 0) {
+        return -1;
+    }
+    snprintf(map, sizeof map, "0 %u 1", (unsigned int) gid);
+    if (test_write_file("/proc/self/gid_map", map) < 0) {
+        return -1;
+    }
+    if (mount("", "/", NULL, MS_REC | MS_PRIVATE, NULL) < 0
+        || mount("none", "/var/run", "tmpfs", 0, NULL) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * vrf_exec() function checking that the loopback interface is up.
+ */
+static int
+test_loopback_up (void *aux)
+{
+    struct ifreq ifr;
+    int sock, error = 0;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return errno;
+    }
+    memset(&ifr, 0, sizeof ifr);
+    snprintf(ifr.ifr_name, sizeof ifr.ifr_name, "lo");
+    if (ioctl(sock, SIOCGIFFLAGS, &ifr) < 0) {
+        error = errno;
+    } else if (!(ifr.ifr_flags & IFF_UP)) {
+        error = ENETDOWN;
+    }
+    close(sock);
+    return error;
+}
+
+/*
+ * vrf_exec() function that runs for longer than its start timeout and
+ * returns a value of its own.
+ */
+static int
+test_slow_fn (void *aux)
+{
+    struct timespec ts = { 0, TEST_SLOW_MS * 1000000L };
+
+    nanosleep(&ts, NULL);
+    return EALREADY;
+}
+
+/*
+ * Returns the time read on 'clock_id' in milliseconds.
+ */
+static double
+test_clock_ms (clockid_t clock_id)
+{
+    struct timespec ts;
+
+    clock_gettime(clock_id, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void
+test_ns_path (const struct vrf_ns_req *req, char *path, size_t size)
+{
+    snprintf(path, size, "/var/run/netns/%s", req->ns_name);
+}
+
+int
+main (void)
+{
+    struct vrf_ns_req reqs[TEST_N_NAMESPACES];
+    struct stat st, st_self, st_first;
+    char path[PATH_MAX];
+    double cpu_ms, wall_ms;
+    size_t i;
+
+    if (test_enter_sandbox() < 0) {
+        fprintf(stderr, "user namespaces not available (%s), skipped\n",
+                strerror(errno));
+        return TEST_SKIP;
+    }
+
+    memset(reqs, 0, sizeof reqs);
+    for (i = 0; i < TEST_N_NAMESPACES; i++) {
+        snprintf(reqs[i].ns_name, sizeof reqs[i].ns_name, "vrf-ns-test-%d",
+                 (int) i);
+    }
+
+    /* Creation: one namespace per request, all different from ours. */
+    TEST_CHECK(vrf_ns_create_batch(reqs, TEST_N_NAMESPACES,
+                                   TEST_N_THREADS) == 0);
+    TEST_CHECK(stat("/proc/self/ns/net", &st_self) == 0);
+    for (i = 0; i < TEST_N_NAMESPACES; i++) {
+        TEST_CHECK(reqs[i].error == 0);
+        test_ns_path(&reqs[i], path, sizeof path);
+        TEST_CHECK(stat(path, &st) == 0);
+        TEST_CHECK(st.st_ino != st_self.st_ino);
+        if (i == 0) {
+            st_first = st;
+        } else {
+            TEST_CHECK(st.st_ino != st_first.st_ino);
+        }
+        TEST_CHECK(vrf_exec(reqs[i].ns_name, test_loopback_up, NULL,
+                            0) == 0);
+    }
+
+    /* Creating them again fails with EEXIST and keeps them. */
+    TEST_CHECK(vrf_ns_create_batch(reqs, TEST_N_NAMESPACES,
+                                   TEST_N_THREADS) == TEST_N_NAMESPACES);
+    for (i = 0; i < TEST_N_NAMESPACES; i++) {
+        TEST_CHECK(reqs[i].error == EEXIST);
+        test_ns_path(&reqs[i], path, sizeof path);
+        TEST_CHECK(stat(path, &st) == 0);
+    }
+
+    /* A function that started in time returns its own result, even if it
+     * runs past the timeout, and is waited for without spinning. */
+    cpu_ms = test_clock_ms(CLOCK_PROCESS_CPUTIME_ID);
+    wall_ms = test_clock_ms(CLOCK_MONOTONIC);
+    TEST_CHECK(vrf_exec(reqs[0].ns_name, test_slow_fn, NULL,
+                        TEST_SLOW_TIMEOUT_MS) == EALREADY);
+    cpu_ms = test_clock_ms(CLOCK_PROCESS_CPUTIME_ID) - cpu_ms;
+    wall_ms = test_clock_ms(CLOCK_MONOTONIC) - wall_ms;
+    TEST_CHECK(wall_ms >= TEST_SLOW_MS);
+    TEST_CHECK(cpu_ms < TEST_SLOW_MS / 2);
+
+    /* Removal. */
+    TEST_CHECK(vrf_ns_delete_batch(reqs, TEST_N_NAMESPACES,
+                                   TEST_N_THREADS) == 0);
+    for (i = 0; i < TEST_N_NAMESPACES; i++) {
+        TEST_CHECK(reqs[i].error == 0);
+        test_ns_path(&reqs[i], path, sizeof path);
+        TEST_CHECK(stat(path, &st) < 0 && errno == ENOENT);
+    }
+
+    /* Removing them again fails with ENOENT. */
+    TEST_CHECK(vrf_ns_delete_batch(reqs, TEST_N_NAMESPACES,
+                                   TEST_N_THREADS) == TEST_N_NAMESPACES);
+    for (i = 0; i < TEST_N_NAMESPACES; i++) {
+        TEST_CHECK(reqs[i].error == ENOENT);
+    }
+
+    /* Entering a removed namespace is reported, not fatal. */
+    TEST_CHECK(vrf_exec(reqs[0].ns_name, test_loopback_up, NULL, 0)
+               == ENOENT);
+
+    if (test_failures) {
+        fprintf(stderr, "%d checks failed\n", test_failures);
+        return EXIT_FAILURE;
+    }
+    printf("vrf-ns-test: all checks passed\n");
+    return EXIT_SUCCESS;
+}